@@ -33,5 +33,21 @@ if (OPENMP_FOUND)
 	endif()
 endif()
 
+# The single-precision flavour of FFTW is optional, but if present it must
+# also come with OpenMP support when the double-precision one does
+find_library(FFTW_FLOAT_LIB NAMES fftw3f)
+if (EXISTS ${FFTW_FLOAT_LIB})
+	if (FFTW_OPENMP_FOUND)
+		find_library(FFTW_FLOAT_OPENMP_LIB NAMES fftw3f_omp)
+		if (EXISTS ${FFTW_FLOAT_OPENMP_LIB})
+			set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${FFTW_FLOAT_LIB} ${FFTW_FLOAT_OPENMP_LIB})
+			set(FFTW_FLOAT_FOUND ON)
+		endif()
+	else()
+		set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${FFTW_FLOAT_LIB})
+		set(FFTW_FLOAT_FOUND ON)
+	endif()
+endif()
+
 include(FindPackageHandleStandardArgs)
 find_package_handle_standard_args(FFTW DEFAULT_MSG FFTW_LIBRARIES FFTW_INCLUDE_DIR)
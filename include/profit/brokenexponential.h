@@ -62,11 +62,16 @@ protected:
 	 * Inherited from RadialProfile
 	 * ----------------------------
 	 */
+	void initial_calculations() override;
 	double get_lumtot() override;
 	double get_rscale() override;
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -99,6 +104,17 @@ private:
 	double a;
 	// @}
 
+	double (*m_eval_function)(double x, double y, double box, double h1, double h2, double rb, double a);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double h1, double h2, double rb, double a);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double h1, double h2, double rb, double a);
+
+	template <bool boxy>
+	void init_eval_function();
+
 	double integrate_at(double r) const;
 
 #ifdef PROFIT_OPENCL
@@ -54,6 +54,15 @@ enum ConvolverType {
 
 	/// @copydoc FFTConvolver
 	FFT,
+
+	/// Like @ref FFT, but carrying out FFTs in single precision
+	FFT_FLOAT,
+
+	/// @copydoc TiledFFTConvolver
+	FFT_TILED,
+
+	/// @copydoc LowRankConvolver
+	LOW_RANK,
 };
 
 /**
@@ -98,6 +107,27 @@ public:
 	Image convolve(const Image &src, const Image &krn, const Mask &mask,
 	               bool crop = true, Point &offset_out = NO_OFFSET);
 
+	/**
+	 * Convolves each of the images in @p srcs with the kernel `krn`, like
+	 * convolve(const Image &, const Image &, const Mask &, bool, Point &)
+	 * does. All images in @p srcs must have the same dimensions, and
+	 * therefore the same potential offset is stored in @p offset_out.
+	 *
+	 * Convolvers can share work among the images of the batch (e.g., the
+	 * kernel's transformation), and perform the convolutions together.
+	 *
+	 * @param srcs The source images
+	 * @param krn The convolution kernel
+	 * @param mask An mask indicating which pixels of the resulting images
+	 *             should be convolved
+	 * @param crop See convolve(const Image &, const Image &, const Mask &, bool, Point &)
+	 * @param offset_out See convolve(const Image &, const Image &, const Mask &, bool, Point &)
+	 * @return The convolved images, in the same order as @p srcs
+	 */
+	std::vector<Image> convolve(const std::vector<Image> &srcs, const Image &krn,
+	                            const Mask &mask, bool crop = true,
+	                            Point &offset_out = NO_OFFSET);
+
 	/**
 	 * Returns the amount of padding that would be introduced by this convolver
 	 * when convolving an image and a kernel of sizes @p src_dims and @p
@@ -122,6 +152,13 @@ protected:
 	Image convolve_impl(const Image &src, const Image &krn, const Mask &mask,
 	                    bool crop = true, Point &offset_out = NO_OFFSET) = 0;
 
+	// Called by convolve for batches of images. By default it convolves each
+	// image in turn
+	virtual
+	std::vector<Image> convolve_batch_impl(const std::vector<Image> &srcs,
+	                                       const Image &krn, const Mask &mask,
+	                                       bool crop, Point &offset_out);
+
 	Image mask_and_crop(Image &img, const Mask &mask, bool crop,
 	                    const Dimensions &orig_dims, const Dimensions &ext_dims,
 	                    const Point &ext_offset, Point &offset_out);
@@ -140,7 +177,8 @@ public:
 		opencl_env(),
 		effort(effort_t::ESTIMATE),
 		reuse_krn_fft(false),
-		instruction_set(simd_instruction_set::AUTO)
+		instruction_set(simd_instruction_set::AUTO),
+		low_rank_tolerance(1e-6)
 	{};
 
 	ConvolverCreationPreferences(
@@ -153,7 +191,8 @@ public:
 		opencl_env(opencl_env),
 		effort(effort),
 		reuse_krn_fft(reuse_krn_fft),
-		instruction_set(instruction_set)
+		instruction_set(instruction_set),
+		low_rank_tolerance(1e-6)
 	{};
 
 
@@ -164,21 +203,28 @@ public:
 	Dimensions krn_dims;
 
 	/// The amount of OpenMP threads (if OpenMP is available) to use by the
-	/// convolver. Used by the FFT convolver (to create and execute the plan
-	/// using OpenMP, when available) and the brute-force convolvers.
+	/// convolver. Used by the FFT convolvers (to create and execute the plan
+	/// using OpenMP, when available), the tiled FFT convolver (to convolve
+	/// tiles in parallel) and the brute-force convolvers.
 	unsigned int omp_threads;
 
 	/// A pointer to an OpenCL environment. Used by the OPENCL convolvers.
 	OpenCLEnvPtr opencl_env;
 
-	/// The amount of effort to put into the plan creation. Used by the @ref FFT convolver.
+	/// The amount of effort to put into the plan creation. Used by the @ref FFT, @ref FFT_FLOAT and @ref FFT_TILED convolvers.
 	effort_t effort;
 
-	/// Whether to reuse or not the FFT'd kernel or not. Used by the @ref FFT convolver.
+	/// Whether to reuse or not the FFT'd kernel or not. Used by the @ref FFT, @ref FFT_FLOAT and @ref FFT_TILED convolvers.
 	bool reuse_krn_fft;
 
-	/// The extended instruction set to use. Used by the @ref BRUTE convolver
+	/// The extended instruction set to use. Used by the @ref BRUTE and
+	/// @ref LOW_RANK convolvers
 	simd_instruction_set instruction_set;
+
+	/// The maximum residual allowed when approximating the kernel by a sum of
+	/// separable kernels (see low_rank_kernel). Used by the @ref LOW_RANK
+	/// convolver
+	double low_rank_tolerance;
 };
 
 /// Handy typedef for shared pointers to Convolver objects
@@ -205,6 +251,46 @@ PROFIT_API ConvolverPtr
 create_convolver(const std::string &type,
                  const ConvolverCreationPreferences &prefs = ConvolverCreationPreferences());
 
+/**
+ * A convolution kernel approximated by a sum of separable (i.e., rank-1)
+ * kernels.
+ *
+ * Each separable kernel is the outer product of a vertical and a horizontal
+ * factor, so that the approximated kernel's value at ``(x, y)`` is the sum of
+ * ``columns[t][y] * rows[t][x]`` over all terms ``t``.
+ */
+class PROFIT_API LowRankKernel {
+
+public:
+	/// The vertical factors of each term, as long as the kernel's height
+	std::vector<std::vector<double>> columns;
+
+	/// The horizontal factors of each term, as long as the kernel's width
+	std::vector<std::vector<double>> rows;
+
+	/// The Frobenius norm of the difference between the kernel and its
+	/// approximation, relative to the Frobenius norm of the kernel
+	double residual;
+
+	/// Returns the number of separable terms of the approximation
+	unsigned int rank() const {
+		return static_cast<unsigned int>(rows.size());
+	}
+};
+
+/**
+ * Approximates @p krn by the sum of the fewest separable kernels whose
+ * residual (see LowRankKernel::residual) is not greater than @p tolerance.
+ * The approximation is calculated from the singular value decomposition of
+ * @p krn, which makes it the best possible for its rank.
+ *
+ * @param krn The kernel to approximate
+ * @param tolerance The maximum residual allowed. A tolerance of 0 yields the
+ * kernel's full decomposition
+ * @return The approximated kernel
+ */
+PROFIT_API LowRankKernel low_rank_kernel(const Image &krn, double tolerance);
+
 } /* namespace profit */
 
 #endif /* PROFIT_CONVOLVE_H */
\ No newline at end of file
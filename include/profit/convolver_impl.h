@@ -26,6 +26,7 @@
 
 #include "profit/convolve.h"
 #include "profit/fft_impl.h"
+#include "profit/omp_utils.h"
 #include "profit/opencl_impl.h"
 
 namespace profit {
@@ -60,13 +61,19 @@ private:
  * because IEEE floating-point math is not associative, and therefore different
  * operation sequences *might* yield different results.
  *
- * The internal loop structure of this class is also slightly different from
- * BruteForceConvolver, but is still pure CPU-based code.
+ * The internal loop structure of this class is also different from
+ * BruteForceConvolver, but is still pure CPU-based code. Output pixels are
+ * convolved in blocks of four SIMD vectors' worth of adjacent pixels of the
+ * same row, which are accumulated in registers: each kernel coefficient is
+ * loaded once per block and multiplied against all of the block's pixels.
+ * Kernel rows are visited in chunks that stay in the L1 cache while they are
+ * applied to all blocks of a row, and blocks without any unmasked pixels are
+ * skipped.
  *
  * Additionally, and depending on the underlying CPU support, this convolver
- * can use dot product implementations based on SIMD operations available in
- * different CPU extended instruction sets. The default is to use the fastest
- * one available, although users might want to use a different one.
+ * can use SIMD operations available in different CPU extended instruction
+ * sets. The default is to use the fastest one available, although users might
+ * want to use a different one.
  */
 template <simd_instruction_set SIMD>
 class AssociativeBruteForceConvolver : public Convolver {
@@ -81,6 +88,42 @@ private:
 	unsigned int omp_threads;
 };
 
+/**
+ * A convolver that approximates the kernel by a sum of a few separable
+ * kernels, and convolves with each of them as a horizontal one-dimensional
+ * convolution followed by a vertical one.
+ *
+ * The approximation (see low_rank_kernel) uses the fewest separable kernels
+ * whose residual is not greater than a given tolerance, and is calculated
+ * again only when a different kernel is given. Convolving an image of ``N``
+ * pixels with a ``Kw`` by ``Kh`` kernel approximated with ``k`` separable
+ * kernels thus takes ``O(N * k * (Kw + Kh))`` operations, instead of the
+ * ``O(N * Kw * Kh)`` of the brute-force convolvers. Smooth kernels like those
+ * of fitted Gaussian or Moffat profiles usually need very few terms.
+ *
+ * Like AssociativeBruteForceConvolver, horizontal passes use the SIMD dot
+ * product implementation for the given instruction set, and rows are
+ * processed in parallel using OpenMP, when available.
+ */
+template <simd_instruction_set SIMD>
+class LowRankConvolver : public Convolver {
+
+public:
+	LowRankConvolver(unsigned int omp_threads, double tolerance);
+
+protected:
+	Image convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool crop = true, Point &offset_out = NO_OFFSET) override;
+
+private:
+	unsigned int omp_threads;
+	double tolerance;
+
+	// The last kernel given, and the reversed factors of its approximation
+	Image krn;
+	std::vector<std::vector<double>> reversed_columns;
+	std::vector<std::vector<double>> reversed_rows;
+};
+
 #ifdef PROFIT_FFTW
 /**
  * A convolver that uses an FFTPlan to carry out FFT-based convolution.
@@ -89,21 +132,34 @@ private:
  *
  *  res = iFFT(FFT(im1) * FFT(im2))
  *
- * To do this, this convolver creates extended versions of the input images.
- * The size of the new images is 4 times that of the source image, which is
- * assumed to be larger than the kernel. The extended version of the source
- * image contains the original image at (0,0), while the extended version of the
- * kernel image contains the original kernel centered at the original image's
- * new mapping (i.e., ``((src_width-krn_width)/2, (src_height-krn_height)/2)``).
+ * To do this, this convolver creates extended versions of the input images,
+ * which are then transformed using two-dimensional real FFTs. The extended
+ * images are big enough to hold the linear convolution of the source image
+ * and the kernel (i.e., ``src_width + krn_width - 1`` by
+ * ``src_height + krn_height - 1``), rounded up on each dimension to the next
+ * number whose only prime factors are 2, 3, 5 and 7. The extended versions of
+ * both the source image and the kernel contain the originals at (0,0).
  * After convolution the result is cropped back (if required) to the original image's
- * dimensions starting at the center of the original image's mapping on the
- * extended image (i.e., ``(src_width/2, src_height/2)`` minus one if the
- * original dimensions are odd).
+ * dimensions starting at the kernel's centre (i.e.,
+ * ``(krn_width - 1 - krn_width/2, krn_height - 1 - krn_height/2)``).
+ * Single convolutions use pruned row-column FFTs that skip the zero rows below
+ * the source image and the kernel, and the rows of the result that are
+ * cropped away.
  *
  * This convolver has been implemented in such a way that no memory allocation
  * happens during convolution (other than the final Image's allocation) to
- * improve performance.
+ * improve performance. The extended images and their transforms live in
+ * FFTW-aligned buffers that FFTW plans operate on directly, and the plans
+ * themselves are shared with all other FFT convolvers in the process.
+ *
+ * FFTs are carried out in the floating-point precision given by @p FT, while
+ * input and output images stay in double precision. Single-precision FFTs
+ * halve the memory traffic and double the SIMD throughput of the
+ * transformations, at the cost of absolute errors of about ``1e-6`` times the
+ * peak value of the result, instead of about ``1e-15`` with double-precision
+ * FFTs.
  */
+template <typename FT>
 class FFTConvolver : public Convolver {
 
 public:
@@ -115,19 +171,86 @@ public:
 
 protected:
 	Image convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool crop = true, Point &offset_out = NO_OFFSET) override;
+	std::vector<Image> convolve_batch_impl(const std::vector<Image> &srcs, const Image &krn, const Mask &mask, bool crop, Point &offset_out) override;
 
 private:
 
 	void resize(const Dimensions &src_dims, const Dimensions &krn_dims);
 
+	// Transforms the kernel into krn_fft, unless it can be reused
+	void transform_krn(const Image &krn);
+
+	// Makes room for batches of up to batch_size images
+	void resize_batch(unsigned int batch_size);
+
 	Point offset_after_convolution(const Dimensions &src_dims, const Dimensions &krn_dims) const;
 
-	std::unique_ptr<FFTRealTransformer> fft_transformer;
+	// Scales down the inverse FFT in ext, whose rows are row_stride numbers
+	// apart, and crops/masks it into an Image
+	Image result_from(const FT *ext, std::size_t row_stride, const Dimensions &src_dims,
+	                  const Dimensions &krn_dims, const Mask &mask, bool crop, Point &offset_out);
+
+	std::unique_ptr<FFTRealTransformer<FT>> fft_transformer;
+
+	Dimensions ext_dims;
+	fftw_array<FT, std::complex<FT>> src_fft;
+	fftw_array<FT, std::complex<FT>> krn_fft;
+	fftw_array<FT, FT> ext_src;
+	fftw_array<FT, FT> ext_krn;
+
+	// Used when convolving batches of images, which are transformed in place
+	unsigned int batch_capacity;
+	fftw_array<FT, std::complex<FT>> batch_data;
+
+	bool reuse_krn_fft;
+	bool krn_fft_initialized;
+};
+
+/**
+ * A convolver that carries out FFT-based convolution tile by tile using the
+ * overlap-save method.
+ *
+ * The source image is split into tiles that are convolved independently
+ * using FFTs of ``tile_width + krn_width - 1`` by
+ * ``tile_height + krn_height - 1`` pixels, which include the parts of the
+ * source image surrounding the tile the kernel reaches into. FFTs are sized
+ * to fit in the processor's caches, and all tiles use the same FFT plans and
+ * the same FFT of the kernel. Tiles are convolved in parallel using
+ * ``omp_threads`` OpenMP threads, each on its own set of buffers, so memory
+ * usage is bounded by the size of the tiles rather than by the size of the
+ * image. Tiles where the mask has no pixels set are not convolved at all.
+ *
+ * Convolution results are the same as those of FFTConvolver, except that
+ * no padding is ever introduced.
+ */
+class TiledFFTConvolver : public Convolver {
+
+public:
+	explicit TiledFFTConvolver(const Dimensions &src_dims, const Dimensions &krn_dims,
+	             effort_t effort, unsigned int omp_threads,
+	             bool reuse_krn_fft);
+
+protected:
+	Image convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool crop = true, Point &offset_out = NO_OFFSET) override;
+
+private:
+
+	void resize(const Dimensions &src_dims, const Dimensions &krn_dims);
+
+	// Transforms the kernel into krn_fft, unless it can be reused
+	void transform_krn(const Image &krn);
+
+	// Convolves the source pixels of tile into result
+	void convolve_tile(const Image &src, const grid_tile &tile, Image &result) const;
+
+	unsigned int omp_threads;
+	FFTRealTransformer<double> fft_transformer;
 
-	std::vector<std::complex<double>> src_fft;
-	std::vector<std::complex<double>> krn_fft;
-	Image ext_src;
-	Image ext_krn;
+	Dimensions krn_dims;
+	Dimensions fft_dims;
+	Dimensions tile_dims;
+	fftw_array<double, std::complex<double>> krn_fft;
+	fftw_array<double, double> ext_krn;
 
 	bool reuse_krn_fft;
 	bool krn_fft_initialized;
@@ -71,6 +71,10 @@ protected:
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -110,6 +114,26 @@ private:
 
 	/* internally calculated when the profile is evaluated */
 	double _bn;
+	double _rb_a;
+	double _re_a;
+
+	double (*m_eval_function)(double x, double y, double box, double rb, double nser,
+	    double a, double b, double bn, double rb_a, double re_a);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double rb, double nser, double a, double b, double bn, double rb_a, double re_a);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double rb, double nser, double a, double b, double bn, double rb_a, double re_a);
+
+	template <bool boxy, radial_exponent t_a, radial_exponent t_n>
+	void init_eval_function();
+
+	template <bool boxy, radial_exponent t_a>
+	void init_eval_function(radial_exponent t_n);
+
+	template <bool boxy>
+	void init_eval_function(radial_exponent t_a, radial_exponent t_n);
 
 	double integrate_at(double r) const;
 
@@ -63,11 +63,17 @@ protected:
 	 * Inherited from RadialProfile
 	 * ----------------------------
 	 */
+	void initial_calculations() override;
 	double get_lumtot() override;
 	double get_rscale() override;
+	double get_rscale_edge() override;
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -95,6 +101,23 @@ private:
 	double b;
 	// @}
 
+	double (*m_eval_function)(double x, double y, double box, double rscale, double a, double b);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double rscale, double a, double b);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double rscale, double a, double b);
+
+	template <bool boxy, radial_exponent t_rf, radial_exponent t_a>
+	void init_eval_function();
+
+	template <bool boxy, radial_exponent t_rf>
+	void init_eval_function(radial_exponent t_a);
+
+	template <bool boxy>
+	void init_eval_function(radial_exponent t_rf, radial_exponent t_a);
+
 #ifdef PROFIT_OPENCL
 
 protected:
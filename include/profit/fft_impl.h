@@ -30,52 +30,256 @@
 #ifdef PROFIT_FFTW
 
 #include <complex>
+#include <cstddef>
+#include <map>
 #include <memory>
 #include <mutex>
-#include <vector>
+#include <new>
 
 #include <fftw3.h>
 
 #include "profit/common.h"
 #include "profit/fft.h"
+#include "profit/image.h"
 
 namespace profit {
 
+/**
+ * The FFTW API for each floating-point type: @c fftw_* functions for doubles,
+ * and @c fftwf_* functions for floats.
+ */
+template <typename FT>
+struct fftw_traits;
+
+template <>
+struct fftw_traits<double> {
+	typedef fftw_complex complex;
+	typedef fftw_plan_s plan_s;
+	static void *malloc(std::size_t n) { return fftw_malloc(n); }
+	static void free(void *p) { fftw_free(p); }
+	static void destroy_plan(plan_s *p) { fftw_destroy_plan(p); }
+	static void execute_dft_r2c(plan_s *p, double *in, complex *out) { fftw_execute_dft_r2c(p, in, out); }
+	static void execute_dft_c2r(plan_s *p, complex *in, double *out) { fftw_execute_dft_c2r(p, in, out); }
+	static void execute_dft(plan_s *p, complex *in, complex *out) { fftw_execute_dft(p, in, out); }
+	static int alignment_of(double *p) { return fftw_alignment_of(p); }
+	static void plan_with_nthreads(int n) {
+#ifdef PROFIT_FFTW_OPENMP
+		fftw_plan_with_nthreads(n);
+#else
+		UNUSED(n);
+#endif /* PROFIT_FFTW_OPENMP */
+	}
+	static plan_s *plan_dft_r2c_2d(int n0, int n1, double *in, complex *out, unsigned flags) {
+		return fftw_plan_dft_r2c_2d(n0, n1, in, out, flags);
+	}
+	static plan_s *plan_dft_c2r_2d(int n0, int n1, complex *in, double *out, unsigned flags) {
+		return fftw_plan_dft_c2r_2d(n0, n1, in, out, flags);
+	}
+	static plan_s *plan_many_dft_r2c(int rank, const int *n, int howmany,
+	    double *in, const int *inembed, int istride, int idist,
+	    complex *out, const int *onembed, int ostride, int odist, unsigned flags) {
+		return fftw_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, flags);
+	}
+	static plan_s *plan_many_dft_c2r(int rank, const int *n, int howmany,
+	    complex *in, const int *inembed, int istride, int idist,
+	    double *out, const int *onembed, int ostride, int odist, unsigned flags) {
+		return fftw_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, flags);
+	}
+	static plan_s *plan_many_dft(int rank, const int *n, int howmany,
+	    complex *in, const int *inembed, int istride, int idist,
+	    complex *out, const int *onembed, int ostride, int odist, int sign, unsigned flags) {
+		return fftw_plan_many_dft(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, sign, flags);
+	}
+};
+
+#ifdef PROFIT_FFTW_FLOAT
+template <>
+struct fftw_traits<float> {
+	typedef fftwf_complex complex;
+	typedef fftwf_plan_s plan_s;
+	static void *malloc(std::size_t n) { return fftwf_malloc(n); }
+	static void free(void *p) { fftwf_free(p); }
+	static void destroy_plan(plan_s *p) { fftwf_destroy_plan(p); }
+	static void execute_dft_r2c(plan_s *p, float *in, complex *out) { fftwf_execute_dft_r2c(p, in, out); }
+	static void execute_dft_c2r(plan_s *p, complex *in, float *out) { fftwf_execute_dft_c2r(p, in, out); }
+	static void execute_dft(plan_s *p, complex *in, complex *out) { fftwf_execute_dft(p, in, out); }
+	static int alignment_of(float *p) { return fftwf_alignment_of(p); }
+	static void plan_with_nthreads(int n) {
+#ifdef PROFIT_FFTW_OPENMP
+		fftwf_plan_with_nthreads(n);
+#else
+		UNUSED(n);
+#endif /* PROFIT_FFTW_OPENMP */
+	}
+	static plan_s *plan_dft_r2c_2d(int n0, int n1, float *in, complex *out, unsigned flags) {
+		return fftwf_plan_dft_r2c_2d(n0, n1, in, out, flags);
+	}
+	static plan_s *plan_dft_c2r_2d(int n0, int n1, complex *in, float *out, unsigned flags) {
+		return fftwf_plan_dft_c2r_2d(n0, n1, in, out, flags);
+	}
+	static plan_s *plan_many_dft_r2c(int rank, const int *n, int howmany,
+	    float *in, const int *inembed, int istride, int idist,
+	    complex *out, const int *onembed, int ostride, int odist, unsigned flags) {
+		return fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, flags);
+	}
+	static plan_s *plan_many_dft_c2r(int rank, const int *n, int howmany,
+	    complex *in, const int *inembed, int istride, int idist,
+	    float *out, const int *onembed, int ostride, int odist, unsigned flags) {
+		return fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, flags);
+	}
+	static plan_s *plan_many_dft(int rank, const int *n, int howmany,
+	    complex *in, const int *inembed, int istride, int idist,
+	    complex *out, const int *onembed, int ostride, int odist, int sign, unsigned flags) {
+		return fftwf_plan_many_dft(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, sign, flags);
+	}
+};
+#endif /* PROFIT_FFTW_FLOAT */
+
 /**
  * A deleter class that we can use for our unique_ptr objects holding
  * FFTW-allocated arrays.
  */
-template <typename T>
+template <typename FT, typename T>
 class fftw_deleter {
 public:
 	void operator()(T *x) {
-		fftw_free(x);
+		fftw_traits<FT>::free(x);
 	}
 };
 
+template <typename FT>
 class fftw_plan_destroyer {
 public:
-	void operator()(fftw_plan_s *p) {
-		fftw_destroy_plan(p);
+	void operator()(typename fftw_traits<FT>::plan_s *p) {
+		fftw_traits<FT>::destroy_plan(p);
 	}
 };
 
+/**
+ * An array allocated with FFTW's malloc function, and therefore aligned as
+ * FFTW plans expect for their SIMD code paths.
+ */
+template <typename FT, typename T>
+using fftw_array = std::unique_ptr<T[], fftw_deleter<FT, T>>;
+
+/**
+ * Allocates an fftw_array of @p size elements of type @p T.
+ *
+ * @param size The number of elements in the array
+ * @return The new array. Its elements are not initialized
+ */
+template <typename FT, typename T>
+fftw_array<FT, T> make_fftw_array(std::size_t size)
+{
+	T *buf = static_cast<T *>(fftw_traits<FT>::malloc(sizeof(T) * size));
+	if (!buf) {
+		throw std::bad_alloc();
+	}
+	return fftw_array<FT, T>(buf);
+}
+
+/**
+ * The kinds of FFT plans kept in the plans registry
+ */
+enum fft_plans_kind {
+
+	/// Two-dimensional real transforms of batches of contiguous inputs
+	FFT_2D = 0,
+
+	/// One-dimensional real transforms of the rows of part of a
+	/// two-dimensional input, for the first pass of a row-column transform
+	FFT_ROWS,
+
+	/// One-dimensional, in-place complex transforms of the columns of a
+	/// two-dimensional hermitian array, for the second pass of a row-column
+	/// transform
+	FFT_COLUMNS,
+
+	/// Two-dimensional, in-place real transforms of batches of contiguous
+	/// inputs whose rows are padded to ``2 * (width / 2 + 1)`` numbers, the
+	/// size of their hermitian rows
+	FFT_2D_IN_PLACE,
+};
+
+/**
+ * A pair of forward and backward FFT plans.
+ *
+ * Plans are created with FFTW_DESTROY_INPUT for transformations between
+ * arrays allocated with FFTW's malloc, and are only ever executed
+ * through FFTW's new-array execution functions. Because of this they don't
+ * belong to any particular set of buffers, and can be shared (and executed
+ * concurrently) by any number of users. In-place plans must be executed in
+ * place too.
+ */
+template <typename FT>
+class FFTPlans {
+
+public:
+	typedef typename fftw_traits<FT>::plan_s plan_s;
+	typedef std::unique_ptr<plan_s, fftw_plan_destroyer<FT>> plan_ptr;
+
+	FFTPlans(plan_ptr &&forward, plan_ptr &&backward) :
+		forward(std::move(forward)),
+		backward(std::move(backward))
+	{}
+
+	/// Plans are destroyed while holding fftw_mutex
+	~FFTPlans();
+
+	plan_ptr forward;
+	plan_ptr backward;
+};
+
+/**
+ * Returns the plans of kind @p kind for transforming inputs of dimensions
+ * @p dims. FFT_2D and FFT_2D_IN_PLACE plans transform @p howmany contiguous
+ * inputs, FFT_ROWS plans transform the first @p howmany rows of their input,
+ * and FFT_COLUMNS plans transform all columns of their (hermitian) input.
+ *
+ * Plans live in a process-wide registry keyed by kind, dimensions, number of
+ * transforms, effort and number of threads, so all convolvers in the process
+ * share them. Plans are created on their first request.
+ *
+ * @param kind The kind of plans
+ * @param dims The dimensions of the (real) input
+ * @param howmany The number of inputs, or rows, transformed together
+ * @param effort The kind of effort that should be put into creating the plans
+ * @param omp_threads The number of threads to use to execute the plans
+ * @return The shared plans
+ */
+template <typename FT>
+std::shared_ptr<const FFTPlans<FT>> get_fft_plans(fft_plans_kind kind,
+    const Dimensions &dims, unsigned int howmany, effort_t effort, unsigned int omp_threads);
+
+/**
+ * Drops the references the registry holds to all plans. Plans still in use
+ * are destroyed when their last user releases them.
+ *
+ * This method must not be called while holding fftw_mutex.
+ */
+void clear_fft_plans();
+
 /**
  * An FFT transformer that turns real numbers into complex numbers and back.
  *
  * Instances of this class are able to perform forward FFT transformation
- * from a collection of double values into its corresponding complex series and
- * back using hermitian redundancy. The forward and backward transformations
- * occur in an internal buffer, but they allow users to pass collections of the
- * corresponding type to store the output of the operation, thus avoiding
- * dynamic memory allocation.
+ * from a collection of real values into its corresponding complex series and
+ * back using hermitian redundancy. Data can be transformed either as a
+ * one-dimensional series or as a two-dimensional, row-major surface.
+ *
+ * Transformations happen directly on the arrays given by the caller, which
+ * must have been allocated with make_fftw_array. Plans are taken from the
+ * process-wide registry (see get_fft_plans), so transformers of the same size
+ * share them. Transformations are carried out in the floating-point precision
+ * given by @p FT, using the corresponding FFTW library.
  */
+template <typename FT>
 class FFTRealTransformer {
 
 public:
 
 	/**
-	 * Creates a new transformer that will work with images and vectors of size
+	 * Creates a new transformer that will work with inputs of size
 	 * @p size, using effort @p effort and @p omp_threads threads.
 	 *
 	 * @param size The size of the data to be transformed
@@ -85,9 +289,9 @@ public:
 	FFTRealTransformer(unsigned int size, effort_t effort, unsigned int omp_threads);
 
 	/**
-	 * Creates a new transformer that will work with images and vectors of yet
-	 * unknown size. The new transformer will create plans using effort @p
-	 * effort and @p omp_threads threads.
+	 * Creates a new transformer that will work with inputs of yet
+	 * unknown size. The new transformer will use plans created with effort
+	 * @p effort and @p omp_threads threads.
 	 *
 	 * @param effort The kind of effort that should be put into creating this plan
 	 * @param omp_threads The number of threads to use to execute the plan
@@ -96,52 +300,118 @@ public:
 
 	/**
 	 * Prepares this object to be able to process inputs of size @p size
-	 * @param input_size The new input size. Old plans and buffers are discarded
-	 * and replaced with new ones fitting this size
+	 * @param input_size The new input size. Plans for the old size are released
 	 */
 	void resize(unsigned int input_size);
 
 	/**
-	 * Transforms a container of numbers into their Fourier Transform. The
-	 * resulting vector is a vector of complex values.
+	 * Prepares this object to be able to process two-dimensional inputs of
+	 * dimensions @p dims, stored in row-major order. The hermitian size of
+	 * such inputs is ``(dims.x / 2 + 1) * dims.y``.
+	 *
+	 * @param dims The new input dimensions. Plans for the old dimensions are
+	 * released
+	 */
+	void resize(const Dimensions &dims);
+
+	/**
+	 * Transforms an array of real numbers into their Fourier Transform.
 	 *
-	 * @param input The numbers to transform
-	 * @param output The vector of complex numbers where the result will be stored.
-	 * It must be at least as long as the hermitian size
+	 * @param input The get_size() numbers to transform. Their values are
+	 * destroyed by the transformation
+	 * @param output The array of get_hermitian_size() complex numbers where
+	 * the result will be stored
 	 */
-	template <typename T>
-	void forward(const T &input, std::vector<std::complex<double>> &output) const;
+	void forward(FT *input, std::complex<FT> *output) const;
 
 	/**
-	 * Transforms the given vector of complex values into their inverse Fourier
-	 * Transform. The resulting vector is a vector of doubles only (the real
-	 * part of the inverse transformation). The vector of complex values must
-	 * be the hermitian redundant version of the FFT transform.
+	 * Transforms the hermitian redundant version of an FFT transform into its
+	 * (unnormalized) inverse Fourier Transform.
 	 *
-	 * @param input The vector of complex numbers to transform
-	 * @param output The container of doubles where the result will be stored.
+	 * @param input The get_hermitian_size() complex numbers to transform.
+	 * Their values are destroyed by the transformation
+	 * @param output The array of get_size() real numbers where the result
+	 * will be stored.
 	 */
-	template <typename T>
-	void backward(const std::vector<std::complex<double>> &input, T &output) const;
+	void backward(std::complex<FT> *input, FT *output) const;
 
-	unsigned int get_size() {
+	/**
+	 * Like forward(FT *, std::complex<FT> *), but transforms @p howmany
+	 * contiguous inputs in place using a single batched plan. Each input
+	 * occupies get_hermitian_size() complex numbers of @p data, and holds its
+	 * real numbers in rows padded to ``2 * (width / 2 + 1)`` numbers.
+	 *
+	 * @param data The inputs to transform, replaced by their transforms
+	 * @param howmany The number of inputs
+	 */
+	void forward(std::complex<FT> *data, unsigned int howmany);
+
+	/**
+	 * Like backward(std::complex<FT> *, FT *), but transforms @p howmany
+	 * contiguous inputs in place using a single batched plan. The results
+	 * are laid out as the inputs of forward(std::complex<FT> *, unsigned int).
+	 *
+	 * @param data The inputs to transform, replaced by their transforms
+	 * @param howmany The number of inputs
+	 */
+	void backward(std::complex<FT> *data, unsigned int howmany);
+
+	/**
+	 * Like forward(FT *, std::complex<FT> *), but for inputs whose rows
+	 * from @p rows onwards are all zero. The transformation is carried out
+	 * as a row-column transform whose first pass skips the zero rows, which
+	 * are not even read.
+	 *
+	 * @param input The numbers to transform. Only their first @p rows rows
+	 * are read, and destroyed
+	 * @param output The array of get_hermitian_size() complex numbers where
+	 * the result will be stored
+	 * @param rows The number of (possibly) non-zero rows in @p input
+	 */
+	void forward_pruned(FT *input, std::complex<FT> *output, unsigned int rows);
+
+	/**
+	 * Like backward(std::complex<FT> *, FT *), but only computes the
+	 * output rows in ``[first_row, first_row + rows)``. The transformation
+	 * is carried out as a row-column transform whose last pass skips the
+	 * rest of the rows. Some of them might still be written to.
+	 *
+	 * @param input The get_hermitian_size() complex numbers to transform.
+	 * Their values are destroyed by the transformation
+	 * @param output The array of get_size() real numbers where the result
+	 * will be stored
+	 * @param first_row The first row of the output that is required
+	 * @param rows The number of output rows that are required
+	 */
+	void backward_pruned(std::complex<FT> *input, FT *output, unsigned int first_row, unsigned int rows);
+
+	unsigned int get_size() const {
 		return size;
 	}
 
-	unsigned int get_hermitian_size() {
+	unsigned int get_hermitian_size() const {
 		return hermitian_size;
 	}
 
 private:
+	Dimensions dims;
 	unsigned int size;
 	unsigned int hermitian_size;
 	effort_t effort;
-	std::unique_ptr<double, fftw_deleter<double>> real_buf;
-	std::unique_ptr<fftw_complex, fftw_deleter<fftw_complex>> complex_buf;
-	std::unique_ptr<fftw_plan_s, fftw_plan_destroyer> forward_plan;
-	std::unique_ptr<fftw_plan_s, fftw_plan_destroyer> backward_plan;
+	unsigned int omp_threads;
+	std::shared_ptr<const FFTPlans<FT>> plans;
+
+	/* Plans for in-place batches, keyed by the number of transformations */
+	std::map<unsigned int, std::shared_ptr<const FFTPlans<FT>>> batch_plans;
+
+	const FFTPlans<FT> &get_batch_plans(unsigned int howmany);
+
+	/* Plans for pruned row-column transformations */
+	std::shared_ptr<const FFTPlans<FT>> column_plans;
+	std::map<unsigned int, std::shared_ptr<const FFTPlans<FT>>> row_plans;
 
-	void resize_impl(unsigned int input_size);
+	const FFTPlans<FT> &get_row_plans(unsigned int rows);
+	const FFTPlans<FT> &get_column_plans();
 };
 
 /// The global mutex used to serialize FFTW operations other than fftw_execute
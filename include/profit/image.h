@@ -29,6 +29,7 @@
 #define PROFIT_IMAGE_H
 
 #include <algorithm>
+#include <memory>
 #include <ostream>
 #include <stdexcept>
 #include <vector>
@@ -203,7 +204,7 @@ _2dcoordinate operator-(const _2dcoordinate &other, int x) {
 /// Element-wise max() function for _2dcoordinate objects
 inline _2dcoordinate max(const _2dcoordinate a, const _2dcoordinate b)
 {
-	return _2dcoordinate {std::max(a.x, b.x), std::max(a.x, b.x)};
+	return _2dcoordinate {std::max(a.x, b.x), std::max(a.y, b.y)};
 }
 
 /// @typedef A point in a 2-dimensional surface
@@ -617,6 +618,66 @@ std::basic_ostream<CharT> &operator<<(std::basic_ostream<CharT> &os, const surfa
 	return os;
 }
 
+class Mask;
+
+/**
+ * A run-length view of a Mask.
+ *
+ * Each row of the mask is described by the runs of consecutive pixels that
+ * are set, in increasing column order. Loops over masked pixels can then visit
+ * each run in turn instead of testing every pixel of the mask individually.
+ */
+class PROFIT_API MaskSpans {
+
+public:
+
+	/// A run of set pixels within a row, as its first and past-the-end columns
+	typedef std::pair<unsigned int, unsigned int> span;
+
+	/// The runs of set pixels of a single row
+	class row_spans {
+	public:
+		row_spans(const span *first, const span *last) : first(first), last(last) {}
+		const span *begin() const { return first; }
+		const span *end() const { return last; }
+		bool empty() const { return first == last; }
+	private:
+		const span *first;
+		const span *last;
+	};
+
+	MaskSpans() = default;
+
+	/**
+	 * Builds the run-length view of @p mask
+	 *
+	 * @param mask The mask to describe
+	 */
+	explicit MaskSpans(const Mask &mask);
+
+	/**
+	 * Returns the runs of set pixels of row @p j, which must be lower than
+	 * the height of the described mask.
+	 *
+	 * @param j The row
+	 * @return The runs of set pixels of row @p j
+	 */
+	row_spans row(unsigned int j) const {
+		return {_spans.data() + _row_offsets[j], _spans.data() + _row_offsets[j + 1]};
+	}
+
+	/// Returns the total number of runs of set pixels
+	std::size_t size() const { return _spans.size(); }
+
+	/// Returns the total number of set pixels
+	std::size_t count() const { return _count; }
+
+private:
+	std::vector<span> _spans;
+	std::vector<std::size_t> _row_offsets;
+	std::size_t _count = 0;
+};
+
 /**
  * A mask is surface of bools
  */
@@ -640,6 +701,8 @@ public:
 	 * the new mask's value is @p true) is an "expanded" version of this mask.
 	 * This is similar in nature to a convolution, but simpler as it is a
 	 * simpler boolean operation that requires no additions or further scaling.
+	 * Its cost is linear on the number of pixels of this mask, regardless of
+	 * @p pad.
 	 *
 	 * @param pad the amount of cells to expand each input pixel on each dimension.
 	 * @param threads threads to use to perform computation. Only valid if
@@ -661,6 +724,55 @@ public:
 	 */
 	Mask upsample(unsigned int factor) const;
 
+	/**
+	 * Returns the run-length view of this mask. The view is built the first
+	 * time it is requested, and then kept until this mask is modified through
+	 * any of its non-const methods, which means it shouldn't be modified
+	 * through iterators or references obtained before calling this method.
+	 * This method can be called concurrently from different threads.
+	 *
+	 * @return The run-length view of this mask
+	 */
+	const MaskSpans &spans() const;
+
+	// Non-const accessors discard the run-length view of this mask
+	using surface::operator[];
+	using surface::begin;
+	using surface::end;
+
+	reference operator[](const size_type idx)
+	{
+		_spans.reset();
+		return surface::operator[](idx);
+	}
+
+	reference operator[](const Point &p)
+	{
+		_spans.reset();
+		return surface::operator[](p);
+	}
+
+	iterator begin()
+	{
+		_spans.reset();
+		return surface::begin();
+	}
+
+	iterator end()
+	{
+		_spans.reset();
+		return surface::end();
+	}
+
+	void zero()
+	{
+		_spans.reset();
+		surface::zero();
+	}
+
+private:
+	mutable std::shared_ptr<const MaskSpans> _spans;
+
 };
 
 /**
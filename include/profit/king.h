@@ -66,11 +66,17 @@ protected:
 	 * Inherited from RadialProfile
 	 * ----------------------------
 	 */
+	void initial_calculations() override;
 	double get_lumtot() override;
 	double get_rscale() override;
+	double get_rscale_edge() override;
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -98,6 +104,23 @@ private:
 	double a;
 	// @}
 
+	/* the value subtracted at every point, which makes the profile 0 at rt */
+	double _edge;
+
+	double (*m_eval_function)(double x, double y, double box, double rc, double rt, double a, double edge);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double rc, double rt, double a, double edge);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double rc, double rt, double a, double edge);
+
+	template <bool boxy, radial_exponent t>
+	void init_eval_function();
+
+	template <bool boxy>
+	void init_eval_function(radial_exponent t);
+
 	double integrate_at(double r) const;
 
 #ifdef PROFIT_OPENCL
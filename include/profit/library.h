@@ -87,6 +87,11 @@ PROFIT_API bool has_openmp();
 /// @return Whether libprofit was compiled with FFTW support
 PROFIT_API bool has_fftw();
 
+/// Returns whether libprofit was compiled with single-precision FFTW support,
+/// and therefore supports the @ref FFT_FLOAT convolver
+/// @return Whether libprofit was compiled with single-precision FFTW support
+PROFIT_API bool has_fftw_float();
+
 /// Returns whether libprofit was compiled against an FFTW library with OpenMP support
 /// @return Whether libprofit was compiled against an FFTW library with OpenMP support
 PROFIT_API bool has_fftw_with_openmp();
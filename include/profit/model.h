@@ -112,6 +112,50 @@ public:
 	 */
 	Image evaluate(Point &offset_out = NO_OFFSET);
 
+	/**
+	 * Like @ref evaluate(Point &), but additionally calculates the partial
+	 * derivatives of the model image with respect to the parameters
+	 * given to each profile via Profile::set_derivative_parameters.
+	 *
+	 * After this method returns @p derivatives contains one image per
+	 * parameter, ordered first by profile (in the order they were added to
+	 * this model) and then by parameter (in the order they were given to each
+	 * profile). Each derivative image has the same dimensions than the
+	 * returned image, and undergoes the same convolution, cropping,
+	 * downsampling and masking.
+	 *
+	 * @param derivatives The vector where the derivative images are stored.
+	 * @param offset_out See @ref evaluate(Point &).
+	 * @returns The image created by libprofit.
+	 */
+	Image evaluate(std::vector<Image> &derivatives, Point &offset_out = NO_OFFSET);
+
+	/**
+	 * Calculates one image for each set of parameter values in @p values,
+	 * like @ref evaluate(Point &) would after setting the parameters in
+	 * @p parameters to those values. This is more efficient than evaluating
+	 * the model for each set of values separately: inputs are analysed and the
+	 * mask adjusted only once, and all images are convolved together
+	 * (e.g., sharing the PSF's FFT and the FFT plans).
+	 *
+	 * The profiles are still evaluated for one set of values after the other,
+	 * so only the analysis and the convolution are batched. All images of the
+	 * batch are kept in memory until they have been convolved.
+	 *
+	 * After this method returns, all parameters have their original values.
+	 *
+	 * @param parameters The `double` parameters of the profiles of this model
+	 * that change between images.
+	 * @param values The sets of values of @p parameters, one per image. Each
+	 * set contains one value per parameter, in the same order.
+	 * @param offset_out See @ref evaluate(Point &).
+	 * @returns The images created by libprofit, one per set of values.
+	 * @throws invalid_parameter if any of the parameters doesn't belong to a
+	 * profile of this model, or if any set of values has the wrong size.
+	 */
+	std::vector<Image> evaluate_batch(const std::vector<ProfileParameter> &parameters,
+	    const std::vector<std::vector<double>> &values, Point &offset_out = NO_OFFSET);
+
 #ifdef PROFIT_DEBUG
 	std::map<std::string, std::map<int, int>> get_profile_integrations() const;
 #endif
@@ -141,12 +185,21 @@ public:
 		this->finesampling = finesampling;
 	}
 
+	/**
+	 * Returns the finesampling factor used by this Model
+	 * @return the finesampling factor used by this Model
+	 */
+	unsigned int get_finesampling() const {
+		return finesampling;
+	}
+
 	/**
 	 * Sets the PSF image that this Model should use
 	 * @param psf The PSF image that this Model should use
 	 */
 	void set_psf(const Image &psf) {
 		this->psf = psf.normalize();
+		profile_cache.clear();
 	}
 
 	/**
@@ -155,6 +208,7 @@ public:
 	void set_psf(Image &&psf) {
 		this->psf = std::move(psf);
 		this->psf.normalize();
+		profile_cache.clear();
 	}
 
 	/**
@@ -187,6 +241,7 @@ public:
 	 */
 	void set_psf_pixel_scale(const PixelScale &scale) {
 		psf_scale = scale;
+		profile_cache.clear();
 	}
 
 	/**
@@ -218,6 +273,7 @@ public:
 	 */
 	void set_mask(const Mask &mask) {
 		this->mask = mask;
+		profile_cache.clear();
 	}
 
 	/**
@@ -225,6 +281,7 @@ public:
 	 */
 	void set_mask(Mask &&mask) {
 		this->mask = std::move(mask);
+		profile_cache.clear();
 	}
 
 	/**
@@ -242,6 +299,7 @@ public:
 	void set_adjust_mask(bool adjust_mask)
 	{
 		this->adjust_mask = adjust_mask;
+		profile_cache.clear();
 	}
 
 	/**
@@ -329,6 +387,123 @@ public:
 		return this->omp_threads;
 	}
 
+	/**
+	 * Sets the maximum number of profiles of this model that are evaluated
+	 * concurrently, each using an equal share of the OpenMP threads given via
+	 * @ref set_omp_threads (for which nested OpenMP parallelism is enabled
+	 * during the evaluation). Profiles are evaluated in batches, each profile
+	 * into its own image covering only the region of the model image it adds
+	 * values to (e.g., the footprint of radial profiles), and their images
+	 * are then added in the same order in which profiles were added to the
+	 * model, so the result is exactly the same as evaluating one profile after
+	 * the other. 0 or 1 (the default) means that profiles are evaluated one
+	 * after the other, each using all threads.
+	 *
+	 * This is useful for models with many small profiles, which cannot
+	 * individually make use of many threads.
+	 *
+	 * @param concurrent_profiles The maximum number of profiles to evaluate
+	 * concurrently
+	 */
+	void set_concurrent_profiles(unsigned int concurrent_profiles) {
+		this->concurrent_profiles = concurrent_profiles;
+	}
+
+	/**
+	 * Returns the maximum number of profiles this Model evaluates concurrently
+	 * @return the maximum number of profiles this Model evaluates concurrently
+	 * @see set_concurrent_profiles(unsigned int)
+	 */
+	unsigned int get_concurrent_profiles() const {
+		return this->concurrent_profiles;
+	}
+
+	/**
+	 * Sets the SIMD instruction set used to evaluate the profiles contained
+	 * in this model. simd_instruction_set::NONE selects the scalar
+	 * evaluation code, while simd_instruction_set::AUTO (the default)
+	 * selects the best instruction set available.
+	 *
+	 * @param instruction_set The SIMD instruction set to use for profile evaluation
+	 * @throws invalid_parameter if @p instruction_set is not supported
+	 * @see has_simd_instruction_set(simd_instruction_set)
+	 */
+	void set_instruction_set(simd_instruction_set instruction_set);
+
+	/**
+	 * Returns the SIMD instruction set this Model has been configured to work with
+	 * @return the SIMD instruction set this Model has been configured to work with
+	 */
+	simd_instruction_set get_instruction_set() const {
+		return this->instruction_set;
+	}
+
+	/**
+	 * Sets whether radial profiles evaluated on the CPU should calculate
+	 * their values using single-precision floating-point numbers instead of
+	 * double-precision ones (the default). Values are still added onto the
+	 * double-precision model image, but are individually accurate only up
+	 * to single-precision rounding errors. In exchange, vectorised evaluation
+	 * processes twice as many values per instruction.
+	 *
+	 * This setting is the CPU counterpart of the ``use_double`` flag given
+	 * when creating an OpenCL environment (see set_opencl_env()).
+	 *
+	 * @param single_precision Whether to evaluate profiles in single precision
+	 */
+	void set_single_precision(bool single_precision) {
+		this->single_precision = single_precision;
+	}
+
+	/**
+	 * Returns whether radial profiles are evaluated on the CPU using
+	 * single-precision floating-point numbers
+	 * @return whether radial profiles are evaluated in single precision
+	 * @see set_single_precision(bool)
+	 */
+	bool get_single_precision() const {
+		return this->single_precision;
+	}
+
+	/**
+	 * Sets the maximum amount of memory, in bytes, this Model can use to keep
+	 * the images of its individual profiles between evaluations. Profiles
+	 * whose parameters didn't change since their image was kept are not
+	 * evaluated again; instead their kept image is used. The image of every
+	 * profile is still added to the model image in the same order as
+	 * profiles were added to the model, so results are exactly the same as
+	 * evaluating all profiles.
+	 *
+	 * Only the region of the model image a profile adds values to is kept
+	 * (see set_concurrent_profiles(unsigned int)). When the images of all
+	 * profiles don't fit in the given memory, the ones used least recently
+	 * are discarded first. Changes in the model's
+	 * dimensions, pixel scale, finesampling, magnitude zero point, mask,
+	 * PSF, PSF pixel scale or evaluation settings discard all kept images.
+	 * 0 (the default) disables this feature.
+	 *
+	 * This is useful when fitting, where the parameters of only one or a few
+	 * profiles change between consecutive evaluations.
+	 *
+	 * @param profile_cache_size The maximum memory to use, in bytes
+	 */
+	void set_profile_cache_size(std::size_t profile_cache_size) {
+		this->profile_cache_size = profile_cache_size;
+		if (!profile_cache_size) {
+			profile_cache.clear();
+		}
+	}
+
+	/**
+	 * Returns the maximum amount of memory this Model can use to keep the
+	 * images of its individual profiles between evaluations
+	 * @return the maximum memory to use, in bytes
+	 * @see set_profile_cache_size(std::size_t)
+	 */
+	std::size_t get_profile_cache_size() const {
+		return this->profile_cache_size;
+	}
+
 	/**
 	 * Modifies @p mask in the same way that it would be modified internally
 	 * by a Model object in order to preserve flux during the convolution step
@@ -365,8 +540,49 @@ private:
 	bool return_finesampled;
 	OpenCLEnvPtr opencl_env;
 	unsigned int omp_threads;
+	unsigned int concurrent_profiles;
+	simd_instruction_set instruction_set;
+	bool single_precision;
 	std::vector<ProfilePtr> profiles;
 
+	// The number of OpenMP threads each profile can use during the current evaluation
+	unsigned int profile_omp_threads;
+
+	// The memory available to keep profile images, see set_profile_cache_size
+	std::size_t profile_cache_size;
+
+	// The image kept for a profile, the region of the model image it
+	// covers, and when it was last used
+	struct profile_cache_entry {
+		Image image;
+		Box region;
+		bool kept = false;
+		unsigned long parameter_changes = 0;
+		unsigned long last_used = 0;
+	};
+
+	// Everything besides its parameters that a profile's image depends on.
+	// The mask, PSF and PSF pixel scale are left out, as their setters
+	// discard all kept images instead; how the mask is adjusted is kept though
+	struct profile_cache_inputs {
+		Dimensions drawing_dims;
+		Dimensions psf_padding;
+		bool mask_needs_adjustment;
+		bool mask_needs_convolution;
+		unsigned int finesampling;
+		PixelScale scale;
+		double magzero;
+		simd_instruction_set instruction_set;
+		bool single_precision;
+		OpenCLEnvPtr opencl_env;
+		bool operator==(const profile_cache_inputs &other) const;
+	};
+
+	// The kept profile images, one (possibly empty) element per profile
+	std::vector<profile_cache_entry> profile_cache;
+	profile_cache_inputs cached_inputs;
+	unsigned long profile_cache_clock;
+
 	// The result of analysing the model inputs, it contains all the necessary
 	// information needed to actually proceed with the rest of the tasks
 	struct input_analysis {
@@ -381,8 +597,42 @@ private:
 	template <typename P>
 	ProfilePtr make_profile(const std::string &name);
 
+	// Evaluate the model, optionally calculating derivatives
+	Image evaluate_model(std::vector<Image> *derivatives, Point &offset_out);
+
+	// The mask given to profiles: either the user's mask, or its adjusted
+	// version, which is then stored in adjusted_mask
+	const Mask &get_profiles_mask(const input_analysis &analysis, Mask &adjusted_mask) const;
+
+	// Remove padding, downsample and mask the evaluated images, updating
+	// their offset accordingly
+	void post_process(const std::vector<Image *> &images, const input_analysis &analysis,
+	    bool mask_adjusted, Point &offset) const;
+
 	// Actually produce the image from the profiles and convolve it against the psf
-	Image produce_image(const Mask &mask, const input_analysis &analysis, Point &offset);
+	Image produce_image(const Mask &mask, const input_analysis &analysis, Point &offset,
+	    std::vector<Image> *derivatives);
+
+	// Evaluate all profiles, adding their values to either image, and
+	// appending their derivatives, if requested
+	void evaluate_profiles(Image &model_image, Image &to_convolve,
+	    const Mask &mask, const input_analysis &analysis,
+	    std::vector<Image> *derivatives);
+
+	// Evaluate a single profile, adding its values to image
+	void evaluate_profile(Profile &profile, Image &image, const Mask &mask,
+	    const input_analysis &analysis);
+
+	// Evaluate each profiles[indices[i]] into images[i], concurrent at a time,
+	// with images[i] covering regions[i] of the model image
+	void evaluate_profiles(const unsigned int *indices, unsigned int n_profiles,
+	    Image *images, Box *regions, unsigned int concurrent, const Mask &mask,
+	    const input_analysis &analysis);
+
+	// Evaluate all profiles reusing the kept images of unchanged profiles,
+	// see set_profile_cache_size
+	void evaluate_cached_profiles(Image &model_image, Image &to_convolve,
+	    const Mask &mask, const input_analysis &analysis, unsigned int concurrent);
 
 	// Analyze the model's inputs and produce information needed by other steps
 	input_analysis analyze_inputs() const;
@@ -69,12 +69,17 @@ protected:
 	 * Inherited from RadialProfile
 	 * ----------------------------
 	 */
+	void initial_calculations() override;
 	double get_lumtot() override;
 	double get_rscale() override;
 	double adjust_acc(double acc) override;
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -98,6 +103,20 @@ private:
 	double con;
 	// @}
 
+	double (*m_eval_function)(double x, double y, double box, double rscale, double con);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double rscale, double con);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double rscale, double con);
+
+	template <bool boxy, radial_exponent t>
+	void init_eval_function();
+
+	template <bool boxy>
+	void init_eval_function(radial_exponent t);
+
 	double fluxfrac(double fraction) const;
 
 #ifdef PROFIT_OPENCL
@@ -27,10 +27,59 @@
 #ifndef PROFIT_OMP_UTILS_H_
 #define PROFIT_OMP_UTILS_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "profit/common.h"
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif // _OPENMP
+
 namespace profit {
 
+/**
+ * While alive, and if @p enable is true, allows the threads of an OpenMP
+ * parallel region to start their own (nested) parallel regions, which
+ * otherwise run with a single thread. The previous setting is restored on
+ * destruction. Without OpenMP support this class does nothing.
+ *
+ * Note that before OpenMP 5.0 the maximum number of active levels is not a
+ * per-thread but a process-wide setting: while an object of this class is
+ * alive, parallel regions started by other threads of the process (e.g.,
+ * by other Models, or by the application) can also nest.
+ */
+class omp_nested_parallelism {
+
+public:
+	explicit omp_nested_parallelism(bool enable)
+	{
+#ifdef _OPENMP
+		previous_levels = omp_get_max_active_levels();
+		if (enable && previous_levels < 2) {
+			omp_set_max_active_levels(2);
+		}
+#else
+		UNUSED(enable);
+#endif // _OPENMP
+	}
+
+	~omp_nested_parallelism()
+	{
+#ifdef _OPENMP
+		omp_set_max_active_levels(previous_levels);
+#endif // _OPENMP
+	}
+
+	omp_nested_parallelism(const omp_nested_parallelism &) = delete;
+	omp_nested_parallelism &operator=(const omp_nested_parallelism &) = delete;
+
+private:
+#ifdef _OPENMP
+	int previous_levels;
+#endif // _OPENMP
+};
+
 /**
  * Runs @p f over each point ``(i, j)`` of a grid of width @p width and height
  * @p height using @p threads OpenMP threads. If no OpenMP support is found, @p f
@@ -70,6 +119,121 @@ void omp_2d_for(int threads, unsigned int width, unsigned int height, Callable &
 #endif // _OPENMP
 }
 
+/**
+ * Runs @p f over each value ``i`` in ``[0, n)`` using @p threads OpenMP
+ * threads. Values are dynamically scheduled one at a time, which makes this
+ * function suitable for iterations with uneven costs. If no OpenMP support is
+ * found, @p f is called sequentially.
+ *
+ * @param threads The number of OpenMP threads to use
+ * @param n The number of values to iterate over
+ * @param f The function to evaluate on each value. It should receive ``i``
+ * as argument
+ */
+template <typename Callable>
+void omp_1d_for(int threads, unsigned int n, Callable &&f)
+{
+#if _OPENMP >= 200805 // OpenMP 3.0
+#pragma omp parallel for schedule(dynamic, 1) if(threads > 1) num_threads(threads)
+	for (unsigned int i = 0; i < n; i++) {
+		f(i);
+	}
+#elif _OPENMP >= 200203 // OpenMP 2.0. Signed int loop variable
+#pragma omp parallel for schedule(dynamic, 1) if(threads > 1) num_threads(threads)
+	for (int i = 0; i < int(n); i++) {
+		f((unsigned int)i);
+	}
+#else
+	UNUSED(threads);
+	for (unsigned int i = 0; i < n; i++) {
+		f(i);
+	}
+#endif // _OPENMP
+}
+
+/**
+ * A rectangular tile of a grid of points, covering the points ``(i, j)`` with
+ * ``i`` in ``[i0, i1)`` and ``j`` in ``[j0, j1)``.
+ */
+struct grid_tile {
+	unsigned int i0;
+	unsigned int i1;
+	unsigned int j0;
+	unsigned int j1;
+	/// The position of this tile in the row-first order of all tiles
+	unsigned int index;
+	/// The estimated cost of processing this tile
+	double cost;
+};
+
+/**
+ * Splits the grid of points ``[i0, i1) x [j0, j1)`` into tiles of at most
+ * @p tile_width by @p tile_height points, and runs @p f over each tile using
+ * @p threads OpenMP threads.
+ *
+ * The cost of each tile is first estimated with @p cost. Tiles are then
+ * dynamically scheduled one at a time, in decreasing order of cost, so that
+ * threads start with the most expensive tiles, and those finishing early
+ * pick the cheaper tiles left at the end. Tiles with the same estimated cost
+ * are scheduled in row-first order, which is also the order used when no
+ * OpenMP support is found.
+ *
+ * @param threads The number of OpenMP threads to use
+ * @param i0 The first ``i`` value of the grid
+ * @param i1 One past the last ``i`` value of the grid
+ * @param j0 The first ``j`` value of the grid
+ * @param j1 One past the last ``j`` value of the grid
+ * @param tile_width The maximum width of the tiles
+ * @param tile_height The maximum height of the tiles
+ * @param cost The function estimating the cost of processing a tile. It
+ * should receive a grid_tile as argument, and return a ``double``
+ * @param f The function to evaluate on each tile. It should receive a
+ * grid_tile as argument
+ */
+template <typename CostFunction, typename Callable>
+void omp_tiled_2d_for(int threads, unsigned int i0, unsigned int i1,
+    unsigned int j0, unsigned int j1, unsigned int tile_width, unsigned int tile_height,
+    CostFunction &&cost, Callable &&f)
+{
+	if (i0 >= i1 || j0 >= j1) {
+		return;
+	}
+
+	unsigned int tile_cols = (i1 - i0 + tile_width - 1) / tile_width;
+	unsigned int tile_rows = (j1 - j0 + tile_height - 1) / tile_height;
+	std::vector<grid_tile> tiles;
+	tiles.reserve(tile_cols * tile_rows);
+	for (unsigned int row = 0; row < tile_rows; row++) {
+		for (unsigned int col = 0; col < tile_cols; col++) {
+			grid_tile tile;
+			tile.i0 = i0 + col * tile_width;
+			tile.i1 = std::min(i1, tile.i0 + tile_width);
+			tile.j0 = j0 + row * tile_height;
+			tile.j1 = std::min(j1, tile.j0 + tile_height);
+			tile.index = row * tile_cols + col;
+			tile.cost = 0;
+			tiles.push_back(tile);
+		}
+	}
+
+#ifdef _OPENMP
+	if (threads > 1) {
+		for (auto &tile: tiles) {
+			tile.cost = cost(tile);
+		}
+		std::stable_sort(tiles.begin(), tiles.end(), [](const grid_tile &a, const grid_tile &b) {
+			return a.cost > b.cost;
+		});
+	}
+#else
+	UNUSED(cost);
+#endif // _OPENMP
+
+	omp_1d_for(threads, static_cast<unsigned int>(tiles.size()), [&](unsigned int t) {
+		f(tiles[t]);
+	});
+}
+
 }  // namespace profit
 
 #endif /* PROFIT_OMP_UTILS_H_ */
@@ -28,6 +28,8 @@
 #define PROFIT_PROFILE_H
 
 #include <functional>
+#include <initializer_list>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -137,6 +139,77 @@ public:
 	virtual void evaluate(Image &image, const Mask &mask, const PixelScale &scale,
 	    const Point &offset, double magzero) = 0;
 
+	/**
+	 * Like @ref evaluate, but evaluates this profile into a new image that
+	 * only covers the region of an image of dimensions @p dims outside of
+	 * which this profile adds no values (e.g., its footprint). The values of
+	 * the new image are those that @ref evaluate would add to the
+	 * corresponding pixels of the bigger image.
+	 *
+	 * The default implementation evaluates the profile over the whole image.
+	 *
+	 * @param dims The dimensions of the image being evaluated.
+	 * @param region Set to the region of the image covered by the new image.
+	 * @param mask The mask to apply during profile calculation.
+	 * @param scale The pixel scale of the image.
+	 * @param offset The offset of the profile's origin with respect to the
+	 * the image's origin
+	 * @param magzero The profile's zero magnitude value.
+	 * @return The image with the values of the pixels in @p region
+	 */
+	virtual Image evaluate_footprint(const Dimensions &dims, Box &region, const Mask &mask,
+	    const PixelScale &scale, const Point &offset, double magzero);
+
+	/**
+	 * Like @ref evaluate, but additionally adds onto each of @p derivatives
+	 * the partial derivative of this profile's image with respect to the
+	 * corresponding parameter given to @ref set_derivative_parameters.
+	 * @p derivatives has one image per parameter, with the same dimensions
+	 * as @p image.
+	 *
+	 * The default implementation uses central differences of the images
+	 * obtained by evaluating this profile with each parameter shifted in
+	 * turn. Subclasses can override this method to provide more efficient
+	 * or accurate derivatives.
+	 *
+	 * @param image The Image object where values need to be stored.
+	 * @param derivatives The Image objects where derivatives need to be stored.
+	 * @param mask The mask to apply during profile calculation.
+	 * @param scale The pixel scale of the image.
+	 * @param offset The offset of the profile's origin with respect to the
+	 * the image's origin
+	 * @param magzero The profile's zero magnitude value.
+	 */
+	virtual void evaluate_derivatives(Image &image, std::vector<Image> &derivatives,
+	    const Mask &mask, const PixelScale &scale, const Point &offset, double magzero);
+
+	/**
+	 * Sets the parameters of this profile with respect to which
+	 * Model::evaluate(std::vector<Image> &, Point &) calculates partial
+	 * derivatives of the model image.
+	 *
+	 * @param parameters The names of the parameters
+	 * @throws invalid_parameter if any of the names corresponds with no known
+	 * parameter on this profile of type `double`.
+	 */
+	void set_derivative_parameters(const std::vector<std::string> &parameters);
+
+	/**
+	 * Returns the parameters of this profile with respect to which partial
+	 * derivatives are calculated
+	 * @return The parameters given to @ref set_derivative_parameters
+	 */
+	const std::vector<std::string> &get_derivative_parameters() const;
+
+	/**
+	 * Returns the number of times the value of any of the parameters of this
+	 * profile has changed. It can be compared across calls to find out
+	 * whether the profile's image might have changed in between.
+	 *
+	 * @return The number of parameter value changes of this profile
+	 */
+	unsigned long get_parameter_changes() const;
+
 	/**
 	 * Parses @p parameter_spec, which should look like `name = value`, and
 	 * sets that parameter value on the profile.
@@ -228,6 +301,49 @@ protected:
 	 */
 	void register_parameter(const char *name, double &variable);
 
+	/**
+	 * Returns whether the value of the parameter @p name has changed since
+	 * the last call to parameter_changes_seen(). All parameters are
+	 * considered as changed until that function is first called.
+	 *
+	 * @param name The name of the parameter
+	 * @return Whether the parameter's value has changed
+	 */
+	bool parameter_changed(const char *name) const;
+
+	/**
+	 * Like parameter_changed(const char *), but checks whether any of the
+	 * parameters of this profile has changed, except those in @p excluded.
+	 *
+	 * @param excluded The names of the parameters that are not checked
+	 * @return Whether any of the checked parameters' value has changed
+	 */
+	bool parameters_changed(std::initializer_list<const char *> excluded) const;
+
+	/**
+	 * Marks all parameters as unchanged. Profiles should call this method
+	 * after they have updated all the quantities they derive from their
+	 * parameters.
+	 */
+	void parameter_changes_seen();
+
+	/**
+	 * Returns the current value of the `double` parameter @p name.
+	 *
+	 * @param name The name of the parameter
+	 * @return The parameter's value
+	 */
+	double get_double_parameter(const std::string &name) const;
+
+	/**
+	 * Returns the step used to calculate derivatives by central differences
+	 * with respect to a parameter whose value is @p value.
+	 *
+	 * @param value The value of the parameter
+	 * @return The step to use
+	 */
+	static double derivative_step(double value);
+
 	/**
 	 * A (constant) reference to the model this profile belongs to
 	 */
@@ -252,8 +368,20 @@ private:
 	parameter_holder<unsigned int> uint_parameters;
 	parameter_holder<double> double_parameters;
 
+	/* Whether each parameter changed since the last parameter_changes_seen() */
+	std::map<std::string, bool> changed_parameters;
+
+	/* The number of parameter value changes, see get_parameter_changes() */
+	unsigned long parameter_changes;
+
+	/* Parameters to calculate derivatives for, see set_derivative_parameters() */
+	std::vector<std::string> derivative_parameters;
+
 	std::shared_ptr<ProfileStats> stats;
 
+	// Model reads parameter values to restore them after evaluating batches
+	friend class Model;
+
 	// RadialProfile sets a different type of stats, and until we have a more
 	// generic stats API we simply let it use our private member
 	friend class RadialProfile;
@@ -262,6 +390,9 @@ private:
 /// A pointer to a Profile object
 typedef std::shared_ptr<Profile> ProfilePtr;
 
+/// A parameter of a profile, given by the profile and the parameter's name
+typedef std::pair<ProfilePtr, std::string> ProfileParameter;
+
 } /* namespace profit */
 
 #endif /* PROFIT_PROFILE_H */
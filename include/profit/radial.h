@@ -30,13 +30,211 @@
 #include <map>
 #endif
 
+#include <cmath>
+#include <utility>
+#include <vector>
+
 #include "profit/config.h"
 #include "profit/opencl_impl.h"
 #include "profit/profile.h"
+#include "profit/simd_math.h"
 
 namespace profit
 {
 
+/**
+ * Exponents for which radial profiles specialise their evaluation functions
+ * at compile time, computing powers with multiplications and square roots
+ * (which in x86_64 are implemented in hardware) instead of calling pow().
+ * Profiles choose their specialisations once per evaluation, when their
+ * shape changes.
+ */
+enum class radial_exponent {
+	general,
+	quarter,
+	half,
+	one,
+	three_halves,
+	two,
+	five_halves,
+	three,
+	four
+};
+
+/**
+ * Returns the radial_exponent matching the absolute value of @p exponent,
+ * or radial_exponent::general if there is none.
+ */
+radial_exponent get_radial_exponent(double exponent);
+
+/**
+ * Returns the radial_exponent of the inverse of an exponent given by @p t,
+ * or radial_exponent::general if there is none.
+ */
+constexpr radial_exponent inverse_radial_exponent(radial_exponent t)
+{
+	return t == radial_exponent::quarter ? radial_exponent::four :
+	       t == radial_exponent::half    ? radial_exponent::two :
+	       t == radial_exponent::one     ? radial_exponent::one :
+	       t == radial_exponent::two     ? radial_exponent::half :
+	       t == radial_exponent::four    ? radial_exponent::quarter :
+	                                       radial_exponent::general;
+}
+
+/**
+ * Calculates @p x to the power of @p exponent, whose absolute value is
+ * given by @p t unless it is radial_exponent::general.
+ */
+template <radial_exponent t>
+inline
+double fixed_pow(double x, double exponent)
+{
+	double p;
+	switch (t) {
+		case radial_exponent::quarter:
+			p = std::sqrt(std::sqrt(x));
+			break;
+		case radial_exponent::half:
+			p = std::sqrt(x);
+			break;
+		case radial_exponent::one:
+			p = x;
+			break;
+		case radial_exponent::three_halves:
+			p = x * std::sqrt(x);
+			break;
+		case radial_exponent::two:
+			p = x * x;
+			break;
+		case radial_exponent::five_halves:
+			p = x * x * std::sqrt(x);
+			break;
+		case radial_exponent::three:
+			p = x * x * x;
+			break;
+		case radial_exponent::four:
+			p = (x * x) * (x * x);
+			break;
+		default:
+			return std::pow(x, exponent);
+	}
+	return exponent < 0 ? 1 / p : p;
+}
+
+/**
+ * Vectorised version of fixed_pow.
+ */
+template <simd_instruction_set SIMD, typename FT, radial_exponent t>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_fixed_pow(
+    typename simd_traits<SIMD, FT>::vector_type x, double exponent)
+{
+	typedef simd_traits<SIMD, FT> S;
+	typename S::vector_type p;
+	switch (t) {
+		case radial_exponent::quarter:
+			p = S::sqrt(S::sqrt(x));
+			break;
+		case radial_exponent::half:
+			p = S::sqrt(x);
+			break;
+		case radial_exponent::one:
+			p = x;
+			break;
+		case radial_exponent::three_halves:
+			p = S::mul(x, S::sqrt(x));
+			break;
+		case radial_exponent::two:
+			p = S::mul(x, x);
+			break;
+		case radial_exponent::five_halves:
+			p = S::mul(S::mul(x, x), S::sqrt(x));
+			break;
+		case radial_exponent::three:
+			p = S::mul(S::mul(x, x), x);
+			break;
+		case radial_exponent::four:
+			p = S::mul(S::mul(x, x), S::mul(x, x));
+			break;
+		default:
+			return simd_pow<SIMD, FT>(x, exponent);
+	}
+	return exponent < 0 ? S::div(S::set1(1.), p) : p;
+}
+
+/**
+ * Calculates the *boxy radius* of profile coordinates (`x`, `y`) for the
+ * boxiness parameter @p box, which is 0 unless @p boxy is ``true``.
+ * See RadialProfile::boxy_r.
+ */
+template <bool boxy>
+inline
+double fixed_boxy_r(double x, double y, double box)
+{
+	if (!boxy) {
+		return std::sqrt(x * x + y * y);
+	}
+	double box_plus_2 = box + 2.;
+	return std::pow(std::pow(std::abs(x), box_plus_2) +
+	                    std::pow(std::abs(y), box_plus_2),
+	                1. / box_plus_2);
+}
+
+/**
+ * The square of fixed_boxy_r, which for non-boxy profiles
+ * doesn't need a square root.
+ */
+template <bool boxy>
+inline
+double fixed_boxy_r2(double x, double y, double box)
+{
+	if (!boxy) {
+		return x * x + y * y;
+	}
+	double box_plus_2 = box + 2.;
+	return std::pow(std::pow(std::abs(x), box_plus_2) +
+	                    std::pow(std::abs(y), box_plus_2),
+	                2. / box_plus_2);
+}
+
+/**
+ * Vectorised version of fixed_boxy_r.
+ */
+template <simd_instruction_set SIMD, typename FT, bool boxy>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_boxy_r(
+    typename simd_traits<SIMD, FT>::vector_type x,
+    typename simd_traits<SIMD, FT>::vector_type y, double box)
+{
+	typedef simd_traits<SIMD, FT> S;
+	if (!boxy) {
+		return S::sqrt(S::add(S::mul(x, x), S::mul(y, y)));
+	}
+	double box_plus_2 = box + 2.;
+	return simd_pow<SIMD, FT>(S::add(simd_pow<SIMD, FT>(S::abs(x), box_plus_2),
+	                                 simd_pow<SIMD, FT>(S::abs(y), box_plus_2)),
+	                          1. / box_plus_2);
+}
+
+/**
+ * Vectorised version of fixed_boxy_r2.
+ */
+template <simd_instruction_set SIMD, typename FT, bool boxy>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_boxy_r2(
+    typename simd_traits<SIMD, FT>::vector_type x,
+    typename simd_traits<SIMD, FT>::vector_type y, double box)
+{
+	typedef simd_traits<SIMD, FT> S;
+	if (!boxy) {
+		return S::add(S::mul(x, x), S::mul(y, y));
+	}
+	double box_plus_2 = box + 2.;
+	return simd_pow<SIMD, FT>(S::add(simd_pow<SIMD, FT>(S::abs(x), box_plus_2),
+	                                 simd_pow<SIMD, FT>(S::abs(y), box_plus_2)),
+	                          2. / box_plus_2);
+}
+
 /**
  * The base class for radial profiles.
  *
@@ -53,7 +251,10 @@ namespace profit
  */
 class RadialProfile : public Profile {
 
+	friend class BrokenExponentialProfile;
+	friend class CoreSersicProfile;
 	friend class FerrerProfile;
+	friend class KingProfile;
 	friend class MoffatProfile;
 	friend class SersicProfile;
 
@@ -76,6 +277,23 @@ public:
 	void evaluate(Image &image, const Mask &mask, const PixelScale &scale,
 	    const Point &offset, double magzero) override;
 
+	/**
+	 * Evaluates this profile on the bounding box of its footprint, or on the
+	 * whole image if OpenCL is used.
+	 */
+	Image evaluate_footprint(const Dimensions &dims, Box &region, const Mask &mask,
+	    const PixelScale &scale, const Point &offset, double magzero) override;
+
+	/**
+	 * Calculates derivatives point-wise: the profile is evaluated once on the
+	 * CPU, recording the points at which it is integrated and their weights.
+	 * Derivatives are then calculated by central differences of the profile
+	 * values at those same points, keeping the subsampling structure fixed,
+	 * except for `mag`, whose derivative is calculated analytically.
+	 */
+	void evaluate_derivatives(Image &image, std::vector<Image> &derivatives,
+	    const Mask &mask, const PixelScale &scale, const Point &offset, double magzero) override;
+
 #ifdef PROFIT_DEBUG
 	std::map<int,int> get_integrations();
 #endif
@@ -109,13 +327,54 @@ protected:
 	 */
 	virtual double evaluate_at(double x, double y) const = 0;
 
+	/**
+	 * Calculates the profile values at @p n profile coordinates at once.
+	 *
+	 * The default implementation calls @ref evaluate_at for each point.
+	 * Subclasses can override this method to provide a vectorised version
+	 * of their evaluation function, which should yield the same values as
+	 * @ref evaluate_at up to rounding errors.
+	 *
+	 * @param x The X profile coordinates to evaluate
+	 * @param y The Y profile coordinates to evaluate
+	 * @param values The output values
+	 * @param n The number of points to evaluate
+	 * @param instruction_set The SIMD instruction set to use. It is never
+	 * simd_instruction_set::NONE, and always one for which
+	 * has_simd_math returns ``true``.
+	 */
+	virtual void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const;
+
+	/**
+	 * Single-precision version of the method above, used when the Model
+	 * evaluates profiles in single precision (see
+	 * Model::set_single_precision). The default implementation calls
+	 * @ref evaluate_at for each point.
+	 */
+	virtual void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const;
+
 	/**
 	 * Performs the initial calculations needed by this profile during the
 	 * evaluation phase. Subclasses might want to override this method to add
 	 * their own initialization steps.
+	 *
+	 * Quantities that don't depend on the position, magnitude or angle of the
+	 * profile are calculated only when @ref shape_parameters_changed returns
+	 * ``true``, and kept across evaluations otherwise. Subclasses should
+	 * follow the same approach for their own expensive calculations.
 	 */
 	virtual void initial_calculations();
 
+	/**
+	 * Returns whether any of the parameters that define the shape of this
+	 * profile, and its subsampling, changed since the last evaluation. This
+	 * includes all parameters except the position, magnitude and angle of
+	 * the profile, and those that don't affect the values of the profile.
+	 */
+	bool shape_parameters_changed() const;
+
 	/**
 	 * Calculates the ``res`` and ``max_rec`` subsampling parameters used for
 	 * the first subsampling level of image pixel ``x``/``y``.
@@ -124,6 +383,30 @@ protected:
 	 */
 	virtual void subsampling_params(double x, double y, unsigned int &res, unsigned int &max_rec);
 
+	/**
+	 * Gives subclasses the chance to provide the value of some of the pixels
+	 * that would otherwise be subsampled (i.e., the average of the profile
+	 * over the pixel area) without actually subsampling them.
+	 * The default implementation provides no values.
+	 *
+	 * @param dims The dimensions of the image being evaluated
+	 * @param scale The pixel scale of the image being evaluated
+	 * @param values The (pixel index, value) pairs provided by this method
+	 */
+	virtual void precalculated_pixels(const Dimensions &dims, const PixelScale &scale,
+	    std::vector<std::pair<unsigned int, double>> &values);
+
+	/**
+	 * Gives subclasses the chance to prepare for the evaluation of an image
+	 * on the CPU knowing the largest radius (in profile coordinates, i.e.,
+	 * already divided by ``axrat`` along the minor axis) at which the profile
+	 * will be evaluated. It is called after @ref initial_calculations.
+	 * The default implementation does nothing.
+	 *
+	 * @param r_max The largest radius at which the profile will be evaluated
+	 */
+	virtual void prepare_evaluation(double r_max);
+
 	/**
 	 * Returns the factor by which each resulting image pixel value must be
 	 * multiplied to yield the final pixel value. The default implementation
@@ -134,6 +417,16 @@ protected:
 	 */
 	virtual double get_pixel_scale(const PixelScale &scale);
 
+	/**
+	 * Returns the radius (relative to ``rscale``) at which this profile is
+	 * truncated; that is, the *boxy* radius from which @ref evaluate_at
+	 * always returns 0. The default implementation returns 0, meaning that
+	 * the profile has no such hard edge, but subclasses can override this
+	 * method so their evaluation is restricted to the pixels that can
+	 * actually hold some flux.
+	 */
+	virtual double get_rscale_edge();
+
 	/*
 	 * ------------------------------------------
 	 *  Mandatory subclasses methods follow
@@ -262,6 +555,20 @@ private:
 	/// Whether the CPU evaluation method should be used, even if an OpenCL
 	/// environment has been given (and libprofit has been compiled with OpenCL support)
 	bool force_cpu;
+
+	/**
+	 * Whether this profile should be evaluated on the CPU by interpolating
+	 * a table of its values against radius, built at evaluation time,
+	 * instead of evaluating its function for every pixel and sub-pixel.
+	 * The table is used only when ``box`` is 0.
+	 */
+	bool tabulate;
+
+	/**
+	 * Maximum relative error allowed when interpolating the table of values
+	 * used when ``tabulate`` is on
+	 */
+	double tabulate_acc;
 	// @}
 
 	/*
@@ -270,7 +577,19 @@ private:
 	 */
 	double rscale;
 
+	/*
+	 * The values requested by the user for the parameters that are
+	 * automatically adjusted when `adjust` is on. These are the ones
+	 * registered as parameters, while acc, rscale_switch, resolution and
+	 * rscale_max hold the values actually used during evaluation
+	 */
+	double requested_acc;
+	double requested_rscale_switch;
+	unsigned int requested_resolution;
+	double requested_rscale_max;
+
 	/* These are internally calculated at profile evaluation time */
+	double _lumtot;
 	double _ie;
 	double _cos_ang;
 	double _sin_ang;
@@ -278,16 +597,161 @@ private:
 	double _ycen;
 	double magzero;
 
+	/*
+	 * Distance between the profile's centre and its closest placement on
+	 * a pixel centre or corner, where the image is point-symmetric
+	 */
+	double _symmetry_offset_x;
+	double _symmetry_offset_y;
+
+	/*
+	 * Evaluates this profile on the CPU. Profile coordinates and values are
+	 * calculated using the floating-point type FT, while pixel positions and
+	 * the final pixel values are kept in double precision
+	 */
+	template <typename FT>
 	void evaluate_cpu(Image &image, const Mask &mask, const PixelScale &scale);
 
+	/*
+	 * Like evaluate_cpu above, but `image` only covers `region` of an image
+	 * of dimensions `dims`. Pixels are still positioned and indexed in terms
+	 * of the bigger image, so values are the same regardless of the region
+	 */
+	template <typename FT>
+	void evaluate_cpu(Image &image, const Box &region, const Dimensions &dims,
+	    const Mask &mask, const PixelScale &scale);
+
+	/*
+	 * Performs the calculations needed before evaluating this profile with
+	 * the given scale, offset and magzero
+	 */
+	void start_evaluation(const PixelScale &scale, const Point &offset, double magzero);
+
+	/*
+	 * Calculates the quantities derived from the shape parameters of this
+	 * profile, see shape_parameters_changed()
+	 */
+	void shape_calculations();
+
+	/* The [first, last) range of pixels of a single image row */
+	typedef std::pair<unsigned int, unsigned int> pixel_span;
+
+	/*
+	 * Returns, for each row of an image of dimensions `dims`, the span of
+	 * pixels covered by this profile's footprint (i.e., the pixels that can
+	 * receive flux from this profile).
+	 */
+	std::vector<pixel_span> footprint(const Dimensions &dims, const PixelScale &scale);
+
 	void _image_to_profile_coordinates(double x, double y, double &x_prof, double &y_prof);
 
-	double subsample_pixel(double x0, double x1,
-	                       double y0, double y1,
-	                       unsigned int recur_level,
-	                       unsigned int max_recursions,
-	                       unsigned int resolution);
+	/*
+	 * Evaluates this profile at the given profile coordinates using the
+	 * Model's instruction set, or evaluate_at if vectorisation is not possible
+	 */
+	template <typename FT>
+	void _evaluate_many(const FT *x, const FT *y, FT *values, std::size_t n) const;
+
+	/*
+	 * A table of the logarithm of this profile's values against the logarithm
+	 * of the radius, interpolated with cubic splines. Segments of the table
+	 * whose interpolation doesn't meet tabulate_acc are marked as invalid,
+	 * and the profile is evaluated directly on them.
+	 */
+	struct radial_table {
+		bool enabled = false;
+		double log_r_min = 0;
+		double inv_h = 0;
+		std::size_t n_segments = 0;
+		/* The 4 coefficients of each segment's cubic polynomial */
+		std::vector<double> coeffs;
+		std::vector<char> valid;
+		/*
+		 * Values at the knots, and at the middle and quarter points of each
+		 * segment, used to build the table
+		 */
+		std::vector<double> log_values;
+		std::vector<double> mid_log_values;
+		std::vector<double> quarter_log_values;
+		std::vector<double> second_derivatives;
+		std::vector<double> scratch;
+	};
+	radial_table table;
+
+	/* Values of pixels given by precalculated_pixels */
+	std::vector<std::pair<unsigned int, double>> precalculated_values;
+
+	/*
+	 * The largest radius (in profile coordinates) at which this profile is
+	 * evaluated on an image with dimensions `dims`
+	 */
+	double max_evaluation_radius(const Dimensions &dims, const PixelScale &scale);
+
+	/*
+	 * Builds the table of values used when `tabulate` is on, covering the
+	 * radii needed to evaluate an image with dimensions `dims`
+	 */
+	void build_table(const Dimensions &dims, const PixelScale &scale);
+
+	/*
+	 * Evaluates this profile at the given profile coordinates using the
+	 * table, vectorising what it can with the given instruction set
+	 */
+	template <typename FT>
+	void evaluate_tabulated(const FT *x, const FT *y, FT *values, std::size_t n,
+	                        simd_instruction_set instruction_set) const;
+
+	/*
+	 * Per-thread scratch memory used during evaluate_cpu. It is kept
+	 * between evaluations so steady-state evaluations don't allocate memory
+	 */
+	struct subsampling_node;
+	template <typename FT>
+	struct subsampling_level;
+	template <typename FT>
+	struct evaluation_scratch;
+	template <typename FT>
+	static evaluation_scratch<FT> &thread_scratch();
 
+	/*
+	 * Subsamples the nodes found at level `recur_level` of the scratch
+	 * memory, calculating the (non-averaged) sum of the values of their
+	 * sub-pixels, including those of further recursion levels
+	 */
+	template <typename FT>
+	void subsample_level(unsigned int recur_level);
+
+	/*
+	 * Calculates the sub-pixels and evaluation points of all nodes in
+	 * `level`, which is at recursion depth `recur_level`
+	 */
+	template <typename FT>
+	void prepare_subsampling_level(subsampling_level<FT> &level, unsigned int recur_level);
+
+	/*
+	 * Whether `node`, being the mirror image of another node, can reuse
+	 * the other node's refinement decisions
+	 */
+	bool mirror_reuses_refinement(const subsampling_node &node) const;
+
+	/*
+	 * A point at which this profile is integrated, contributing
+	 * `weight * value` to the value of `pixel`
+	 */
+	struct integration_point;
+
+	/*
+	 * Whether evaluate_cpu should record its integration points in the
+	 * scratch memory, see evaluate_derivatives
+	 */
+	bool record_integration_points;
+
+	/*
+	 * Evaluates this profile at all `points` with its current parameters,
+	 * adding `factor * weight * value` to each point's pixel in `image`
+	 */
+	void add_integration_points(Image &image, const std::vector<integration_point> &points,
+	    const PixelScale &scale, const Point &offset, double factor);
 
 #ifdef PROFIT_DEBUG
 	/* record of how many subintegrations we've done */
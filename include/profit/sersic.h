@@ -75,6 +75,12 @@ public:
 
 	void validate() override;
 
+	/**
+	 * Forgets the central pixel values cached by profiles with
+	 * `cache_center` on, both in memory and on disk
+	 */
+	static void clear_central_pixel_cache();
+
 protected:
 
 	/*
@@ -82,10 +88,11 @@ protected:
 	 * Inherited from RadialProfile
 	 * ----------------------------
 	 */
-	void evaluate(Image &image, const Mask &mask, const PixelScale &scale,
-	    const Point &offset, double magzero) override;
 	void initial_calculations() override;
 	void subsampling_params(double x, double y, unsigned int &res, unsigned int &max_rec) override;
+	void precalculated_pixels(const Dimensions &dims, const PixelScale &scale,
+	    std::vector<std::pair<unsigned int, double>> &values) override;
+	void prepare_evaluation(double r_max) override;
 	double get_pixel_scale(const PixelScale &scale) override;
 
 	double get_lumtot() override;
@@ -94,6 +101,10 @@ protected:
 	double adjust_rscale_switch() override;
 	double adjust_rscale_max() override;
 	double evaluate_at(double x, double y) const override;
+	void evaluate_many(const double *x, const double *y, double *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
+	void evaluate_many(const float *x, const float *y, float *values,
+	    std::size_t n, simd_instruction_set instruction_set) const override;
 
 private:
 
@@ -119,19 +130,58 @@ private:
 	 * Rescale flux up to rscale_max or not
 	 */
 	bool rescale_flux;
+
+	/**
+	 * Whether the values of the pixels closest to the profile centre,
+	 * which are heavily subsampled, should be interpolated from a persistent
+	 * cache of pre-integrated values instead. Only applies to non-boxy
+	 * profiles with ``nser > 1`` when ``adjust`` is on. Interpolated values
+	 * are about as accurate as the subsampled values they replace: they are
+	 * usually within 0.5% of accurately integrated values, but can be a few
+	 * percent off for very concentrated profiles.
+	 */
+	bool cache_center;
+
+	/**
+	 * Whether the vectorised evaluation of the profile should use fast
+	 * approximations of the transcendental functions, with errors well below
+	 * ``acc``.
+	 */
+	bool fast_math;
 	// @}
 
 	/* these are internally calculated when the profile is evaluated */
 	double _bn;
 	double _rescale_factor;
+	unsigned int _fast_math_order;
 
 	double (*m_eval_function)(double x, double y, double box, double re, double nser, double bn);
+	void (*m_eval_many_function)(simd_instruction_set instruction_set,
+	    const double *x, const double *y, double *values, std::size_t n,
+	    double box, double re, double nser, double bn);
+	void (*m_eval_many_float_function)(simd_instruction_set instruction_set,
+	    const float *x, const float *y, float *values, std::size_t n,
+	    double box, double re, double nser, double bn);
+
+	/* Sets the evaluation functions for the current shape and fast math order */
+	void select_eval_functions();
 
 	template <bool boxy, SersicProfile::rfactor_invexp_t t>
 	void init_eval_function();
 
+	template <bool boxy, SersicProfile::rfactor_invexp_t t, unsigned int Order>
+	void init_eval_many_function();
+
 	double fluxfrac(double fraction) const;
 
+	/*
+	 * The log of the average value over a pixel of a sersic profile, used to
+	 * populate the cache of central pixel values. `params` holds nser, axrat,
+	 * log10(re), ang, and the position of the pixel relative to the profile
+	 * centre, all in pixel units.
+	 */
+	static double central_pixel_log_value(const double (&params)[6]);
+
 #ifdef PROFIT_OPENCL
 
 protected:
@@ -0,0 +1,719 @@
+/**
+ * Vectorised math functions for libprofit
+ *
+ * ICRAR - International Centre for Radio Astronomy Research
+ * (c) UWA - The University of Western Australia, 2019
+ * Copyright by UWA (in the framework of the ICRAR)
+ * All rights reserved
+ *
+ * Contributed by Rodrigo Tobar
+ *
+ * This file is part of libprofit.
+ *
+ * libprofit is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libprofit is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libprofit.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFIT_SIMD_MATH_H_
+#define PROFIT_SIMD_MATH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#include "profit/config.h"
+#include "profit/common.h"
+
+#ifdef PROFIT_HAS_SSE2
+#include <emmintrin.h>
+#endif // PROFIT_HAS_SSE2
+
+#ifdef PROFIT_HAS_AVX
+#include <immintrin.h>
+#endif // PROFIT_HAS_AVX
+
+namespace profit {
+
+/*
+ * =============================================================================
+ * Per-instruction set primitive operations
+ * =============================================================================
+ *
+ * simd_traits<SIMD, FT> exposes the vector type for a given instruction set
+ * and floating-point type, its width (number of FT values), and the basic
+ * operations on which the transcendental functions below are built upon.
+ * Comparisons return vector masks that are consumed by select().
+ */
+template <simd_instruction_set SIMD, typename FT = double>
+struct simd_traits;
+
+#ifdef PROFIT_HAS_SSE2
+template <>
+struct simd_traits<SSE2, double> {
+
+	typedef __m128d vector_type;
+	static constexpr std::size_t width = 2;
+
+	static vector_type load(const double *p) { return _mm_loadu_pd(p); }
+	static void store(double *p, vector_type v) { _mm_storeu_pd(p, v); }
+	static vector_type set1(double x) { return _mm_set1_pd(x); }
+
+	static vector_type add(vector_type a, vector_type b) { return _mm_add_pd(a, b); }
+	static vector_type sub(vector_type a, vector_type b) { return _mm_sub_pd(a, b); }
+	static vector_type mul(vector_type a, vector_type b) { return _mm_mul_pd(a, b); }
+	static vector_type div(vector_type a, vector_type b) { return _mm_div_pd(a, b); }
+	static vector_type sqrt(vector_type a) { return _mm_sqrt_pd(a); }
+	// if a is NaN then the second argument is returned
+	static vector_type min(vector_type a, vector_type b) { return _mm_min_pd(a, b); }
+	static vector_type max(vector_type a, vector_type b) { return _mm_max_pd(a, b); }
+	static vector_type abs(vector_type a) { return _mm_andnot_pd(_mm_set1_pd(-0.), a); }
+
+	static vector_type lt(vector_type a, vector_type b) { return _mm_cmplt_pd(a, b); }
+	static vector_type gt(vector_type a, vector_type b) { return _mm_cmpgt_pd(a, b); }
+	static vector_type eq(vector_type a, vector_type b) { return _mm_cmpeq_pd(a, b); }
+	static vector_type not_ge(vector_type a, vector_type b) { return _mm_cmpnge_pd(a, b); }
+	static vector_type select(vector_type mask, vector_type a, vector_type b)
+	{
+		return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+	}
+
+	// Round to nearest; valid only for |a| < 2^51, which is all we need
+	static vector_type round(vector_type a)
+	{
+		const auto magic = _mm_set1_pd(6755399441055744.);
+		return _mm_sub_pd(_mm_add_pd(a, magic), magic);
+	}
+
+	// a * 2^n for integer-valued n within [-2044, 2046]. We scale in two steps
+	// so that each individual factor has a normal exponent
+	static vector_type ldexp(vector_type a, vector_type n)
+	{
+		auto n_1 = _mm_cvtpd_epi32(n);
+		auto n_2 = _mm_srai_epi32(n_1, 1);
+		n_1 = _mm_sub_epi32(n_1, n_2);
+		return _mm_mul_pd(_mm_mul_pd(a, pow2i(n_1)), pow2i(n_2));
+	}
+
+	// 2^n for each of the two lower integers of n, within [-1022, 1023]
+	static vector_type pow2i(__m128i n)
+	{
+		auto biased = _mm_add_epi32(n, _mm_set1_epi32(1023));
+		auto bits = _mm_unpacklo_epi32(biased, _mm_setzero_si128());
+		return _mm_castsi128_pd(_mm_slli_epi64(bits, 52));
+	}
+
+	// Splits a positive, normal a into mantissa in [1, 2) and unbiased exponent
+	static void split(vector_type a, vector_type &mantissa, vector_type &exponent)
+	{
+		auto bits = _mm_castpd_si128(a);
+		auto mantissa_mask = _mm_set1_epi64x(0x000fffffffffffffLL);
+		auto one_bits = _mm_set1_epi64x(0x3ff0000000000000LL);
+		mantissa = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, mantissa_mask), one_bits));
+		auto biased = _mm_srli_epi64(bits, 52);
+		biased = _mm_shuffle_epi32(biased, _MM_SHUFFLE(3, 3, 2, 0));
+		exponent = _mm_sub_pd(_mm_cvtepi32_pd(biased), _mm_set1_pd(1023.));
+	}
+};
+
+template <>
+struct simd_traits<SSE2, float> {
+
+	typedef __m128 vector_type;
+	static constexpr std::size_t width = 4;
+
+	static vector_type load(const float *p) { return _mm_loadu_ps(p); }
+	static void store(float *p, vector_type v) { _mm_storeu_ps(p, v); }
+	static vector_type set1(float x) { return _mm_set1_ps(x); }
+
+	static vector_type add(vector_type a, vector_type b) { return _mm_add_ps(a, b); }
+	static vector_type sub(vector_type a, vector_type b) { return _mm_sub_ps(a, b); }
+	static vector_type mul(vector_type a, vector_type b) { return _mm_mul_ps(a, b); }
+	static vector_type div(vector_type a, vector_type b) { return _mm_div_ps(a, b); }
+	static vector_type sqrt(vector_type a) { return _mm_sqrt_ps(a); }
+	// if a is NaN then the second argument is returned
+	static vector_type min(vector_type a, vector_type b) { return _mm_min_ps(a, b); }
+	static vector_type max(vector_type a, vector_type b) { return _mm_max_ps(a, b); }
+	static vector_type abs(vector_type a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+
+	static vector_type lt(vector_type a, vector_type b) { return _mm_cmplt_ps(a, b); }
+	static vector_type gt(vector_type a, vector_type b) { return _mm_cmpgt_ps(a, b); }
+	static vector_type eq(vector_type a, vector_type b) { return _mm_cmpeq_ps(a, b); }
+	static vector_type not_ge(vector_type a, vector_type b) { return _mm_cmpnge_ps(a, b); }
+	static vector_type select(vector_type mask, vector_type a, vector_type b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	// Round to nearest; valid only for |a| < 2^22, which is all we need
+	static vector_type round(vector_type a)
+	{
+		const auto magic = _mm_set1_ps(12582912.f);
+		return _mm_sub_ps(_mm_add_ps(a, magic), magic);
+	}
+
+	// a * 2^n for integer-valued n within [-252, 254], scaled in two steps
+	static vector_type ldexp(vector_type a, vector_type n)
+	{
+		auto n_1 = _mm_cvtps_epi32(n);
+		auto n_2 = _mm_srai_epi32(n_1, 1);
+		n_1 = _mm_sub_epi32(n_1, n_2);
+		return _mm_mul_ps(_mm_mul_ps(a, pow2i(n_1)), pow2i(n_2));
+	}
+
+	// 2^n for each of the integers of n, within [-126, 127]
+	static vector_type pow2i(__m128i n)
+	{
+		return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+	}
+
+	// Splits a positive, normal a into mantissa in [1, 2) and unbiased exponent
+	static void split(vector_type a, vector_type &mantissa, vector_type &exponent)
+	{
+		auto bits = _mm_castps_si128(a);
+		auto mantissa_mask = _mm_set1_epi32(0x007fffff);
+		auto one_bits = _mm_set1_epi32(0x3f800000);
+		mantissa = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, mantissa_mask), one_bits));
+		auto biased = _mm_srli_epi32(bits, 23);
+		exponent = _mm_sub_ps(_mm_cvtepi32_ps(biased), _mm_set1_ps(127.f));
+	}
+};
+#endif // PROFIT_HAS_SSE2
+
+#if defined(PROFIT_HAS_AVX) && defined(PROFIT_HAS_SSE2)
+template <>
+struct simd_traits<AVX, double> {
+
+	typedef __m256d vector_type;
+	static constexpr std::size_t width = 4;
+
+	static vector_type load(const double *p) { return _mm256_loadu_pd(p); }
+	static void store(double *p, vector_type v) { _mm256_storeu_pd(p, v); }
+	static vector_type set1(double x) { return _mm256_set1_pd(x); }
+
+	static vector_type add(vector_type a, vector_type b) { return _mm256_add_pd(a, b); }
+	static vector_type sub(vector_type a, vector_type b) { return _mm256_sub_pd(a, b); }
+	static vector_type mul(vector_type a, vector_type b) { return _mm256_mul_pd(a, b); }
+	static vector_type div(vector_type a, vector_type b) { return _mm256_div_pd(a, b); }
+	static vector_type sqrt(vector_type a) { return _mm256_sqrt_pd(a); }
+	// if a is NaN then the second argument is returned
+	static vector_type min(vector_type a, vector_type b) { return _mm256_min_pd(a, b); }
+	static vector_type max(vector_type a, vector_type b) { return _mm256_max_pd(a, b); }
+	static vector_type abs(vector_type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), a); }
+
+	static vector_type lt(vector_type a, vector_type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+	static vector_type gt(vector_type a, vector_type b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+	static vector_type eq(vector_type a, vector_type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+	static vector_type not_ge(vector_type a, vector_type b) { return _mm256_cmp_pd(a, b, _CMP_NGE_UQ); }
+	static vector_type select(vector_type mask, vector_type a, vector_type b)
+	{
+		return _mm256_blendv_pd(b, a, mask);
+	}
+
+	static vector_type round(vector_type a)
+	{
+		return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	}
+
+	// AVX lacks 256-bit integer operations, so we work on each SSE2 half
+	static vector_type ldexp(vector_type a, vector_type n)
+	{
+		auto lo = simd_traits<SSE2>::ldexp(_mm256_castpd256_pd128(a), _mm256_castpd256_pd128(n));
+		auto hi = simd_traits<SSE2>::ldexp(_mm256_extractf128_pd(a, 1), _mm256_extractf128_pd(n, 1));
+		return _mm256_insertf128_pd(_mm256_castpd128_pd256(lo), hi, 1);
+	}
+
+	static void split(vector_type a, vector_type &mantissa, vector_type &exponent)
+	{
+		__m128d m_lo, m_hi, e_lo, e_hi;
+		simd_traits<SSE2>::split(_mm256_castpd256_pd128(a), m_lo, e_lo);
+		simd_traits<SSE2>::split(_mm256_extractf128_pd(a, 1), m_hi, e_hi);
+		mantissa = _mm256_insertf128_pd(_mm256_castpd128_pd256(m_lo), m_hi, 1);
+		exponent = _mm256_insertf128_pd(_mm256_castpd128_pd256(e_lo), e_hi, 1);
+	}
+};
+
+template <>
+struct simd_traits<AVX, float> {
+
+	typedef __m256 vector_type;
+	static constexpr std::size_t width = 8;
+
+	static vector_type load(const float *p) { return _mm256_loadu_ps(p); }
+	static void store(float *p, vector_type v) { _mm256_storeu_ps(p, v); }
+	static vector_type set1(float x) { return _mm256_set1_ps(x); }
+
+	static vector_type add(vector_type a, vector_type b) { return _mm256_add_ps(a, b); }
+	static vector_type sub(vector_type a, vector_type b) { return _mm256_sub_ps(a, b); }
+	static vector_type mul(vector_type a, vector_type b) { return _mm256_mul_ps(a, b); }
+	static vector_type div(vector_type a, vector_type b) { return _mm256_div_ps(a, b); }
+	static vector_type sqrt(vector_type a) { return _mm256_sqrt_ps(a); }
+	// if a is NaN then the second argument is returned
+	static vector_type min(vector_type a, vector_type b) { return _mm256_min_ps(a, b); }
+	static vector_type max(vector_type a, vector_type b) { return _mm256_max_ps(a, b); }
+	static vector_type abs(vector_type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+
+	static vector_type lt(vector_type a, vector_type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static vector_type gt(vector_type a, vector_type b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static vector_type eq(vector_type a, vector_type b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static vector_type not_ge(vector_type a, vector_type b) { return _mm256_cmp_ps(a, b, _CMP_NGE_UQ); }
+	static vector_type select(vector_type mask, vector_type a, vector_type b)
+	{
+		return _mm256_blendv_ps(b, a, mask);
+	}
+
+	static vector_type round(vector_type a)
+	{
+		return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	}
+
+	// AVX lacks 256-bit integer operations, so we work on each SSE2 half
+	static vector_type ldexp(vector_type a, vector_type n)
+	{
+		auto lo = simd_traits<SSE2, float>::ldexp(_mm256_castps256_ps128(a), _mm256_castps256_ps128(n));
+		auto hi = simd_traits<SSE2, float>::ldexp(_mm256_extractf128_ps(a, 1), _mm256_extractf128_ps(n, 1));
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+	}
+
+	static void split(vector_type a, vector_type &mantissa, vector_type &exponent)
+	{
+		__m128 m_lo, m_hi, e_lo, e_hi;
+		simd_traits<SSE2, float>::split(_mm256_castps256_ps128(a), m_lo, e_lo);
+		simd_traits<SSE2, float>::split(_mm256_extractf128_ps(a, 1), m_hi, e_hi);
+		mantissa = _mm256_insertf128_ps(_mm256_castps128_ps256(m_lo), m_hi, 1);
+		exponent = _mm256_insertf128_ps(_mm256_castps128_ps256(e_lo), e_hi, 1);
+	}
+};
+#endif // PROFIT_HAS_AVX && PROFIT_HAS_SSE2
+
+/*
+ * =============================================================================
+ * Transcendental functions
+ * =============================================================================
+ *
+ * In double precision log follows the algorithm (and constants) of fdlibm's
+ * implementation, while exp uses the same argument reduction but a polynomial
+ * approximation without divisions. Their errors are within 1 and 3 ulp
+ * respectively. The single precision versions follow the same approach with
+ * the constants of fdlibm's logf/expf and shorter polynomials.
+ */
+template <simd_instruction_set SIMD, typename FT>
+struct simd_math_functions;
+
+template <simd_instruction_set SIMD>
+struct simd_math_functions<SIMD, double> {
+
+	typedef simd_traits<SIMD, double> S;
+	typedef typename S::vector_type vector_type;
+
+	static vector_type exp(vector_type x)
+	{
+		// Out-of-range values naturally overflow (underflow) to inf (0) when
+		// scaling by 2^k below, NaNs propagate through
+		x = S::max(S::set1(-746.), S::min(S::set1(710.), x));
+
+		// x = k*ln2 + r, |r| <= 0.5*ln2
+		auto k = S::round(S::mul(x, S::set1(1.44269504088896338700e+00)));
+		auto hi = S::sub(x, S::mul(k, S::set1(6.93147180369123816490e-01)));
+		auto lo = S::mul(k, S::set1(1.90821492927058770002e-10));
+		auto r = S::sub(hi, lo);
+
+		// exp(r) as its Taylor series up to r^12, evaluated with Estrin's scheme
+		// to shorten the dependency chain
+		auto r2 = S::mul(r, r);
+		auto r4 = S::mul(r2, r2);
+		auto r8 = S::mul(r4, r4);
+		auto a0 = S::add(S::set1(1.), r);
+		auto a1 = S::add(S::set1(1. / 2), S::mul(r, S::set1(1. / 6)));
+		auto a2 = S::add(S::set1(1. / 24), S::mul(r, S::set1(1. / 120)));
+		auto a3 = S::add(S::set1(1. / 720), S::mul(r, S::set1(1. / 5040)));
+		auto a4 = S::add(S::set1(1. / 40320), S::mul(r, S::set1(1. / 362880)));
+		auto a5 = S::add(S::set1(1. / 3628800), S::mul(r, S::set1(1. / 39916800)));
+		auto b0 = S::add(a0, S::mul(a1, r2));
+		auto b1 = S::add(a2, S::mul(a3, r2));
+		auto b2 = S::add(a4, S::mul(a5, r2));
+		auto c0 = S::add(b0, S::mul(b1, r4));
+		auto c1 = S::add(b2, S::mul(S::set1(1. / 479001600), r4));
+		auto y = S::add(c0, S::mul(c1, r8));
+
+		return S::ldexp(y, k);
+	}
+
+	static vector_type log(vector_type x)
+	{
+		const auto zero = S::set1(0.);
+		const auto one = S::set1(1.);
+		const auto inf = S::set1(std::numeric_limits<double>::infinity());
+		auto is_zero = S::eq(x, zero);
+		auto is_inf = S::eq(x, inf);
+		auto is_invalid = S::not_ge(x, zero); // negative or NaN
+
+		// Bring subnormals into the normal range
+		auto subnormal = S::lt(x, S::set1(std::numeric_limits<double>::min()));
+		x = S::select(subnormal, S::mul(x, S::set1(18014398509481984.)), x);
+
+		// x = 2^k * (1+f), sqrt(2)/2 < 1+f < sqrt(2)
+		vector_type m, k;
+		S::split(x, m, k);
+		k = S::select(subnormal, S::sub(k, S::set1(54.)), k);
+		auto big = S::gt(m, S::set1(1.41421356237309504880));
+		m = S::select(big, S::mul(m, S::set1(0.5)), m);
+		k = S::select(big, S::add(k, one), k);
+		auto f = S::sub(m, one);
+
+		// log(1+f) = f - (hfsq - s*(hfsq+R))
+		auto s = S::div(f, S::add(S::set1(2.), f));
+		auto z = S::mul(s, s);
+		auto w = S::mul(z, z);
+		auto t1 = S::add(S::set1(2.222219843214978396e-01), S::mul(w, S::set1(1.531383769920937332e-01)));
+		t1 = S::mul(w, S::add(S::set1(3.999999999940941908e-01), S::mul(w, t1)));
+		auto t2 = S::add(S::set1(1.818357216161805012e-01), S::mul(w, S::set1(1.479819860511658591e-01)));
+		t2 = S::add(S::set1(2.857142874366239149e-01), S::mul(w, t2));
+		t2 = S::mul(z, S::add(S::set1(6.666666666666735130e-01), S::mul(w, t2)));
+		auto R = S::add(t1, t2);
+		auto hfsq = S::mul(S::set1(0.5), S::mul(f, f));
+		auto k_lo = S::mul(k, S::set1(1.90821492927058770002e-10));
+		auto k_hi = S::mul(k, S::set1(6.93147180369123816490e-01));
+		auto y = S::sub(S::sub(hfsq, S::add(S::mul(s, S::add(hfsq, R)), k_lo)), f);
+		y = S::sub(k_hi, y);
+
+		y = S::select(is_inf, inf, y);
+		y = S::select(is_zero, S::set1(-std::numeric_limits<double>::infinity()), y);
+		return S::select(is_invalid, S::set1(std::numeric_limits<double>::quiet_NaN()), y);
+	}
+};
+
+template <simd_instruction_set SIMD>
+struct simd_math_functions<SIMD, float> {
+
+	typedef simd_traits<SIMD, float> S;
+	typedef typename S::vector_type vector_type;
+
+	static vector_type exp(vector_type x)
+	{
+		// See the double precision version
+		x = S::max(S::set1(-104.f), S::min(S::set1(89.f), x));
+
+		// x = k*ln2 + r, |r| <= 0.5*ln2
+		auto k = S::round(S::mul(x, S::set1(1.4426950216e+00f)));
+		auto hi = S::sub(x, S::mul(k, S::set1(6.9314575195e-01f)));
+		auto lo = S::mul(k, S::set1(1.4286067653e-06f));
+		auto r = S::sub(hi, lo);
+
+		// exp(r) as its Taylor series up to r^7
+		auto r2 = S::mul(r, r);
+		auto r4 = S::mul(r2, r2);
+		auto a0 = S::add(S::set1(1.f), r);
+		auto a1 = S::add(S::set1(1.f / 2), S::mul(r, S::set1(1.f / 6)));
+		auto a2 = S::add(S::set1(1.f / 24), S::mul(r, S::set1(1.f / 120)));
+		auto a3 = S::add(S::set1(1.f / 720), S::mul(r, S::set1(1.f / 5040)));
+		auto b0 = S::add(a0, S::mul(a1, r2));
+		auto b1 = S::add(a2, S::mul(a3, r2));
+		auto y = S::add(b0, S::mul(b1, r4));
+
+		return S::ldexp(y, k);
+	}
+
+	static vector_type log(vector_type x)
+	{
+		const auto zero = S::set1(0.f);
+		const auto one = S::set1(1.f);
+		const auto inf = S::set1(std::numeric_limits<float>::infinity());
+		auto is_zero = S::eq(x, zero);
+		auto is_inf = S::eq(x, inf);
+		auto is_invalid = S::not_ge(x, zero); // negative or NaN
+
+		// Bring subnormals into the normal range
+		auto subnormal = S::lt(x, S::set1(std::numeric_limits<float>::min()));
+		x = S::select(subnormal, S::mul(x, S::set1(33554432.f)), x);
+
+		// x = 2^k * (1+f), sqrt(2)/2 < 1+f < sqrt(2)
+		vector_type m, k;
+		S::split(x, m, k);
+		k = S::select(subnormal, S::sub(k, S::set1(25.f)), k);
+		auto big = S::gt(m, S::set1(1.41421356f));
+		m = S::select(big, S::mul(m, S::set1(0.5f)), m);
+		k = S::select(big, S::add(k, one), k);
+		auto f = S::sub(m, one);
+
+		// log(1+f) = f - (hfsq - s*(hfsq+R))
+		auto s = S::div(f, S::add(S::set1(2.f), f));
+		auto z = S::mul(s, s);
+		auto w = S::mul(z, z);
+		auto t1 = S::mul(w, S::add(S::set1(4.0000000596e-01f), S::mul(w, S::set1(2.2222198546e-01f))));
+		auto t2 = S::mul(z, S::add(S::set1(6.6666668653e-01f), S::mul(w, S::set1(2.8571429849e-01f))));
+		auto R = S::add(t1, t2);
+		auto hfsq = S::mul(S::set1(0.5f), S::mul(f, f));
+		auto k_lo = S::mul(k, S::set1(9.0580006145e-06f));
+		auto k_hi = S::mul(k, S::set1(6.9313812256e-01f));
+		auto y = S::sub(S::sub(hfsq, S::add(S::mul(s, S::add(hfsq, R)), k_lo)), f);
+		y = S::sub(k_hi, y);
+
+		y = S::select(is_inf, inf, y);
+		y = S::select(is_zero, S::set1(-std::numeric_limits<float>::infinity()), y);
+		return S::select(is_invalid, S::set1(std::numeric_limits<float>::quiet_NaN()), y);
+	}
+};
+
+/// exp(x)
+template <simd_instruction_set SIMD, typename FT = double>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_exp(typename simd_traits<SIMD, FT>::vector_type x)
+{
+	return simd_math_functions<SIMD, FT>::exp(x);
+}
+
+/// log(x)
+template <simd_instruction_set SIMD, typename FT = double>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_log(typename simd_traits<SIMD, FT>::vector_type x)
+{
+	return simd_math_functions<SIMD, FT>::log(x);
+}
+
+/// pow(x, y) for non-negative x
+template <simd_instruction_set SIMD, typename FT = double>
+inline
+typename simd_traits<SIMD, FT>::vector_type simd_pow(typename simd_traits<SIMD, FT>::vector_type x, double y)
+{
+	typedef simd_traits<SIMD, FT> S;
+	const auto one = S::set1(1.);
+	if (y == 0) {
+		return one;
+	}
+	else if (y == 1) {
+		return x;
+	}
+	else if (y == 2) {
+		return S::mul(x, x);
+	}
+	else if (y == 0.5) {
+		return S::sqrt(x);
+	}
+	auto result = simd_exp<SIMD, FT>(S::mul(S::set1(y), simd_log<SIMD, FT>(x)));
+	return S::select(S::eq(x, one), one, result);
+}
+
+/*
+ * =============================================================================
+ * Fast approximations
+ * =============================================================================
+ *
+ * Cheaper exp, log and pow that trade accuracy for speed. They use the same
+ * argument reductions as the functions above, but evaluate truncated series:
+ * exp(r) as its Taylor polynomial of degree Order for |r| <= ln(2)/2, and
+ * log(1+f) = 2*atanh(s), s = f/(2+f), |s| <= 3-2*sqrt(2), using its first
+ * Order/2 + 1 terms. Special values other than zeros and overflows are not
+ * handled. simd_fast_math_error gives the error bound for each Order, and
+ * Order 0 falls back to the accurate functions.
+ */
+template <simd_instruction_set SIMD, typename FT, unsigned int Order>
+struct simd_fast_math_functions {
+
+	typedef simd_traits<SIMD, FT> S;
+	typedef typename S::vector_type vector_type;
+
+	static constexpr bool is_double = sizeof(FT) == sizeof(double);
+
+	static vector_type exp(vector_type x)
+	{
+		x = S::max(S::set1(is_double ? -746. : -104.), S::min(S::set1(is_double ? 710. : 89.), x));
+
+		// x = k*ln2 + r, |r| <= 0.5*ln2
+		auto k = S::round(S::mul(x, S::set1(1.44269504088896338700e+00)));
+		auto r = S::sub(S::sub(x, S::mul(k, S::set1(ln2_hi()))), S::mul(k, S::set1(ln2_lo())));
+
+		// 1 + r(1 + r/2(1 + r/3(... (1 + r/Order))))
+		const auto one = S::set1(1.);
+		auto y = one;
+		for (unsigned int i = Order; i != 0; i--) {
+			y = S::add(one, S::mul(y, S::mul(r, S::set1(1. / i))));
+		}
+		return S::ldexp(y, k);
+	}
+
+	static vector_type log(vector_type x)
+	{
+		auto is_zero = S::eq(x, S::set1(0.));
+
+		// x = 2^k * (1+f), sqrt(2)/2 < 1+f < sqrt(2)
+		vector_type m, k;
+		S::split(x, m, k);
+		auto big = S::gt(m, S::set1(1.41421356237309504880));
+		m = S::select(big, S::mul(m, S::set1(0.5)), m);
+		k = S::select(big, S::add(k, S::set1(1.)), k);
+		auto f = S::sub(m, S::set1(1.));
+
+		// 2*s*(1 + z/3 + z^2/5 + ...), z = s^2
+		constexpr unsigned int terms = Order / 2 + 1;
+		auto s = S::div(f, S::add(S::set1(2.), f));
+		auto z = S::mul(s, s);
+		auto p = S::set1(1. / (2 * terms - 1));
+		for (unsigned int i = terms - 1; i != 0; i--) {
+			p = S::add(S::set1(1. / (2 * i - 1)), S::mul(p, z));
+		}
+		auto y = S::add(S::mul(k, S::set1(ln2_lo())), S::mul(S::add(s, s), p));
+		y = S::add(S::mul(k, S::set1(ln2_hi())), y);
+
+		return S::select(is_zero, S::set1(-std::numeric_limits<FT>::infinity()), y);
+	}
+
+	static vector_type pow(vector_type x, double y)
+	{
+		if (y == 0 || y == 1 || y == 2 || y == 0.5) {
+			return simd_pow<SIMD, FT>(x, y);
+		}
+		const auto one = S::set1(1.);
+		auto result = exp(S::mul(S::set1(y), log(x)));
+		return S::select(S::eq(x, one), one, result);
+	}
+
+private:
+
+	// ln(2) split in a high part with trailing zeros, so k*ln2_hi is exact,
+	// and a low part with the rest
+	static constexpr double ln2_hi()
+	{
+		return is_double ? 6.93147180369123816490e-01 : 6.9314575195e-01;
+	}
+	static constexpr double ln2_lo()
+	{
+		return is_double ? 1.90821492927058770002e-10 : 1.4286067653e-06;
+	}
+};
+
+template <simd_instruction_set SIMD, typename FT>
+struct simd_fast_math_functions<SIMD, FT, 0> {
+
+	typedef typename simd_traits<SIMD, FT>::vector_type vector_type;
+
+	static vector_type exp(vector_type x) { return simd_exp<SIMD, FT>(x); }
+	static vector_type log(vector_type x) { return simd_log<SIMD, FT>(x); }
+	static vector_type pow(vector_type x, double y) { return simd_pow<SIMD, FT>(x, y); }
+};
+
+/// The orders for which fast math functions are instantiated, from least
+/// to most accurate
+constexpr unsigned int simd_fast_math_orders[] = {4, 6, 8, 10};
+
+/// The maximum relative error of the fast exp function, and absolute error of
+/// the fast log function, of the given @p order, excluding rounding errors
+inline
+double simd_fast_math_error(unsigned int order)
+{
+	// Lagrange remainders of both series at the edges of their domains;
+	// relative to exp(r) the remainder of exp grows by up to exp(|r|)
+	double r = std::log(2.) / 2;
+	double exp_error = std::sqrt(2.);
+	for (unsigned int i = 1; i != order + 2; i++) {
+		exp_error *= r / i;
+	}
+	double s = 3 - 2 * std::sqrt(2.);
+	unsigned int terms = order / 2 + 1;
+	double log_error = 2 * std::pow(s, 2 * terms + 1) / (2 * terms + 1) / (1 - s * s);
+	return std::max(exp_error, log_error);
+}
+
+/// The lowest fast math order whose error is within @p tolerance, or 0 if
+/// there is none and accurate functions should be used instead
+inline
+unsigned int simd_fast_math_order(double tolerance)
+{
+	for (auto order: simd_fast_math_orders) {
+		if (simd_fast_math_error(order) <= tolerance) {
+			return order;
+		}
+	}
+	return 0;
+}
+
+/*
+ * =============================================================================
+ * Batch evaluation
+ * =============================================================================
+ */
+
+/// Evaluates @p kernel on the @p n points given by @p x and @p y, storing the
+/// results in @p values. The last points that don't fill an entire vector are
+/// evaluated on a padded copy, so every point goes through the same code.
+template <simd_instruction_set SIMD, typename Kernel, typename FT>
+inline
+void simd_transform(const Kernel &kernel, const FT *x, const FT *y, FT *values, std::size_t n)
+{
+	typedef simd_traits<SIMD, FT> S;
+	constexpr std::size_t width = S::width;
+
+	std::size_t i = 0;
+	for (; i + width <= n; i += width) {
+		S::store(values + i, kernel(S::load(x + i), S::load(y + i)));
+	}
+
+	auto rem = n - i;
+	if (rem) {
+		FT x_pad[width] = {0};
+		FT y_pad[width] = {0};
+		FT values_pad[width];
+		std::copy(x + i, x + n, x_pad);
+		std::copy(y + i, y + n, y_pad);
+		S::store(values_pad, kernel(S::load(x_pad), S::load(y_pad)));
+		std::copy(values_pad, values_pad + rem, values + i);
+	}
+}
+
+/// Whether there is a vectorised implementation of the math functions
+/// for @p instruction_set.
+inline
+bool has_simd_math(simd_instruction_set instruction_set)
+{
+#if defined(PROFIT_HAS_AVX) && defined(PROFIT_HAS_SSE2)
+	if (instruction_set == AVX) {
+		return true;
+	}
+#endif // PROFIT_HAS_AVX && PROFIT_HAS_SSE2
+#ifdef PROFIT_HAS_SSE2
+	if (instruction_set == SSE2 || instruction_set == AUTO) {
+		return true;
+	}
+#endif // PROFIT_HAS_SSE2
+	UNUSED(instruction_set);
+	return false;
+}
+
+/// Evaluates, using @p instruction_set, the kernel ``Kernel<SIMD, FT>``
+/// constructed with @p args on the @p n points given by @p x and @p y.
+/// @p instruction_set must be one for which has_simd_math returns ``true``.
+template <template <simd_instruction_set, typename> class Kernel, typename FT, typename ... Args>
+inline
+void simd_evaluate(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n, Args ... args)
+{
+#if defined(PROFIT_HAS_AVX) && defined(PROFIT_HAS_SSE2)
+	if (instruction_set == AVX || instruction_set == AUTO) {
+		simd_transform<AVX>(Kernel<AVX, FT>(args...), x, y, values, n);
+		return;
+	}
+#endif // PROFIT_HAS_AVX && PROFIT_HAS_SSE2
+#ifdef PROFIT_HAS_SSE2
+	simd_transform<SSE2>(Kernel<SSE2, FT>(args...), x, y, values, n);
+#else
+	UNUSED(instruction_set);
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(values);
+	UNUSED(n);
+#endif // PROFIT_HAS_SSE2
+}
+
+}  // namespace profit
+
+#endif /* PROFIT_SIMD_MATH_H_ */
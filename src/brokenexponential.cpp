@@ -87,10 +87,90 @@ double _broken_exponential(double r, double h1, double h2, double rb, double a)
  *
  *       r = (x^{2+B} + y^{2+B})^{1/(2+B)}
  *       B = box parameter
+ *
+ * The evaluation function is specialised for B = 0.
+ */
+template <bool boxy>
+static
+double eval_function(double x, double y, double box, double h1, double h2, double rb, double a)
+{
+	return _broken_exponential(fixed_boxy_r<boxy>(x, y, box), h1, h2, rb, a);
+}
+
+/*
+ * The vectorised brokenexponential evaluation function
  */
+template <bool boxy>
+struct brokenexponential_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double h1, double h2, double rb, double a) :
+			box(box), h1(h1), rb(rb), a(a), expo(1 / h1 - 1 / h2) {}
+
+		// See _broken_exponential for details
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			auto r = simd_boxy_r<SIMD, FT, boxy>(x, y, box);
+			auto base = S::sub(r, S::set1(rb));
+			auto a_base = S::mul(S::set1(a), base);
+			auto log_base = S::div(simd_log<SIMD, FT>(S::add(S::set1(1.), simd_exp<SIMD, FT>(a_base))), S::set1(a));
+			base = S::select(S::lt(a_base, S::set1(40.)), log_base, base);
+			auto exponent = S::add(S::div(r, S::set1(-h1)), S::mul(S::set1(expo), base));
+			return simd_exp<SIMD, FT>(exponent);
+		}
+
+		double box, h1, rb, a;
+		double expo;
+	};
+
+};
+
+template <bool boxy, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double h1, double h2, double rb, double a)
+{
+	simd_evaluate<brokenexponential_kernel<boxy>::template simd>(instruction_set, x, y, values, n, box, h1, h2, rb, a);
+}
+
 double BrokenExponentialProfile::evaluate_at(double x, double y) const
 {
-	return _broken_exponential(boxy_r(x, y), h1, h2, rb, a);
+	return m_eval_function(x, y, box, h1, h2, rb, a);
+}
+
+void BrokenExponentialProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, h1, h2, rb, a);
+}
+
+void BrokenExponentialProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, h1, h2, rb, a);
+}
+
+template <bool boxy>
+void BrokenExponentialProfile::init_eval_function() {
+	m_eval_function = eval_function<boxy>;
+	m_eval_many_function = eval_many_function<boxy, double>;
+	m_eval_many_float_function = eval_many_function<boxy, float>;
+}
+
+void BrokenExponentialProfile::initial_calculations() {
+
+	RadialProfile::initial_calculations();
+
+	/* The evaluation functions are specialised for the shape of the profile */
+	if( shape_parameters_changed() ) {
+		if( box != 0 ) init_eval_function<true>();
+		else           init_eval_function<false>();
+	}
 }
 
 void BrokenExponentialProfile::validate() {
@@ -24,8 +24,12 @@
  * along with libprofit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <numeric>
 #include <sstream>
 #include <vector>
 
@@ -34,6 +38,7 @@
 #include "profit/exceptions.h"
 #include "profit/library.h"
 #include "profit/omp_utils.h"
+#include "profit/simd_math.h"
 #include "profit/utils.h"
 
 
@@ -78,6 +83,55 @@ Image Convolver::convolve(const Image &src, const Image &krn, const Mask &mask,
 	}
 }
 
+std::vector<Image> Convolver::convolve(const std::vector<Image> &srcs, const Image &krn,
+                                      const Mask &mask, bool crop, Point &offset_out)
+{
+	if (srcs.empty()) {
+		return {};
+	}
+	auto src_dims = srcs.front().getDimensions();
+	for (auto &src: srcs) {
+		if (src.getDimensions() != src_dims) {
+			std::ostringstream os;
+			os << "All images in a batch must have the same dimensions: ";
+			os << src.getDimensions() << " != " << src_dims;
+			throw invalid_parameter(os.str());
+		}
+	}
+
+	// Same as in the single-image case
+	auto krn_dims = krn.getDimensions();
+	if (!(src_dims >= krn_dims)) {
+		auto new_dims = max(src_dims, krn_dims);
+		auto dims_diff = new_dims - src_dims;
+		std::vector<Image> extended_srcs;
+		for (auto &src: srcs) {
+			extended_srcs.push_back(src.extend(new_dims));
+		}
+		auto extended_mask = Mask{};
+		if (mask) {
+			extended_mask = mask.extend(new_dims);
+		}
+		auto results = convolve_batch_impl(extended_srcs, krn, extended_mask, crop, offset_out);
+		for (auto &result: results) {
+			result = result.crop(result.getDimensions() - dims_diff);
+		}
+		return results;
+	}
+	return convolve_batch_impl(srcs, krn, mask, crop, offset_out);
+}
+
+std::vector<Image> Convolver::convolve_batch_impl(const std::vector<Image> &srcs,
+                                                  const Image &krn, const Mask &mask,
+                                                  bool crop, Point &offset_out)
+{
+	std::vector<Image> results;
+	for (auto &src: srcs) {
+		results.push_back(convolve_impl(src, krn, mask, crop, offset_out));
+	}
+	return results;
+}
+
 Image Convolver::mask_and_crop(Image &img, const Mask &mask, bool crop, const Dimensions &orig_dims, const Dimensions &ext_dims, const Point &ext_offset, Point &offset_out) {
 
 	// No cropping requested
@@ -98,6 +152,27 @@ Image Convolver::mask_and_crop(Image &img, const Mask &mask, bool crop, const Di
 	return img.crop(orig_dims, ext_offset) & mask;
 }
 
+/*
+ * Calls f(i, j) for each pixel of a surface of dimensions dims that is not
+ * masked out, visiting only the runs of set pixels of the mask, if any
+ */
+template <typename Callable>
+static void for_each_unmasked(int threads, const Dimensions &dims, const Mask &mask, Callable &&f)
+{
+	if (!mask) {
+		omp_2d_for(threads, dims.x, dims.y, f);
+		return;
+	}
+	const auto &mask_spans = mask.spans();
+	omp_1d_for(threads, dims.y, [&](unsigned int j) {
+		for (auto &span: mask_spans.row(j)) {
+			for (unsigned int i = span.first; i < span.second; i++) {
+				f(i, j);
+			}
+		}
+	});
+}
+
 Image BruteForceConvolver::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool  /*crop*/, Point & /*offset_out*/)
 {
 	const auto src_dims = src.getDimensions();
@@ -115,17 +190,11 @@ Image BruteForceConvolver::convolve_impl(const Image &src, const Image &krn, con
 	auto krn_end = krn.cend();
 
 	/* Convolve! */
-	/* Loop around the output image first... */
-	omp_2d_for(omp_threads, src_width, src_height, [&](unsigned int i, unsigned int j) {
+	/* Loop around the unmasked pixels of the output image first... */
+	for_each_unmasked(omp_threads, src_dims, mask, [&](unsigned int i, unsigned int j) {
 
 		auto im_idx = i + j * src_width;
 
-		/* Don't convolve this pixel */
-		if( mask && !mask[im_idx]) {
-			convolution[im_idx] = 0;
-			return;
-		}
-
 		double pixel = 0;
 		auto krnPtr = krn_end - 1;
 		auto srcPtr2 = src.begin() + im_idx - krn_half_width - krn_half_height*src_width;
@@ -155,9 +224,65 @@ Image BruteForceConvolver::convolve_impl(const Image &src, const Image &krn, con
 	return convolution;
 }
 
+/*
+ * The vector operations used by AssociativeBruteForceConvolver for the given
+ * instruction set. Without SIMD support "vectors" hold a single double
+ */
+template <simd_instruction_set SIMD>
+struct brute_force_vector {
+	typedef double vector_type;
+	static constexpr std::size_t width = 1;
+	static vector_type load(const double *p) { return *p; }
+	static void store(double *p, vector_type v) { *p = v; }
+	static vector_type set1(double x) { return x; }
+	static vector_type add(vector_type a, vector_type b) { return a + b; }
+	static vector_type mul(vector_type a, vector_type b) { return a * b; }
+};
+
+#ifdef PROFIT_HAS_SSE2
+template <>
+struct brute_force_vector<SSE2> : simd_traits<SSE2, double> {};
+#endif // PROFIT_HAS_SSE2
+
+#if defined(PROFIT_HAS_AVX) && defined(PROFIT_HAS_SSE2)
+template <>
+struct brute_force_vector<AVX> : simd_traits<AVX, double> {};
+template <>
+struct brute_force_vector<AUTO> : simd_traits<AVX, double> {};
+#elif defined(PROFIT_HAS_SSE2)
+template <>
+struct brute_force_vector<AUTO> : simd_traits<SSE2, double> {};
+#endif // PROFIT_HAS_AVX && PROFIT_HAS_SSE2
+
+/*
+ * The buffers AssociativeBruteForceConvolver uses to convolve a row: the
+ * indices of its blocks that need to be convolved, and their accumulated
+ * values. They are reused by all rows each thread convolves
+ */
+struct brute_force_row_scratch {
+	std::vector<unsigned int> blocks;
+	std::vector<double> out_row;
+};
+
+static brute_force_row_scratch &thread_brute_force_row_scratch()
+{
+	static thread_local brute_force_row_scratch scratch;
+	return scratch;
+}
+
+// Number of doubles of kernel and source rows the convolution of a block of
+// output pixels should keep in the L1 cache
+constexpr unsigned int brute_force_cache_doubles = 2048;
+
 template <simd_instruction_set SIMD>
 Image AssociativeBruteForceConvolver<SIMD>::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool  /*crop*/, Point & /*offset_out*/)
 {
+	typedef brute_force_vector<SIMD> V;
+	typedef typename V::vector_type vector_type;
+
+	// Output pixels are convolved in blocks of four vectors
+	constexpr unsigned int vector_width = V::width;
+	constexpr unsigned int block_width = 4 * vector_width;
 
 	const auto src_dims = src.getDimensions();
 	const auto krn_dims = krn.getDimensions();
@@ -169,146 +294,680 @@ Image AssociativeBruteForceConvolver<SIMD>::convolve_impl(const Image &src, cons
 	const unsigned int krn_half_width = krn_width / 2;
 	const unsigned int krn_half_height = krn_height / 2;
 
+	// The source image, extended with zeros on both sides so every block
+	// can read the full width of the kernel without checking for the edges
+	const unsigned int n_blocks = (src_width + block_width - 1) / block_width;
+	const unsigned int out_width = n_blocks * block_width;
+	const unsigned int ext_width = out_width + krn_width - 1;
+	std::vector<double> ext_src(std::size_t(ext_width) * src_height, 0.);
+	for (unsigned int j = 0; j != src_height; j++) {
+		auto src_row = src.begin() + std::size_t(j) * src_width;
+		std::copy(src_row, src_row + src_width, ext_src.begin() + std::size_t(j) * ext_width + krn_half_width);
+	}
+
 	Image ikrn = krn.reverse();
 	Image convolution(src_dims);
 
-	const size_t src_krn_offset = krn_half_width + krn_half_height*src_width;
+	// Kernel rows are visited in chunks small enough for them and the source
+	// rows they are applied to to stay in cache across all blocks of a row
+	const unsigned int krn_rows_chunk = std::max(1U, brute_force_cache_doubles / (2 * krn_width + block_width));
 
 	/* Convolve!
-	 * We use OpenMP to calculate the convolution of each pixel independently
+	 * We use OpenMP to calculate the convolution of each row independently.
+	 * Each block of output pixels is accumulated in registers, and every
+	 * kernel coefficient is applied to all of them at once. Blocks without
+	 * unmasked pixels are skipped, and stay zero
 	 */
-	omp_2d_for(omp_threads, src_width, src_height, [&](unsigned int i, unsigned int j) {
+	const MaskSpans *mask_spans = mask ? &mask.spans() : nullptr;
+	omp_1d_for(omp_threads, src_height, [&](unsigned int j) {
 
-		auto im_idx = i + j * src_width;
+		auto &scratch = thread_brute_force_row_scratch();
 
-		/* Don't convolve this pixel */
-		if (mask && !mask[im_idx]) {
-			convolution[im_idx] = 0;
+		// The blocks of this row that need to be convolved
+		auto &blocks = scratch.blocks;
+		if (!mask_spans) {
+			blocks.resize(n_blocks);
+			std::iota(blocks.begin(), blocks.end(), 0U);
+		}
+		else {
+			blocks.clear();
+			for (auto &span: mask_spans->row(j)) {
+				auto first = span.first / block_width;
+				if (!blocks.empty() && blocks.back() >= first) {
+					first = blocks.back() + 1;
+				}
+				for (auto b = first; b < (span.second + block_width - 1) / block_width; b++) {
+					blocks.push_back(b);
+				}
+			}
+		}
+		if (blocks.empty()) {
 			return;
 		}
 
-		size_t src_offset = im_idx - src_krn_offset;
-		size_t krn_offset = 0;
-
-		// Depending on where the output pixel is we might need to use
-		// smaller portions of the source image and kernel to convolve
+		// Depending on the row we might need to use only some of the kernel rows
 		unsigned int l_min = 0;
 		unsigned int l_max = krn_height;
-		unsigned int k_min = 0;
-		unsigned int k_max = krn_width;
-
 		if (j < krn_half_height) {
 			l_min = krn_half_height - j;
 		}
-		else if ((j + krn_half_height) >= src_height) {
+		if ((j + krn_half_height) >= src_height) {
 			l_max = src_height + krn_half_height - j;
 		}
-		if (i < krn_half_width) {
-			k_min = krn_half_width - i;
-		}
-		else if ((i + krn_half_width) >= src_width)
-		{
-			k_max = src_width + krn_half_width - i;
+
+		auto &out_row = scratch.out_row;
+		out_row.assign(out_width, 0.);
+		for (unsigned int l_begin = l_min; l_begin < l_max; l_begin += krn_rows_chunk) {
+			auto l_end = std::min(l_max, l_begin + krn_rows_chunk);
+			for (auto b: blocks) {
+				double *out = out_row.data() + b * block_width;
+				vector_type acc_1 = V::load(out);
+				vector_type acc_2 = V::load(out + vector_width);
+				vector_type acc_3 = V::load(out + 2 * vector_width);
+				vector_type acc_4 = V::load(out + 3 * vector_width);
+				for (unsigned int l = l_begin; l != l_end; l++) {
+					const double *src_row = ext_src.data() + std::size_t(j + l - krn_half_height) * ext_width + b * block_width;
+					const double *krn_row = ikrn.data() + std::size_t(l) * krn_width;
+					for (unsigned int k = 0; k != krn_width; k++) {
+						auto coefficient = V::set1(krn_row[k]);
+						acc_1 = V::add(acc_1, V::mul(coefficient, V::load(src_row + k)));
+						acc_2 = V::add(acc_2, V::mul(coefficient, V::load(src_row + k + vector_width)));
+						acc_3 = V::add(acc_3, V::mul(coefficient, V::load(src_row + k + 2 * vector_width)));
+						acc_4 = V::add(acc_4, V::mul(coefficient, V::load(src_row + k + 3 * vector_width)));
+					}
+				}
+				V::store(out, acc_1);
+				V::store(out + vector_width, acc_2);
+				V::store(out + 2 * vector_width, acc_3);
+				V::store(out + 3 * vector_width, acc_4);
+			}
 		}
+		std::copy(out_row.begin(), out_row.begin() + src_width, convolution.begin() + std::size_t(j) * src_width);
+	});
 
-		src_offset += k_min + l_min * src_width;
-		krn_offset += k_min + l_min * krn_width;
+	// Blocks might include masked out pixels
+	convolution &= mask;
+	return convolution;
 
-		// Loop throught each of the rows of the src/krn surfaces
-		// and compute the dot product of each of them, then sum up
-		double pixel = 0;
-		for (size_t l = 0; l < l_max - l_min; l++) {
-			pixel += dot_product<SIMD>(src.data() + src_offset, ikrn.data() + krn_offset, k_max - k_min);
-			src_offset += src_width;
-			krn_offset += krn_width;
+}
+
+LowRankKernel low_rank_kernel(const Image &krn, double tolerance)
+{
+	if (tolerance < 0) {
+		throw invalid_parameter("low-rank kernel tolerance must be non-negative");
+	}
+
+	// One-sided Jacobi SVD of the kernel: pairs of its columns are rotated
+	// until all of them are orthogonal, accumulating the rotations in v.
+	// Columns then become the kernel's left singular vectors scaled by their
+	// singular values, and the columns of v its right singular vectors
+	auto width = krn.getWidth();
+	auto height = krn.getHeight();
+	std::vector<std::vector<double>> columns(width, std::vector<double>(height));
+	std::vector<std::vector<double>> v(width, std::vector<double>(width, 0.));
+	for (unsigned int i = 0; i != width; i++) {
+		for (unsigned int j = 0; j != height; j++) {
+			columns[i][j] = krn[i + j * width];
 		}
+		v[i][i] = 1;
+	}
 
-		convolution[im_idx] = pixel;
+	auto dot = [](const std::vector<double> &x, const std::vector<double> &y) {
+		return std::inner_product(x.begin(), x.end(), y.begin(), 0.);
+	};
+	auto rotate = [](std::vector<double> &x, std::vector<double> &y, double c, double s) {
+		for (std::size_t k = 0; k != x.size(); k++) {
+			auto x_k = x[k];
+			x[k] = c * x_k - s * y[k];
+			y[k] = s * x_k + c * y[k];
+		}
+	};
+	const unsigned int max_sweeps = 64;
+	const double epsilon = std::numeric_limits<double>::epsilon();
+	for (unsigned int sweep = 0; sweep != max_sweeps; sweep++) {
+		bool rotated = false;
+		for (unsigned int p = 0; p + 1 < width; p++) {
+			for (unsigned int q = p + 1; q != width; q++) {
+				auto alpha = dot(columns[p], columns[p]);
+				auto beta = dot(columns[q], columns[q]);
+				auto gamma = dot(columns[p], columns[q]);
+				if (std::abs(gamma) <= epsilon * std::sqrt(alpha * beta)) {
+					continue;
+				}
+				rotated = true;
+				auto zeta = (beta - alpha) / (2 * gamma);
+				auto t = std::copysign(1., zeta) / (std::abs(zeta) + std::sqrt(1 + zeta * zeta));
+				auto c = 1 / std::sqrt(1 + t * t);
+				auto s = c * t;
+				rotate(columns[p], columns[q], c, s);
+				rotate(v[p], v[q], c, s);
+			}
+		}
+		if (!rotated) {
+			break;
+		}
+	}
+
+	// Keep the terms with the largest singular values until the rest
+	// (whose squares add up to the squared residual) are small enough
+	std::vector<double> squared_singular_values(width);
+	std::transform(columns.begin(), columns.end(), squared_singular_values.begin(),
+	               [&](const std::vector<double> &column) { return dot(column, column); });
+	std::vector<unsigned int> order(width);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		return squared_singular_values[a] > squared_singular_values[b];
 	});
+	auto squared_norm = std::accumulate(squared_singular_values.begin(), squared_singular_values.end(), 0.);
+	auto squared_tail = squared_norm;
+
+	// Singular values this small are rounding errors of zero ones, and
+	// kernels have at most min(width, height) non-zero singular values
+	auto rounding = epsilon * std::max(width, height);
+	auto negligible = squared_norm * rounding * rounding;
+
+	LowRankKernel low_rank;
+	low_rank.residual = 0;
+	for (auto i: order) {
+		auto residual = squared_norm > 0 ? std::sqrt(std::max(squared_tail, 0.) / squared_norm) : 0.;
+		if (residual <= tolerance || squared_singular_values[i] <= negligible) {
+			low_rank.residual = residual;
+			break;
+		}
+		low_rank.columns.push_back(std::move(columns[i]));
+		low_rank.rows.push_back(std::move(v[i]));
+		squared_tail -= squared_singular_values[i];
+	}
+	return low_rank;
+}
 
-	return convolution;
+template <simd_instruction_set SIMD>
+LowRankConvolver<SIMD>::LowRankConvolver(unsigned int omp_threads, double tolerance) :
+	omp_threads(omp_threads), tolerance(tolerance),
+	krn(), reversed_columns(), reversed_rows()
+{
+	if (tolerance < 0) {
+		throw invalid_parameter("low-rank kernel tolerance must be non-negative");
+	}
+}
+
+template <simd_instruction_set SIMD>
+Image LowRankConvolver<SIMD>::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool  /*crop*/, Point & /*offset_out*/)
+{
+	// Like in the brute-force convolvers, the kernel is flipped, and its
+	// centre aligned with the pixel being convolved
+	if (!(krn == this->krn)) {
+		auto low_rank = low_rank_kernel(krn, tolerance);
+		reversed_columns = std::move(low_rank.columns);
+		reversed_rows = std::move(low_rank.rows);
+		for (auto &column: reversed_columns) {
+			std::reverse(column.begin(), column.end());
+		}
+		for (auto &row: reversed_rows) {
+			std::reverse(row.begin(), row.end());
+		}
+		this->krn = krn;
+	}
+
+	const auto src_width = src.getWidth();
+	const auto src_height = src.getHeight();
+	const auto krn_width = krn.getWidth();
+	const auto krn_height = krn.getHeight();
+	const unsigned int krn_half_width = krn_width / 2;
+	const unsigned int krn_half_height = krn_height / 2;
+
+	Image convolution(src.getDimensions());
+	Image horizontal(src.getDimensions());
+	for (std::size_t t = 0; t != reversed_rows.size(); t++) {
+		const auto &krn_row = reversed_rows[t];
+		const auto &krn_column = reversed_columns[t];
+
+		// Horizontal pass, on all rows the vertical pass might read
+		omp_1d_for(omp_threads, src_height, [&](unsigned int j) {
+			auto src_row = src.data() + j * src_width;
+			auto out_row = horizontal.begin() + j * src_width;
+			for (unsigned int i = 0; i != src_width; i++) {
+				unsigned int k_min = i < krn_half_width ? krn_half_width - i : 0;
+				unsigned int k_max = std::min(krn_width, src_width + krn_half_width - i);
+				out_row[i] = dot_product<SIMD>(src_row + i + k_min - krn_half_width, krn_row.data() + k_min, k_max - k_min);
+			}
+		});
+
+		// Vertical pass, accumulating whole rows at a time, skipping those
+		// that are fully masked out
+		omp_1d_for(omp_threads, src_height, [&](unsigned int j) {
+			if (mask && mask.spans().row(j).empty()) {
+				return;
+			}
+			auto out_row = convolution.data() + j * src_width;
+			unsigned int l_min = j < krn_half_height ? krn_half_height - j : 0;
+			unsigned int l_max = std::min(krn_height, src_height + krn_half_height - j);
+			auto in_row = [&](unsigned int l) {
+				return horizontal.data() + (j + l - krn_half_height) * src_width;
+			};
+
+			// Rows are added four at a time to save loads and stores of out_row
+			unsigned int l = l_min;
+			for (; l + 4 <= l_max; l += 4) {
+				const double w0 = krn_column[l], w1 = krn_column[l + 1];
+				const double w2 = krn_column[l + 2], w3 = krn_column[l + 3];
+				const double *in0 = in_row(l), *in1 = in_row(l + 1);
+				const double *in2 = in_row(l + 2), *in3 = in_row(l + 3);
+				for (unsigned int i = 0; i != src_width; i++) {
+					out_row[i] += w0 * in0[i] + w1 * in1[i] + w2 * in2[i] + w3 * in3[i];
+				}
+			}
+			for (; l != l_max; l++) {
+				const double w = krn_column[l];
+				const double *in = in_row(l);
+				for (unsigned int i = 0; i != src_width; i++) {
+					out_row[i] += w * in[i];
+				}
+			}
+		});
+	}
 
+	convolution &= mask;
+	return convolution;
 }
 
 #ifdef PROFIT_FFTW
-FFTConvolver::FFTConvolver(const Dimensions &src_dims, const Dimensions &krn_dims,
+template <typename FT>
+FFTConvolver<FT>::FFTConvolver(const Dimensions &src_dims, const Dimensions &krn_dims,
                            effort_t effort, unsigned int plan_omp_threads,
                            bool reuse_krn_fft) :
 	fft_transformer(),
-	src_fft(), krn_fft(), ext_src(), ext_krn(),
+	ext_dims(), src_fft(), krn_fft(), ext_src(), ext_krn(),
+	batch_capacity(0), batch_data(),
 	reuse_krn_fft(reuse_krn_fft), krn_fft_initialized(false)
 {
-	fft_transformer = std::unique_ptr<FFTRealTransformer>(new FFTRealTransformer(effort, plan_omp_threads));
+	fft_transformer = std::unique_ptr<FFTRealTransformer<FT>>(new FFTRealTransformer<FT>(effort, plan_omp_threads));
 	resize(src_dims, krn_dims);
 }
 
-void FFTConvolver::resize(const Dimensions &src_dims, const Dimensions &krn_dims)
+/*
+ * Returns the smallest number not lower than n whose only prime factors are
+ * 2, 3, 5 and 7, for which FFTW is fastest
+ */
+static unsigned int fft_friendly_size(unsigned int n)
+{
+	for (;; n++) {
+		auto m = n;
+		for (unsigned int p: {2, 3, 5, 7}) {
+			while (m % p == 0) {
+				m /= p;
+			}
+		}
+		if (m == 1) {
+			return n;
+		}
+	}
+}
+
+/*
+ * The circular convolution of an image with a kernel equals their linear
+ * convolution as long as both are padded to at least src + krn - 1 pixels
+ * in each dimension
+ */
+static Dimensions fft_dimensions(const Dimensions &src_dims, const Dimensions &krn_dims)
+{
+	auto linear_dims = src_dims + krn_dims - 1;
+	return {fft_friendly_size(linear_dims.x), fft_friendly_size(linear_dims.y)};
+}
+
+/*
+ * Copies src into the origin of the ext_dims-sized FFT buffer ext, whose rows
+ * are row_stride numbers apart, zeroing the rest of the rows it occupies.
+ * Rows below src are zeroed only if zero_rows_below is set, as pruned FFTs
+ * don't read them
+ */
+template <typename FT>
+static void extend_into(const Image &src, FT *ext, const Dimensions &ext_dims, std::size_t row_stride, bool zero_rows_below)
 {
-	auto ext_dims = max(src_dims, krn_dims) * 2;
-	if (ext_dims.x == 0 || ext_dims.y == 0) {
+	auto width = src.getWidth();
+	auto height = src.getHeight();
+	for (unsigned int j = 0; j != height; j++) {
+		auto row = src.data() + j * width;
+		auto ext_row = ext + j * row_stride;
+		std::copy(row, row + width, ext_row);
+		std::fill(ext_row + width, ext_row + ext_dims.x, FT(0));
+	}
+	if (zero_rows_below) {
+		std::fill(ext + height * row_stride, ext + ext_dims.y * row_stride, FT(0));
+	}
+}
+
+template <typename FT>
+void FFTConvolver<FT>::resize(const Dimensions &src_dims, const Dimensions &krn_dims)
+{
+	if (src_dims.x == 0 || src_dims.y == 0) {
 		return;
 	}
-	if (ext_dims == ext_src.getDimensions()) {
-		ext_src.zero();
+	auto new_ext_dims = fft_dimensions(src_dims, krn_dims);
+	if (new_ext_dims == ext_dims) {
 		return;
 	}
-	fft_transformer->resize(ext_dims.x * ext_dims.y);
-	src_fft.resize(fft_transformer->get_hermitian_size());
-	krn_fft.resize(fft_transformer->get_hermitian_size());
-	ext_src = Image(ext_dims);
-	ext_krn = Image(ext_dims);
+	fft_transformer->resize(new_ext_dims);
+	auto size = fft_transformer->get_size();
+	auto hermitian_size = fft_transformer->get_hermitian_size();
+	src_fft = make_fftw_array<FT, std::complex<FT>>(hermitian_size);
+	krn_fft = make_fftw_array<FT, std::complex<FT>>(hermitian_size);
+	ext_src = make_fftw_array<FT, FT>(size);
+	ext_krn = make_fftw_array<FT, FT>(size);
+	ext_dims = new_ext_dims;
+	batch_capacity = 0;
 	krn_fft_initialized = false;
 }
 
-PointPair FFTConvolver::padding(const Dimensions &src_dims, const Dimensions &krn_dims) const
+template <typename FT>
+void FFTConvolver<FT>::resize_batch(unsigned int batch_size)
 {
-	auto ext_dims = max(src_dims, krn_dims) * 2;
+	if (batch_size <= batch_capacity) {
+		return;
+	}
+	auto hermitian_size = std::size_t(fft_transformer->get_hermitian_size());
+	batch_data = make_fftw_array<FT, std::complex<FT>>(hermitian_size * batch_size);
+	batch_capacity = batch_size;
+}
+
+template <typename FT>
+PointPair FFTConvolver<FT>::padding(const Dimensions &src_dims, const Dimensions &krn_dims) const
+{
+	auto ext_dims = fft_dimensions(src_dims, krn_dims);
 	auto offset = offset_after_convolution(src_dims, krn_dims);
-	return {offset, ext_dims - ext_dims / 2 - offset};
+	return {offset, ext_dims - src_dims - offset};
 }
 
-Point FFTConvolver::offset_after_convolution(const Dimensions &src_dims, const Dimensions &krn_dims) const
+template <typename FT>
+Point FFTConvolver<FT>::offset_after_convolution(const Dimensions & /*src_dims*/, const Dimensions &krn_dims) const
 {
-	// even image and odd kernel requires slight adjustment
-	auto offset = Point{src_dims / 2};
-	if (src_dims.x % 2 == 0 || krn_dims.x % 2 == 0) {
-		offset.x -= 1;
+	// The kernel sits at the origin of the extended kernel image, so the
+	// convolution of the first pixel is found where the kernel's centre is
+	return krn_dims - 1 - krn_dims / 2;
+}
+
+template <typename FT>
+Image FFTConvolver<FT>::result_from(const FT *ext, std::size_t row_stride, const Dimensions &src_dims,
+                                    const Dimensions &krn_dims, const Mask &mask, bool crop, Point &offset_out)
+{
+	// The inverse FFT is unnormalized, so it's scaled down while copied out
+	double size = fft_transformer->get_size();
+	auto scale_down = [size](FT x) { return x / size; };
+
+	// The resulting image starts at ext_offset
+	auto ext_offset = offset_after_convolution(src_dims, krn_dims);
+	if (!crop) {
+		Image result(ext_dims);
+		for (unsigned int j = 0; j != ext_dims.y; j++) {
+			auto ext_row = ext + j * row_stride;
+			std::transform(ext_row, ext_row + ext_dims.x, result.begin() + j * ext_dims.x, scale_down);
+		}
+		return mask_and_crop(result, mask, crop, src_dims, ext_dims, ext_offset, offset_out);
 	}
-	if (src_dims.y % 2 == 0 || krn_dims.y % 2 == 0) {
-		offset.y -= 1;
+
+	Image result(src_dims);
+	for (unsigned int j = 0; j != src_dims.y; j++) {
+		auto ext_row = ext + ext_offset.x + (j + ext_offset.y) * row_stride;
+		std::transform(ext_row, ext_row + src_dims.x, result.begin() + j * src_dims.x, scale_down);
 	}
-	return offset;
+	result &= mask;
+	return result;
 }
 
-Image FFTConvolver::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool crop, Point &offset_out)
+template <typename FT>
+Image FFTConvolver<FT>::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool crop, Point &offset_out)
 {
 	auto src_dims = src.getDimensions();
 	auto krn_dims = krn.getDimensions();
 
 	// Create extended images first
 	resize(src_dims, krn_dims);
-	src.extend(ext_src);
+	extend_into(src, ext_src.get(), ext_dims, ext_dims.x, false);
+
+	// Forward FFTs, which skip the zero rows below the image
+	fft_transformer->forward_pruned(ext_src.get(), src_fft.get(), src_dims.y);
+	transform_krn(krn);
+
+	// element-wise multiplication
+	auto hermitian_size = fft_transformer->get_hermitian_size();
+	std::transform(src_fft.get(), src_fft.get() + hermitian_size, krn_fft.get(), src_fft.get(),
+	               std::multiplies<std::complex<FT>>());
+
+	// inverse FFT, skipping the rows that are cropped away
+	if (crop) {
+		auto ext_offset = offset_after_convolution(src_dims, krn_dims);
+		fft_transformer->backward_pruned(src_fft.get(), ext_src.get(), ext_offset.y, src_dims.y);
+	}
+	else {
+		fft_transformer->backward(src_fft.get(), ext_src.get());
+	}
+	return result_from(ext_src.get(), ext_dims.x, src_dims, krn_dims, mask, crop, offset_out);
+}
 
-	// Forward FFTs
-	fft_transformer->forward(ext_src, src_fft);
+template <typename FT>
+void FFTConvolver<FT>::transform_krn(const Image &krn)
+{
 	if (!reuse_krn_fft || !krn_fft_initialized) {
-		auto krn_start = (src_dims - krn_dims) / 2;
-		krn.extend(ext_krn, krn_start);
-		fft_transformer->forward(ext_krn, krn_fft);
+		extend_into(krn, ext_krn.get(), ext_dims, ext_dims.x, false);
+		fft_transformer->forward_pruned(ext_krn.get(), krn_fft.get(), krn.getHeight());
 		krn_fft_initialized = true;
 	}
+}
 
-	// element-wise multiplication
-	std::transform(src_fft.begin(), src_fft.end(), krn_fft.begin(), src_fft.begin(),
-	               std::multiplies<std::complex<double>>());
+template <typename FT>
+std::vector<Image> FFTConvolver<FT>::convolve_batch_impl(const std::vector<Image> &srcs,
+                                                     const Image &krn, const Mask &mask,
+                                                     bool crop, Point &offset_out)
+{
+	auto src_dims = srcs.front().getDimensions();
+	auto krn_dims = krn.getDimensions();
+
+	// The kernel is transformed once for the whole batch
+	resize(src_dims, krn_dims);
+	transform_krn(krn);
+
+	// Each image is transformed in place within its own part of batch_data,
+	// so its real rows are padded to the length of the hermitian ones
+	unsigned int howmany = srcs.size();
+	resize_batch(howmany);
+	auto hermitian_size = std::size_t(fft_transformer->get_hermitian_size());
+	auto row_stride = 2 * std::size_t(ext_dims.x / 2 + 1);
+	auto batch_image = [&](std::size_t i) {
+		return batch_data.get() + i * hermitian_size;
+	};
+	for (std::size_t i = 0; i != howmany; i++) {
+		extend_into(srcs[i], reinterpret_cast<FT *>(batch_image(i)), ext_dims, row_stride, true);
+	}
 
-	// inverse FFT and scale down
-	fft_transformer->backward(src_fft, ext_src);
-	ext_src /= ext_src.size();
+	// Forward FFTs of all images together, element-wise multiplication,
+	// then all inverse FFTs together
+	fft_transformer->forward(batch_data.get(), howmany);
+	for (std::size_t i = 0; i != howmany; i++) {
+		std::transform(batch_image(i), batch_image(i) + hermitian_size, krn_fft.get(), batch_image(i),
+		               std::multiplies<std::complex<FT>>());
+	}
+	fft_transformer->backward(batch_data.get(), howmany);
 
-	// The resulting image now starts at ext_offset
-	auto ext_offset = offset_after_convolution(src_dims, krn_dims);
-	return mask_and_crop(ext_src, mask, crop, src_dims, ext_src.getDimensions(), ext_offset, offset_out);
+	std::vector<Image> results;
+	for (std::size_t i = 0; i != howmany; i++) {
+		auto ext = reinterpret_cast<const FT *>(batch_image(i));
+		results.push_back(result_from(ext, row_stride, src_dims, krn_dims, mask, crop, offset_out));
+	}
+	return results;
+}
+
+template class FFTConvolver<double>;
+#ifdef PROFIT_FFTW_FLOAT
+template class FFTConvolver<float>;
+#endif /* PROFIT_FFTW_FLOAT */
+
+TiledFFTConvolver::TiledFFTConvolver(const Dimensions &src_dims, const Dimensions &krn_dims,
+                                     effort_t effort, unsigned int omp_threads,
+                                     bool reuse_krn_fft) :
+	omp_threads(omp_threads),
+	// tiles are convolved in parallel, each with a single-threaded FFT
+	fft_transformer(effort, 1),
+	krn_dims(), fft_dims(), tile_dims(),
+	krn_fft(), ext_krn(),
+	reuse_krn_fft(reuse_krn_fft), krn_fft_initialized(false)
+{
+	resize(src_dims, krn_dims);
+}
+
+/*
+ * The FFTs of a tile and its spectrum fit in the L2 cache with up to about
+ * 256x256 pixels. Tiles need to be larger for larger kernels though, or
+ * the overlap between tiles would dominate. On the other hand, there is no
+ * point in using tiles larger than the image itself
+ */
+static Dimensions tile_fft_dimensions(const Dimensions &src_dims, const Dimensions &krn_dims)
+{
+	const unsigned int cache_fft_size = 256;
+	auto image_fft_dims = fft_dimensions(src_dims, krn_dims);
+	auto tile_fft_size = [&](unsigned int image_fft_size, unsigned int krn_size) {
+		return std::min(image_fft_size, fft_friendly_size(std::max(cache_fft_size, 4 * (krn_size - 1) + 1)));
+	};
+	return {tile_fft_size(image_fft_dims.x, krn_dims.x), tile_fft_size(image_fft_dims.y, krn_dims.y)};
+}
+
+void TiledFFTConvolver::resize(const Dimensions &src_dims, const Dimensions &new_krn_dims)
+{
+	if (src_dims.x == 0 || src_dims.y == 0) {
+		return;
+	}
+	auto new_fft_dims = tile_fft_dimensions(src_dims, new_krn_dims);
+	if (new_fft_dims == fft_dims && new_krn_dims == krn_dims) {
+		return;
+	}
+	fft_transformer.resize(new_fft_dims);
+	krn_fft = make_fftw_array<double, std::complex<double>>(fft_transformer.get_hermitian_size());
+	ext_krn = make_fftw_array<double, double>(fft_transformer.get_size());
+	krn_dims = new_krn_dims;
+	fft_dims = new_fft_dims;
+	tile_dims = fft_dims - krn_dims + 1;
+	krn_fft_initialized = false;
+}
+
+void TiledFFTConvolver::transform_krn(const Image &krn)
+{
+	if (!reuse_krn_fft || !krn_fft_initialized) {
+		extend_into(krn, ext_krn.get(), fft_dims, fft_dims.x, false);
+		fft_transformer.forward_pruned(ext_krn.get(), krn_fft.get(), krn.getHeight());
+		krn_fft_initialized = true;
+	}
+}
+
+/*
+ * The buffers each thread uses to convolve tiles
+ */
+struct tile_scratch {
+	std::size_t size = 0;
+	std::size_t hermitian_size = 0;
+	fftw_array<double, double> ext_tile;
+	fftw_array<double, std::complex<double>> tile_fft;
+};
+
+static tile_scratch &thread_tile_scratch(std::size_t size, std::size_t hermitian_size)
+{
+	static thread_local tile_scratch scratch;
+	if (scratch.size < size || scratch.hermitian_size < hermitian_size) {
+		scratch.ext_tile = make_fftw_array<double, double>(size);
+		scratch.tile_fft = make_fftw_array<double, std::complex<double>>(hermitian_size);
+		scratch.size = size;
+		scratch.hermitian_size = hermitian_size;
+	}
+	return scratch;
+}
+
+/*
+ * Whether mask has no pixels set within each of the tiles of tile_dims
+ * pixels that dims is split into, indexed in row-first order
+ */
+static std::vector<char> masked_out_tiles(const Mask &mask, const Dimensions &dims, const Dimensions &tile_dims)
+{
+	unsigned int tile_cols = (dims.x + tile_dims.x - 1) / tile_dims.x;
+	unsigned int tile_rows = (dims.y + tile_dims.y - 1) / tile_dims.y;
+	if (!mask) {
+		return std::vector<char>(tile_cols * tile_rows, false);
+	}
+
+	// Tiles are masked out unless a span of set pixels reaches into them
+	std::vector<char> masked_out(tile_cols * tile_rows, true);
+	const auto &spans = mask.spans();
+	for (unsigned int j = 0; j != dims.y; j++) {
+		auto row_tiles = masked_out.begin() + (j / tile_dims.y) * tile_cols;
+		for (const auto &span: spans.row(j)) {
+			std::fill(row_tiles + span.first / tile_dims.x, row_tiles + (span.second - 1) / tile_dims.x + 1, false);
+		}
+	}
+	return masked_out;
+}
+
+void TiledFFTConvolver::convolve_tile(const Image &src, const grid_tile &tile, Image &result) const
+{
+	auto size = fft_transformer.get_size();
+	auto hermitian_size = fft_transformer.get_hermitian_size();
+	auto &scratch = thread_tile_scratch(size, hermitian_size);
+	auto ext_tile = scratch.ext_tile.get();
+	auto tile_fft = scratch.tile_fft.get();
+
+	// The FFT covers the source pixels the kernel reaches from the tile,
+	// which start krn_dims / 2 pixels before it. Pixels outside the source
+	// image are zero
+	auto src_dims = src.getDimensions();
+	int first_i = int(tile.i0) - int(krn_dims.x / 2);
+	int first_j = int(tile.j0) - int(krn_dims.y / 2);
+	auto src_i0 = unsigned(std::max(first_i, 0));
+	auto src_i1 = unsigned(std::max(std::min(first_i + int(fft_dims.x), int(src_dims.x)), 0));
+	for (unsigned int l = 0; l != fft_dims.y; l++) {
+		auto ext_row = ext_tile + std::size_t(l) * fft_dims.x;
+		int src_j = first_j + int(l);
+		if (src_j < 0 || src_j >= int(src_dims.y) || src_i0 >= src_i1) {
+			std::fill(ext_row, ext_row + fft_dims.x, 0.);
+			continue;
+		}
+		auto src_row = src.data() + std::size_t(src_j) * src_dims.x;
+		auto ext_first = ext_row + (int(src_i0) - first_i);
+		std::fill(ext_row, ext_first, 0.);
+		std::copy(src_row + src_i0, src_row + src_i1, ext_first);
+		std::fill(ext_first + (src_i1 - src_i0), ext_row + fft_dims.x, 0.);
+	}
+
+	fft_transformer.forward(ext_tile, tile_fft);
+	std::transform(tile_fft, tile_fft + hermitian_size, krn_fft.get(), tile_fft,
+	               std::multiplies<std::complex<double>>());
+	fft_transformer.backward(tile_fft, ext_tile);
+
+	// The first krn_dims - 1 rows and columns of the circular convolution
+	// wrap around; the tile's convolution follows them
+	double scale = size;
+	for (unsigned int j = tile.j0; j != tile.j1; j++) {
+		auto ext_row = ext_tile + std::size_t(j - tile.j0 + krn_dims.y - 1) * fft_dims.x + (krn_dims.x - 1);
+		std::transform(ext_row, ext_row + (tile.i1 - tile.i0), result.begin() + j * src_dims.x + tile.i0,
+		               [scale](double x) { return x / scale; });
+	}
+}
+
+Image TiledFFTConvolver::convolve_impl(const Image &src, const Image &krn, const Mask &mask, bool /*crop*/, Point & /*offset_out*/)
+{
+	auto src_dims = src.getDimensions();
+	resize(src_dims, krn.getDimensions());
+	transform_krn(krn);
+
+	// Tiles with no pixels to convolve cost nothing
+	Image result(src_dims);
+	auto masked_out = masked_out_tiles(mask, src_dims, tile_dims);
+	auto tile_cost = [&](const grid_tile &tile) {
+		return masked_out[tile.index] ? 0. : 1.;
+	};
+	omp_tiled_2d_for(omp_threads, 0, src_dims.x, 0, src_dims.y, tile_dims.x, tile_dims.y, tile_cost,
+	    [&](const grid_tile &tile) {
+		if (!masked_out[tile.index]) {
+			convolve_tile(src, tile, result);
+		}
+	});
+	result &= mask;
+	return result;
 }
 
 #endif /* PROFIT_FFTW */
@@ -518,40 +1177,63 @@ Image OpenCLLocalConvolver::_clpadded_convolve(const Image &src, const Image &kr
 
 #endif // PROFIT_OPENCL
 
+/*
+ * Creates a SIMDConvolver for the given (supported) instruction set
+ */
+template <template <simd_instruction_set> class SIMDConvolver, typename ... Args>
+static ConvolverPtr create_simd_convolver(simd_instruction_set instruction_set, Args && ... args)
+{
+	if (!has_simd_instruction_set(instruction_set)) {
+		std::ostringstream os;
+		os << "Instruction set \"" << instruction_set << "\" is not supported";
+		throw invalid_parameter(os.str());
+	}
+#ifdef PROFIT_HAS_AVX
+	if (instruction_set == simd_instruction_set::AVX) {
+		return std::make_shared<SIMDConvolver<AVX>>(std::forward<Args>(args)...);
+	}
+#endif // PROFIT_HAS_AVX
+#ifdef PROFIT_HAS_SSE2
+	if (instruction_set == simd_instruction_set::SSE2) {
+		return std::make_shared<SIMDConvolver<SSE2>>(std::forward<Args>(args)...);
+	}
+#endif // PROFIT_HAS_SSE2
+	if (instruction_set == simd_instruction_set::NONE) {
+		return std::make_shared<SIMDConvolver<NONE>>(std::forward<Args>(args)...);
+	}
+	return std::make_shared<SIMDConvolver<AUTO>>(std::forward<Args>(args)...);
+}
+
 ConvolverPtr create_convolver(const ConvolverType type, const ConvolverCreationPreferences &prefs)
 {
 	switch(type) {
 		case BRUTE_OLD:
 			return std::make_shared<BruteForceConvolver>(prefs.omp_threads);
 		case BRUTE:
-			if (!has_simd_instruction_set(prefs.instruction_set)) {
-				std::ostringstream os;
-				os << "Instruction set \"" << prefs.instruction_set << "\" is not supported";
-				throw invalid_parameter(os.str());
-			}
-#ifdef PROFIT_HAS_AVX
-			if (prefs.instruction_set == simd_instruction_set::AVX) {
-				return std::make_shared<AssociativeBruteForceConvolver<AVX>>(prefs.omp_threads);
-			}
-#endif // PROFIT_HAS_AVX
-#ifdef PROFIT_HAS_SSE2
-			if (prefs.instruction_set == simd_instruction_set::SSE2) {
-				return std::make_shared<AssociativeBruteForceConvolver<SSE2>>(prefs.omp_threads);
-			}
-#endif // PROFIT_HAS_SSE2
-			if (prefs.instruction_set == simd_instruction_set::NONE) {
-				return std::make_shared<AssociativeBruteForceConvolver<NONE>>(prefs.omp_threads);
-			}
-			return std::make_shared<AssociativeBruteForceConvolver<AUTO>>(prefs.omp_threads);
+			return create_simd_convolver<AssociativeBruteForceConvolver>(prefs.instruction_set, prefs.omp_threads);
+		case LOW_RANK:
+			return create_simd_convolver<LowRankConvolver>(prefs.instruction_set, prefs.omp_threads, prefs.low_rank_tolerance);
 #ifdef PROFIT_OPENCL
 		case OPENCL:
 			return std::make_shared<OpenCLConvolver>(OpenCLEnvImpl::fromOpenCLEnvPtr(prefs.opencl_env));
 #endif // PROFIT_OPENCL
 #ifdef PROFIT_FFTW
 		case FFT:
-			return std::make_shared<FFTConvolver>(prefs.src_dims, prefs.krn_dims,
-			                                      prefs.effort, prefs.omp_threads,
-			                                      prefs.reuse_krn_fft);
+			return std::make_shared<FFTConvolver<double>>(prefs.src_dims, prefs.krn_dims,
+			                                              prefs.effort, prefs.omp_threads,
+			                                              prefs.reuse_krn_fft);
+#endif // PROFIT_FFTW
+#ifdef PROFIT_FFTW_FLOAT
+		case FFT_FLOAT:
+			return std::make_shared<FFTConvolver<float>>(prefs.src_dims, prefs.krn_dims,
+			                                             prefs.effort, prefs.omp_threads,
+			                                             prefs.reuse_krn_fft);
+#endif // PROFIT_FFTW_FLOAT
+#ifdef PROFIT_FFTW
+		case FFT_TILED:
+			return std::make_shared<TiledFFTConvolver>(prefs.src_dims, prefs.krn_dims,
+			                                           prefs.effort, prefs.omp_threads,
+			                                           prefs.reuse_krn_fft);
 #endif // PROFIT_FFTW
 		default:
 			// Shouldn't happen
@@ -567,6 +1249,9 @@ ConvolverPtr create_convolver(const std::string &type, const ConvolverCreationPr
 	else if (type == "brute") {
 		return create_convolver(BRUTE, prefs);
 	}
+	else if (type == "low-rank") {
+		return create_convolver(LOW_RANK, prefs);
+	}
 #ifdef PROFIT_OPENCL
 	else if (type == "opencl") {
 		return create_convolver(OPENCL, prefs);
@@ -577,6 +1262,16 @@ ConvolverPtr create_convolver(const std::string &type, const ConvolverCreationPr
 		return create_convolver(FFT, prefs);
 	}
 #endif // PROFIT_FFTW
+#ifdef PROFIT_FFTW_FLOAT
+	else if (type == "fft-float") {
+		return create_convolver(FFT_FLOAT, prefs);
+	}
+#endif // PROFIT_FFTW_FLOAT
+#ifdef PROFIT_FFTW
+	else if (type == "fft-tiled") {
+		return create_convolver(FFT_TILED, prefs);
+	}
+#endif // PROFIT_FFTW
 
 	std::ostringstream os;
 	os << "Convolver of type " << type << " is not supported";
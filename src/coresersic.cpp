@@ -47,15 +47,115 @@ namespace profit
  *
  *           r = (x^{2+B} + y^{2+B})^{1/(2+B)}
  *           B = box parameter
+ *
+ * rb^a and re^a only depend on the shape of the profile, r^a is calculated
+ * as r^2 to the power of a/2, which for B = 0 doesn't need a square root, and
+ * the evaluation function is specialised for common values of a/2 and
+ * 1/(nser*a) (see radial_exponent).
  */
-double CoreSersicProfile::evaluate_at(double x, double y) const
+template <bool boxy, radial_exponent t_a, radial_exponent t_n>
+static
+double eval_function(double x, double y, double box, double rb, double nser,
+    double a, double b, double bn, double rb_a, double re_a)
 {
 	using std::exp;
 	using std::pow;
 
-	double r = boxy_r(x, y);
-	return pow(1 + pow(r/rb,-a), b/a) *
-	       exp(-_bn * pow((pow(r, a) + pow(rb, a))/pow(re,a), 1/(nser*a)));
+	double r2 = fixed_boxy_r2<boxy>(x, y, box);
+	double core = pow(1 + fixed_pow<t_a>(r2 / (rb * rb), -a / 2), b / a);
+	double base = (fixed_pow<t_a>(r2, a / 2) + rb_a) / re_a;
+	return core * exp(-bn * fixed_pow<t_n>(base, 1 / (nser * a)));
+}
+
+/*
+ * The vectorised coresersic evaluation function
+ */
+template <bool boxy, radial_exponent t_a, radial_exponent t_n>
+struct coresersic_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double rb, double nser, double a, double b, double bn, double rb_a, double re_a) :
+			box(box), rb(rb), nser(nser), a(a), b(b), bn(bn), rb_a(rb_a), re_a(re_a) {}
+
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			auto r2 = simd_boxy_r2<SIMD, FT, boxy>(x, y, box);
+			auto core = S::add(S::set1(1.), simd_fixed_pow<SIMD, FT, t_a>(S::div(r2, S::set1(rb * rb)), -a / 2));
+			core = simd_pow<SIMD, FT>(core, b / a);
+			auto base = S::div(S::add(simd_fixed_pow<SIMD, FT, t_a>(r2, a / 2), S::set1(rb_a)), S::set1(re_a));
+			auto sersic = simd_exp<SIMD, FT>(S::mul(S::set1(-bn), simd_fixed_pow<SIMD, FT, t_n>(base, 1 / (nser * a))));
+			return S::mul(core, sersic);
+		}
+
+		double box, rb, nser, a, b, bn;
+		double rb_a, re_a;
+	};
+
+};
+
+template <bool boxy, radial_exponent t_a, radial_exponent t_n, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double rb, double nser, double a, double b, double bn, double rb_a, double re_a)
+{
+	simd_evaluate<coresersic_kernel<boxy, t_a, t_n>::template simd>(instruction_set, x, y, values, n,
+	    box, rb, nser, a, b, bn, rb_a, re_a);
+}
+
+double CoreSersicProfile::evaluate_at(double x, double y) const
+{
+	return m_eval_function(x, y, box, rb, nser, a, b, _bn, _rb_a, _re_a);
+}
+
+void CoreSersicProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, rb, nser, a, b, _bn, _rb_a, _re_a);
+}
+
+void CoreSersicProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, rb, nser, a, b, _bn, _rb_a, _re_a);
+}
+
+template <bool boxy, radial_exponent t_a, radial_exponent t_n>
+void CoreSersicProfile::init_eval_function() {
+	m_eval_function = eval_function<boxy, t_a, t_n>;
+	m_eval_many_function = eval_many_function<boxy, t_a, t_n, double>;
+	m_eval_many_float_function = eval_many_function<boxy, t_a, t_n, float>;
+}
+
+// 1/(nser*a) usually comes from an integer nser and a = 1, for which we avoid
+// instantiating too many functions
+template <bool boxy, radial_exponent t_a>
+void CoreSersicProfile::init_eval_function(radial_exponent t_n) {
+	switch (t_n) {
+		case radial_exponent::quarter: init_eval_function<boxy, t_a, radial_exponent::quarter>(); break;
+		case radial_exponent::half:    init_eval_function<boxy, t_a, radial_exponent::half>(); break;
+		case radial_exponent::one:     init_eval_function<boxy, t_a, radial_exponent::one>(); break;
+		default:                       init_eval_function<boxy, t_a, radial_exponent::general>(); break;
+	}
+}
+
+template <bool boxy>
+void CoreSersicProfile::init_eval_function(radial_exponent t_a, radial_exponent t_n) {
+	switch (t_a) {
+		case radial_exponent::quarter:      init_eval_function<boxy, radial_exponent::quarter>(t_n); break;
+		case radial_exponent::half:         init_eval_function<boxy, radial_exponent::half>(t_n); break;
+		case radial_exponent::one:          init_eval_function<boxy, radial_exponent::one>(t_n); break;
+		case radial_exponent::three_halves: init_eval_function<boxy, radial_exponent::three_halves>(t_n); break;
+		case radial_exponent::two:          init_eval_function<boxy, radial_exponent::two>(t_n); break;
+		case radial_exponent::five_halves:  init_eval_function<boxy, radial_exponent::five_halves>(t_n); break;
+		case radial_exponent::three:        init_eval_function<boxy, radial_exponent::three>(t_n); break;
+		case radial_exponent::four:         init_eval_function<boxy, radial_exponent::four>(t_n); break;
+		default:                            init_eval_function<boxy, radial_exponent::general>(t_n); break;
+	}
 }
 
 void CoreSersicProfile::validate() {
@@ -107,9 +207,20 @@ void CoreSersicProfile::initial_calculations() {
 
 	/*
 	 * bn needs to be calculated before calling the super method
-	 * because it's used to calculate the total luminosity
+	 * because it's used to calculate the total luminosity.
+	 * Like the rest of the shape-derived quantities, it is kept
+	 * from previous evaluations if the shape hasn't changed
 	 */
-	this->_bn = qgamma(0.5, 2*this->nser);
+	bool shape_changed = shape_parameters_changed();
+	if( shape_changed ) {
+		this->_bn = qgamma(0.5, 2*this->nser);
+		this->_rb_a = std::pow(rb, a);
+		this->_re_a = std::pow(re, a);
+		auto t_a = get_radial_exponent(a / 2);
+		auto t_n = get_radial_exponent(1 / (nser * a));
+		if( box != 0 ) init_eval_function<true>(t_a, t_n);
+		else           init_eval_function<false>(t_a, t_n);
+	}
 
 	/* Common calculations first */
 	RadialProfile::initial_calculations();
@@ -130,7 +241,8 @@ double CoreSersicProfile::get_rscale() {
 
 CoreSersicProfile::CoreSersicProfile(const Model &model, const std::string &name) :
 	RadialProfile(model, name),
-	re(1), rb(1), nser(4), a(1), b(1)
+	re(1), rb(1), nser(4), a(1), b(1),
+	_bn(0), _rb_a(1), _re_a(1)
 {
 	register_parameter("re", re);
 	register_parameter("rb", rb);
@@ -46,17 +46,119 @@ namespace profit
  * where r_factor = (r/rscale)^(2-b)
  *              r = (x^{2+B} + y^{2+B})^{1/(2+B)}
  *              B = box parameter
+ *
+ * We calculate r_factor as (r/rscale)^2 to the power of (2-b)/2, which for
+ * B = 0 doesn't need a square root, and specialise the evaluation function
+ * for common values of (2-b)/2 and a (see radial_exponent).
+ */
+template <bool boxy, radial_exponent t_rf, radial_exponent t_a>
+static
+double eval_function(double x, double y, double box, double rscale, double a, double b)
+{
+	double r2_factor = fixed_boxy_r2<boxy>(x, y, box) / (rscale * rscale);
+	if( r2_factor < 1 ) {
+		return fixed_pow<t_a>(1 - fixed_pow<t_rf>(r2_factor, (2 - b) / 2), a);
+	}
+	return 0;
+}
+
+/*
+ * The vectorised ferrer evaluation function
  */
+template <bool boxy, radial_exponent t_rf, radial_exponent t_a>
+struct ferrer_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double rscale, double a, double b) :
+			box(box), rscale(rscale), a(a), b(b) {}
+
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			const auto one = S::set1(1.);
+			auto r2_factor = S::div(simd_boxy_r2<SIMD, FT, boxy>(x, y, box), S::set1(rscale * rscale));
+			auto r_factor = simd_fixed_pow<SIMD, FT, t_rf>(r2_factor, (2 - b) / 2);
+			auto val = simd_fixed_pow<SIMD, FT, t_a>(S::sub(one, r_factor), a);
+			return S::select(S::lt(r2_factor, one), val, S::set1(0.));
+		}
+
+		double box, rscale, a, b;
+	};
+
+};
+
+template <bool boxy, radial_exponent t_rf, radial_exponent t_a, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double rscale, double a, double b)
+{
+	simd_evaluate<ferrer_kernel<boxy, t_rf, t_a>::template simd>(instruction_set, x, y, values, n, box, rscale, a, b);
+}
+
 double FerrerProfile::evaluate_at(double x, double y) const {
+	return m_eval_function(x, y, box, rscale, a, b);
+}
 
-	using std::pow;
+void FerrerProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, rscale, a, b);
+}
 
-	double r = boxy_r(x, y);
-	double r_factor = r/rscale;
-	if( r_factor < 1 ) {
-		return pow(1 - pow(r_factor, 2 - b), a);
+void FerrerProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, rscale, a, b);
+}
+
+template <bool boxy, radial_exponent t_rf, radial_exponent t_a>
+void FerrerProfile::init_eval_function() {
+	m_eval_function = eval_function<boxy, t_rf, t_a>;
+	m_eval_many_function = eval_many_function<boxy, t_rf, t_a, double>;
+	m_eval_many_float_function = eval_many_function<boxy, t_rf, t_a, float>;
+}
+
+// a is usually an integer, for which we avoid instantiating too many functions
+template <bool boxy, radial_exponent t_rf>
+void FerrerProfile::init_eval_function(radial_exponent t_a) {
+	switch (t_a) {
+		case radial_exponent::one:   init_eval_function<boxy, t_rf, radial_exponent::one>(); break;
+		case radial_exponent::two:   init_eval_function<boxy, t_rf, radial_exponent::two>(); break;
+		case radial_exponent::three: init_eval_function<boxy, t_rf, radial_exponent::three>(); break;
+		default:                     init_eval_function<boxy, t_rf, radial_exponent::general>(); break;
+	}
+}
+
+template <bool boxy>
+void FerrerProfile::init_eval_function(radial_exponent t_rf, radial_exponent t_a) {
+	switch (t_rf) {
+		case radial_exponent::quarter:      init_eval_function<boxy, radial_exponent::quarter>(t_a); break;
+		case radial_exponent::half:         init_eval_function<boxy, radial_exponent::half>(t_a); break;
+		case radial_exponent::one:          init_eval_function<boxy, radial_exponent::one>(t_a); break;
+		case radial_exponent::three_halves: init_eval_function<boxy, radial_exponent::three_halves>(t_a); break;
+		case radial_exponent::two:          init_eval_function<boxy, radial_exponent::two>(t_a); break;
+		case radial_exponent::five_halves:  init_eval_function<boxy, radial_exponent::five_halves>(t_a); break;
+		case radial_exponent::three:        init_eval_function<boxy, radial_exponent::three>(t_a); break;
+		case radial_exponent::four:         init_eval_function<boxy, radial_exponent::four>(t_a); break;
+		default:                            init_eval_function<boxy, radial_exponent::general>(t_a); break;
+	}
+}
+
+void FerrerProfile::initial_calculations() {
+
+	RadialProfile::initial_calculations();
+
+	/* The evaluation functions are specialised for the shape of the profile */
+	if( shape_parameters_changed() ) {
+		auto t_rf = get_radial_exponent((2 - b) / 2);
+		auto t_a = get_radial_exponent(a);
+		if( box != 0 ) init_eval_function<true>(t_rf, t_a);
+		else           init_eval_function<false>(t_rf, t_a);
 	}
-	return 0;
 }
 
 void FerrerProfile::validate() {
@@ -112,12 +214,18 @@ double FerrerProfile::get_rscale() {
 	return this->rout;
 }
 
+double FerrerProfile::get_rscale_edge() {
+	// evaluate_at is 0 for r >= rout
+	return 1;
+}
+
 FerrerProfile::FerrerProfile(const Model &model, const std::string &name) :
 	RadialProfile(model, name),
 	rout(3), a(1), b(1)
 {
-	// this profile defaults to a different accuracy
-	this->acc = 1;
+	// this profile defaults to a different accuracy, which is the value
+	// registered as the "acc" parameter
+	this->requested_acc = 1;
 
 	register_parameter("rout", rout);
 	register_parameter("a", a);
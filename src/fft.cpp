@@ -24,11 +24,11 @@
 
 #include <algorithm>
 #include <complex>
-#include <cstring>
-#include <iterator>
-#include <sstream>
+#include <map>
 #include <string>
 #include <stdexcept>
+#include <tuple>
+#include <utility>
 
 #include "profit/exceptions.h"
 #include "profit/fft_impl.h"
@@ -40,16 +40,6 @@ namespace profit {
 
 std::mutex fftw_mutex;
 
-template <typename T>
-void check_size(const T &data, unsigned int size)
-{
-	if (data.size() != size) {
-		std::ostringstream os;
-		os << "data size != plan size: " << data.size() << " != " << size;
-		throw std::invalid_argument(os.str());
-	}
-}
-
 static
 int get_fftw_effort(effort_t effort)
 {
@@ -67,99 +57,308 @@ int get_fftw_effort(effort_t effort)
 	}
 }
 
-template <typename T>
-static inline
-T *_fftw_buf(std::size_t size)
+template <typename FT>
+FFTPlans<FT>::~FFTPlans()
 {
-	T *buf = static_cast<T *>(fftw_malloc(sizeof(T) * size));
-	if (!buf) {
-		throw std::bad_alloc();
-	}
-	return buf;
+	std::lock_guard<std::mutex> guard(fftw_mutex);
+	forward.reset();
+	backward.reset();
 }
 
+// kind, width, height, howmany, effort, omp_threads
+typedef std::tuple<int, unsigned int, unsigned int, unsigned int, int, unsigned int> fft_plans_key;
+
+template <typename FT>
+using fft_plans_registry = std::map<fft_plans_key, std::shared_ptr<const FFTPlans<FT>>>;
 
-FFTRealTransformer::FFTRealTransformer(unsigned int size, effort_t effort, unsigned int omp_threads) :
-	size(0), hermitian_size(0), effort(effort),
-	real_buf(nullptr), complex_buf(nullptr),
-	forward_plan(nullptr),
-	backward_plan(nullptr)
+// Access to the registries is serialized with fftw_mutex
+template <typename FT>
+static fft_plans_registry<FT> &plans_registry()
 {
-	std::lock_guard<std::mutex> guard(fftw_mutex);
-#ifdef PROFIT_FFTW_OPENMP
-	fftw_plan_with_nthreads(omp_threads);
-#endif /* PROFIT_FFTW_OPENMP */
-	resize_impl(size);
+	static fft_plans_registry<FT> registry;
+	return registry;
 }
 
-FFTRealTransformer::FFTRealTransformer(effort_t effort, unsigned int omp_threads) :
-	size(0), hermitian_size(0), effort(effort),
-	real_buf(nullptr), complex_buf(nullptr),
-	forward_plan(nullptr),
-	backward_plan(nullptr)
+template <typename FT>
+static std::shared_ptr<const FFTPlans<FT>> create_fft_plans(fft_plans_kind kind,
+    const Dimensions &dims, unsigned int howmany, effort_t effort, unsigned int omp_threads)
 {
+	typedef typename fftw_traits<FT>::complex complex;
+	typedef typename FFTPlans<FT>::plan_ptr plan_ptr;
+
+	// Plans are only executed on new arrays, so the arrays below are needed
+	// only during planning, and are sized for what each kind of plan
+	// transforms. They are allocated with FFTW's malloc, like the arrays
+	// the plans will be executed on, so their alignment matches
+	std::size_t size = std::size_t(dims.x) * dims.y;
+	std::size_t hermitian_size = std::size_t(dims.x / 2 + 1) * dims.y;
+
+	fftw_traits<FT>::plan_with_nthreads(omp_threads);
+	int flags = FFTW_DESTROY_INPUT | get_fftw_effort(effort);
+	plan_ptr fwd_plan, bwd_plan;
+	if (kind == FFT_2D) {
+		auto real_buf = make_fftw_array<FT, FT>(size * howmany);
+		auto complex_buf = make_fftw_array<FT, complex>(hermitian_size * howmany);
+		int n[] = {int(dims.y), int(dims.x)};
+		fwd_plan.reset(fftw_traits<FT>::plan_many_dft_r2c(2, n, howmany,
+		    real_buf.get(), nullptr, 1, size,
+		    complex_buf.get(), nullptr, 1, hermitian_size, flags));
+		if (fwd_plan) {
+			bwd_plan.reset(fftw_traits<FT>::plan_many_dft_c2r(2, n, howmany,
+			    complex_buf.get(), nullptr, 1, hermitian_size,
+			    real_buf.get(), nullptr, 1, size, flags));
+		}
+	}
+	else if (kind == FFT_ROWS) {
+		// howmany rows, each transformed on its own
+		int n[] = {int(dims.x)};
+		int hermitian_width = dims.x / 2 + 1;
+		auto real_buf = make_fftw_array<FT, FT>(std::size_t(dims.x) * howmany);
+		auto complex_buf = make_fftw_array<FT, complex>(std::size_t(hermitian_width) * howmany);
+		fwd_plan.reset(fftw_traits<FT>::plan_many_dft_r2c(1, n, howmany,
+		    real_buf.get(), nullptr, 1, dims.x,
+		    complex_buf.get(), nullptr, 1, hermitian_width, flags));
+		if (fwd_plan) {
+			bwd_plan.reset(fftw_traits<FT>::plan_many_dft_c2r(1, n, howmany,
+			    complex_buf.get(), nullptr, 1, hermitian_width,
+			    real_buf.get(), nullptr, 1, dims.x, flags));
+		}
+	}
+	else if (kind == FFT_2D_IN_PLACE) {
+		// The real rows are padded to the length of the hermitian ones, so
+		// each input is transformed within its own hermitian_size numbers
+		int n[] = {int(dims.y), int(dims.x)};
+		int real_embed[] = {int(dims.y), 2 * int(dims.x / 2 + 1)};
+		auto complex_buf = make_fftw_array<FT, complex>(hermitian_size * howmany);
+		auto *buf = complex_buf.get();
+		auto *real_buf = reinterpret_cast<FT *>(buf);
+		fwd_plan.reset(fftw_traits<FT>::plan_many_dft_r2c(2, n, howmany,
+		    real_buf, real_embed, 1, 2 * hermitian_size,
+		    buf, nullptr, 1, hermitian_size, flags));
+		if (fwd_plan) {
+			bwd_plan.reset(fftw_traits<FT>::plan_many_dft_c2r(2, n, howmany,
+			    buf, nullptr, 1, hermitian_size,
+			    real_buf, real_embed, 1, 2 * hermitian_size, flags));
+		}
+	}
+	else {
+		// In-place transformations of the columns of a single spectrum
+		int n[] = {int(dims.y)};
+		int hermitian_width = dims.x / 2 + 1;
+		auto complex_buf = make_fftw_array<FT, complex>(hermitian_size);
+		auto *buf = complex_buf.get();
+		fwd_plan.reset(fftw_traits<FT>::plan_many_dft(1, n, hermitian_width,
+		    buf, nullptr, hermitian_width, 1,
+		    buf, nullptr, hermitian_width, 1, FFTW_FORWARD, flags));
+		if (fwd_plan) {
+			bwd_plan.reset(fftw_traits<FT>::plan_many_dft(1, n, hermitian_width,
+			    buf, nullptr, hermitian_width, 1,
+			    buf, nullptr, hermitian_width, 1, FFTW_BACKWARD, flags));
+		}
+	}
+	if (!fwd_plan) {
+		throw fft_error("Error creating forward plan");
+	}
+	if (!bwd_plan) {
+		throw fft_error("Error creating backward plan");
+	}
+	return std::make_shared<const FFTPlans<FT>>(std::move(fwd_plan), std::move(bwd_plan));
+}
+
+template <typename FT>
+std::shared_ptr<const FFTPlans<FT>> get_fft_plans(fft_plans_kind kind,
+    const Dimensions &dims, unsigned int howmany, effort_t effort, unsigned int omp_threads)
+{
+	fft_plans_key key {int(kind), dims.x, dims.y, howmany, int(effort), omp_threads};
 	std::lock_guard<std::mutex> guard(fftw_mutex);
-#ifdef PROFIT_FFTW_OPENMP
-	fftw_plan_with_nthreads(omp_threads);
-#endif /* PROFIT_FFTW_OPENMP */
+	auto &registry = plans_registry<FT>();
+	auto it = registry.find(key);
+	if (it != registry.end()) {
+		return it->second;
+	}
+	auto plans = create_fft_plans<FT>(kind, dims, howmany, effort, omp_threads);
+	registry.emplace(key, plans);
+	return plans;
 }
 
-void FFTRealTransformer::resize(unsigned int input_size)
+void clear_fft_plans()
 {
+	// Plans no longer in use are destroyed when these go out of scope,
+	// which must happen after releasing the lock
+	fft_plans_registry<double> plans;
+#ifdef PROFIT_FFTW_FLOAT
+	fft_plans_registry<float> plansf;
+#endif /* PROFIT_FFTW_FLOAT */
 	std::lock_guard<std::mutex> guard(fftw_mutex);
-	resize_impl(input_size);
+	plans.swap(plans_registry<double>());
+#ifdef PROFIT_FFTW_FLOAT
+	plansf.swap(plans_registry<float>());
+#endif /* PROFIT_FFTW_FLOAT */
 }
 
-void FFTRealTransformer::resize_impl(unsigned int input_size)
+template <typename FT>
+FFTRealTransformer<FT>::FFTRealTransformer(unsigned int size, effort_t effort, unsigned int omp_threads) :
+	FFTRealTransformer(effort, omp_threads)
 {
-	if (input_size == 0) {
+	resize(size);
+}
+
+template <typename FT>
+FFTRealTransformer<FT>::FFTRealTransformer(effort_t effort, unsigned int omp_threads) :
+	dims(), size(0), hermitian_size(0), effort(effort),
+	omp_threads(omp_threads), plans(),
+	batch_plans(),
+	column_plans(), row_plans()
+{
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::resize(unsigned int input_size)
+{
+	resize(Dimensions{input_size, 1});
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::resize(const Dimensions &input_dims)
+{
+	if (input_dims.x == 0 || input_dims.y == 0) {
 		throw invalid_parameter("cannot resize fft transformer to size 0");
 	}
-	if (size == input_size) {
+	if (dims == input_dims) {
 		return;
 	}
-	size = input_size;
-	hermitian_size = input_size / 2 + 1;
-	real_buf.reset(_fftw_buf<double>(size));
-	complex_buf.reset(_fftw_buf<fftw_complex>(hermitian_size));
-	int fftw_effort = get_fftw_effort(effort);
-	auto fwd_plan = fftw_plan_dft_r2c_1d(size, real_buf.get(), complex_buf.get(), FFTW_DESTROY_INPUT | fftw_effort);
-	if (!fwd_plan) {
-		throw fft_error("Error creating forward plan");
+	plans = get_fft_plans<FT>(FFT_2D, input_dims, 1, effort, omp_threads);
+	dims = input_dims;
+	size = dims.x * dims.y;
+	hermitian_size = (dims.x / 2 + 1) * dims.y;
+	batch_plans.clear();
+	column_plans.reset();
+	row_plans.clear();
+}
+
+// std::complex<FT> is required to be layout-compatible with FT[2] since C++11
+template <typename FT>
+static inline
+typename fftw_traits<FT>::complex *as_fftw_complex(std::complex<FT> *x)
+{
+	return reinterpret_cast<typename fftw_traits<FT>::complex *>(x);
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::forward(FT *input, std::complex<FT> *output) const
+{
+	fftw_traits<FT>::execute_dft_r2c(plans->forward.get(), input, as_fftw_complex(output));
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::backward(std::complex<FT> *input, FT *output) const
+{
+	fftw_traits<FT>::execute_dft_c2r(plans->backward.get(), as_fftw_complex(input), output);
+}
+
+template <typename FT>
+const FFTPlans<FT> &FFTRealTransformer<FT>::get_batch_plans(unsigned int howmany)
+{
+	auto &plans = batch_plans[howmany];
+	if (!plans) {
+		plans = get_fft_plans<FT>(FFT_2D_IN_PLACE, dims, howmany, effort, omp_threads);
 	}
-	auto bwd_plan = fftw_plan_dft_c2r_1d(size, complex_buf.get(), real_buf.get(), FFTW_DESTROY_INPUT | fftw_effort);
-	if (!bwd_plan) {
-		throw fft_error("Error creating backward plan");
+	return *plans;
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::forward(std::complex<FT> *data, unsigned int howmany)
+{
+	fftw_traits<FT>::execute_dft_r2c(get_batch_plans(howmany).forward.get(),
+	    reinterpret_cast<FT *>(data), as_fftw_complex(data));
+}
+
+template <typename FT>
+void FFTRealTransformer<FT>::backward(std::complex<FT> *data, unsigned int howmany)
+{
+	fftw_traits<FT>::execute_dft_c2r(get_batch_plans(howmany).backward.get(),
+	    as_fftw_complex(data), reinterpret_cast<FT *>(data));
+}
+
+template <typename FT>
+const FFTPlans<FT> &FFTRealTransformer<FT>::get_row_plans(unsigned int rows)
+{
+	auto &plans = row_plans[rows];
+	if (!plans) {
+		plans = get_fft_plans<FT>(FFT_ROWS, dims, rows, effort, omp_threads);
 	}
-	forward_plan.reset(fwd_plan);
-	backward_plan.reset(bwd_plan);
+	return *plans;
 }
 
-template <typename T>
-void FFTRealTransformer::forward(const T &input, std::vector<std::complex<double>> &output) const
+template <typename FT>
+const FFTPlans<FT> &FFTRealTransformer<FT>::get_column_plans()
 {
-	check_size(input, size);
-	check_size(output, hermitian_size);
-	std::copy(input.begin(), input.end(), real_buf.get());
-	fftw_execute(forward_plan.get());
-	// This cast is required to work since C++11 according to the standard
-	auto *as_double = reinterpret_cast<double *>(output.data());
-	std::memcpy(as_double, complex_buf.get(), sizeof(fftw_complex) * hermitian_size);
+	if (!column_plans) {
+		column_plans = get_fft_plans<FT>(FFT_COLUMNS, dims, 1, effort, omp_threads);
+	}
+	return *column_plans;
 }
 
-template <typename T>
-void FFTRealTransformer::backward(const std::vector<std::complex<double>> &input, T &output) const
+template <typename FT>
+void FFTRealTransformer<FT>::forward_pruned(FT *input, std::complex<FT> *output, unsigned int rows)
 {
-	check_size(input, hermitian_size);
-	check_size(output, size);
-	std::memcpy(complex_buf.get(), input.data(), sizeof(fftw_complex) * hermitian_size);
-	fftw_execute(backward_plan.get());
-	std::copy(real_buf.get(), real_buf.get() + size, output.begin());
+	if (rows >= dims.y) {
+		forward(input, output);
+		return;
+	}
+
+	// The FFT of a zero row is zero, so only the first rows need transforming
+	auto hermitian_width = dims.x / 2 + 1;
+	std::fill(output + std::size_t(rows) * hermitian_width, output + hermitian_size, std::complex<FT>(0));
+	if (rows == 0) {
+		return;
+	}
+	fftw_traits<FT>::execute_dft_r2c(get_row_plans(rows).forward.get(), input, as_fftw_complex(output));
+	fftw_traits<FT>::execute_dft(get_column_plans().forward.get(), as_fftw_complex(output), as_fftw_complex(output));
 }
 
-// Specializations for the Image type
-template void FFTRealTransformer::forward<Image>(const Image &input, std::vector<std::complex<double>> &output) const;
-template void FFTRealTransformer::backward<Image>(const std::vector<std::complex<double>> &input, Image &output) const;
+template <typename FT>
+void FFTRealTransformer<FT>::backward_pruned(std::complex<FT> *input, FT *output, unsigned int first_row, unsigned int rows)
+{
+	rows = std::min(rows, dims.y - std::min(first_row, dims.y));
+	if (first_row == 0 && rows == dims.y) {
+		backward(input, output);
+		return;
+	}
+	if (rows == 0) {
+		return;
+	}
+
+	// Plans expect arrays aligned like those they were created with, which
+	// the rows starting at first_row might not be. In that case we start
+	// at the closest previous row that is
+	auto hermitian_width = dims.x / 2 + 1;
+	auto same_alignment = [&](unsigned int row) {
+		auto *complex_row = reinterpret_cast<FT *>(input + std::size_t(row) * hermitian_width);
+		auto *real_row = output + std::size_t(row) * dims.x;
+		return fftw_traits<FT>::alignment_of(complex_row) == fftw_traits<FT>::alignment_of(reinterpret_cast<FT *>(input)) &&
+		       fftw_traits<FT>::alignment_of(real_row) == fftw_traits<FT>::alignment_of(output);
+	};
+	while (!same_alignment(first_row)) {
+		first_row--;
+		rows++;
+	}
+
+	fftw_traits<FT>::execute_dft(get_column_plans().backward.get(), as_fftw_complex(input), as_fftw_complex(input));
+	fftw_traits<FT>::execute_dft_c2r(get_row_plans(rows).backward.get(),
+	    as_fftw_complex(input + std::size_t(first_row) * hermitian_width),
+	    output + std::size_t(first_row) * dims.x);
+}
+
+template class FFTPlans<double>;
+template std::shared_ptr<const FFTPlans<double>> get_fft_plans<double>(fft_plans_kind, const Dimensions &, unsigned int, effort_t, unsigned int);
+template class FFTRealTransformer<double>;
+
+#ifdef PROFIT_FFTW_FLOAT
+template class FFTPlans<float>;
+template std::shared_ptr<const FFTPlans<float>> get_fft_plans<float>(fft_plans_kind, const Dimensions &, unsigned int, effort_t, unsigned int);
+template class FFTRealTransformer<float>;
+#endif /* PROFIT_FFTW_FLOAT */
 
 }  // namespace profit
 
@@ -27,6 +27,7 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <memory>
 #include <numeric>
 #include <utility>
 
@@ -109,56 +110,110 @@ Mask::Mask(std::vector<bool>&& data, Dimensions dimensions) :
 {
 }
 
+MaskSpans::MaskSpans(const Mask &mask) :
+	_row_offsets(mask.getHeight() + 1, 0)
+{
+	auto width = mask.getWidth();
+	auto height = mask.getHeight();
+	auto row_begin = mask.begin();
+	for (unsigned int j = 0; j < height; j++) {
+		auto row_end = row_begin + width;
+		auto first = std::find(row_begin, row_end, true);
+		while (first != row_end) {
+			auto last = std::find(first, row_end, false);
+			unsigned int i0 = first - row_begin;
+			unsigned int i1 = last - row_begin;
+			_spans.emplace_back(i0, i1);
+			_count += i1 - i0;
+			first = std::find(last, row_end, true);
+		}
+		_row_offsets[j + 1] = _spans.size();
+		row_begin = row_end;
+	}
+}
+
+const MaskSpans &Mask::spans() const
+{
+	// Threads racing to build the view agree on the first one stored,
+	// which is kept until this mask is modified
+	auto spans = std::atomic_load(&_spans);
+	if (!spans) {
+		std::shared_ptr<const MaskSpans> stored;
+		spans = std::make_shared<const MaskSpans>(*this);
+		if (!std::atomic_compare_exchange_strong(&_spans, &stored, spans)) {
+			spans = stored;
+		}
+	}
+	return *spans;
+}
+
 Mask Mask::expand_by(Dimensions pad, int threads) const
 {
-	Mask output{*this};
+	if (empty()) {
+		return *this;
+	}
+
+	// The expansion is a dilation by a (2 * pad.x + 1) x (2 * pad.y + 1)
+	// rectangle, which is separable into a horizontal and a vertical pass.
+	// Pixels are kept in bytes rather than bits to allow concurrent writes
 	auto width = getWidth();
 	auto height = getHeight();
-	const size_t src_krn_offset = pad.x + pad.y * width;
-	const auto &mask_data = _get();
-	omp_2d_for(threads, width, height, [&](unsigned int i, unsigned int j) {
-		// Quickly skip those that are set already
-		auto output_idx = i + j * width;
-		if (output[output_idx]) {
-			return;
-		}
-
-		// Depending on where the output pixel is we might need to use
-		// smaller portions of the source image
-		size_t input_idx = output_idx - src_krn_offset;
-		unsigned int l_min = 0;
-		unsigned int l_max = 2 * pad.y + 1;
-		unsigned int k_min = 0;
-		unsigned int k_max = 2 * pad.x + 1;
 
-		if (j < pad.y) {
-			l_min = pad.y - j;
+	// Horizontal pass: widen each run of set pixels by pad.x on both sides,
+	// not filling twice the overlapping parts of consecutive runs
+	std::vector<unsigned char> widened(width * height, 0);
+	const auto &mask_spans = spans();
+	omp_1d_for(threads, height, [&](unsigned int j) {
+		auto row = widened.begin() + j * width;
+		unsigned int filled = 0;
+		for (auto &span: mask_spans.row(j)) {
+			auto i0 = std::max(filled, span.first > pad.x ? span.first - pad.x : 0);
+			auto i1 = std::min(width, span.second + pad.x);
+			std::fill(row + i0, row + i1, 1);
+			filled = i1;
 		}
-		else if ((j + pad.y) >= height) {
-			l_max = height + pad.y - j;
-		}
-		if (i < pad.x) {
-			k_min = pad.x - i;
-		}
-		else if ((i + pad.x) >= width)
-		{
-			k_max = width + pad.x - i;
+	});
+
+	// Vertical pass: keep a running count of the set pixels within
+	// [j - pad.y, j + pad.y] for each column, processing blocks of columns
+	// independently
+	std::vector<unsigned char> expanded(width * height);
+	const unsigned int block_width = 256;
+	unsigned int n_blocks = (width + block_width - 1) / block_width;
+	omp_1d_for(threads, n_blocks, [&](unsigned int block) {
+		unsigned int i0 = block * block_width;
+		unsigned int n = std::min(width - i0, block_width);
+		std::vector<unsigned int> counts(n, 0);
+		auto add_row = [&](unsigned int j) {
+			auto row = widened.data() + i0 + j * width;
+			for (unsigned int i = 0; i < n; i++) {
+				counts[i] += row[i];
+			}
+		};
+		auto remove_row = [&](unsigned int j) {
+			auto row = widened.data() + i0 + j * width;
+			for (unsigned int i = 0; i < n; i++) {
+				counts[i] -= row[i];
+			}
+		};
+		for (unsigned int j = 0; j < std::min(height, pad.y); j++) {
+			add_row(j);
 		}
-		input_idx += k_min + l_min * width;
-
-		// Loop throught each of the rows of the src/krn surfaces
-		// and compute the dot product of each of them, then sum up
-		for (size_t l = 0; l < l_max - l_min; l++) {
-			auto first = mask_data.begin() + input_idx;
-			if (std::any_of(first, first + k_max - k_min,
-			                [](bool mask_value) { return mask_value; })) {
-				output[output_idx] = true;
-				return;
+		for (unsigned int j = 0; j < height; j++) {
+			if (j + pad.y < height) {
+				add_row(j + pad.y);
+			}
+			if (j > pad.y) {
+				remove_row(j - pad.y - 1);
+			}
+			auto row = expanded.data() + i0 + j * width;
+			for (unsigned int i = 0; i < n; i++) {
+				row[i] = counts[i] > 0;
 			}
-			input_idx += width;
 		}
 	});
-	return output;
+
+	return Mask(std::vector<bool>(expanded.begin(), expanded.end()), getDimensions());
 }
 
 Image::Image(unsigned int width, unsigned int height) :
@@ -329,10 +384,19 @@ Image &Image::operator&=(const Mask &mask)
 		return *this;
 	}
 
-	std::transform(begin(), end(), mask.begin(), begin(),
-		[](const double i, const bool m) {
-			return m ? i : 0.;
-	});
+	// Zero the gaps between the runs of set pixels of each row
+	auto width = getWidth();
+	auto height = getHeight();
+	const auto &mask_spans = mask.spans();
+	for (unsigned int j = 0; j < height; j++) {
+		auto row = begin() + j * width;
+		unsigned int i = 0;
+		for (auto &span: mask_spans.row(j)) {
+			std::fill(row + i, row + span.first, 0.);
+			i = span.second;
+		}
+		std::fill(row + i, row + width, 0.);
+	}
 	return *this;
 }
 
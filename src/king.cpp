@@ -47,15 +47,111 @@ namespace profit
  *   temp  = 1/(1+(rt/rc)^2)^(1/a)
  *       r = (x^{2+B} + y^{2+B})^{1/(2+B)}
  *       B = box parameter
+ *
+ * temp (the edge value, which makes the profile 0 at rt) only depends on the
+ * shape of the profile, r^2 is calculated directly, which for B = 0 doesn't
+ * need a square root, and the evaluation function is specialised for common
+ * values of a (and thus of 1/a, see radial_exponent).
+ */
+template <bool boxy, radial_exponent t>
+static
+double eval_function(double x, double y, double box, double rc, double rt, double a, double edge)
+{
+	double r2 = fixed_boxy_r2<boxy>(x, y, box);
+	if( r2 < rt * rt ) {
+		double base = fixed_pow<inverse_radial_exponent(t)>(1 + r2 / (rc * rc), 1 / a);
+		return fixed_pow<t>(1 / base - edge, a);
+	}
+	return 0;
+}
+
+/*
+ * The vectorised king evaluation function
  */
+template <bool boxy, radial_exponent t>
+struct king_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double rc, double rt, double a, double edge) :
+			box(box), rc(rc), rt(rt), a(a), edge(edge) {}
+
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			const auto one = S::set1(1.);
+			auto r2 = simd_boxy_r2<SIMD, FT, boxy>(x, y, box);
+			auto r2_factor = S::div(r2, S::set1(rc * rc));
+			auto base = simd_fixed_pow<SIMD, FT, inverse_radial_exponent(t)>(S::add(one, r2_factor), 1 / a);
+			auto val = simd_fixed_pow<SIMD, FT, t>(S::sub(S::div(one, base), S::set1(edge)), a);
+			return S::select(S::lt(r2, S::set1(rt * rt)), val, S::set1(0.));
+		}
+
+		double box, rc, rt, a, edge;
+	};
+
+};
+
+template <bool boxy, radial_exponent t, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double rc, double rt, double a, double edge)
+{
+	simd_evaluate<king_kernel<boxy, t>::template simd>(instruction_set, x, y, values, n, box, rc, rt, a, edge);
+}
+
 double KingProfile::evaluate_at(double x, double y) const {
+	return m_eval_function(x, y, box, rc, rt, a, _edge);
+}
 
-	using std::pow;
-	double r = boxy_r(x, y);
-	if( r < rt ) {
-		return pow(1/pow(1 + pow(r/rc, 2), 1/a) - 1/pow(1 + pow(rt/rc, 2), 1/a), a);
+void KingProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, rc, rt, a, _edge);
+}
+
+void KingProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, rc, rt, a, _edge);
+}
+
+template <bool boxy, radial_exponent t>
+void KingProfile::init_eval_function() {
+	m_eval_function = eval_function<boxy, t>;
+	m_eval_many_function = eval_many_function<boxy, t, double>;
+	m_eval_many_float_function = eval_many_function<boxy, t, float>;
+}
+
+template <bool boxy>
+void KingProfile::init_eval_function(radial_exponent t) {
+	switch (t) {
+		case radial_exponent::quarter:      init_eval_function<boxy, radial_exponent::quarter>(); break;
+		case radial_exponent::half:         init_eval_function<boxy, radial_exponent::half>(); break;
+		case radial_exponent::one:          init_eval_function<boxy, radial_exponent::one>(); break;
+		case radial_exponent::three_halves: init_eval_function<boxy, radial_exponent::three_halves>(); break;
+		case radial_exponent::two:          init_eval_function<boxy, radial_exponent::two>(); break;
+		case radial_exponent::five_halves:  init_eval_function<boxy, radial_exponent::five_halves>(); break;
+		case radial_exponent::three:        init_eval_function<boxy, radial_exponent::three>(); break;
+		case radial_exponent::four:         init_eval_function<boxy, radial_exponent::four>(); break;
+		default:                            init_eval_function<boxy, radial_exponent::general>(); break;
+	}
+}
+
+void KingProfile::initial_calculations() {
+
+	RadialProfile::initial_calculations();
+
+	/* The edge value and evaluation functions depend only on the shape */
+	if( shape_parameters_changed() ) {
+		_edge = 1 / std::pow(1 + std::pow(rt / rc, 2), 1 / a);
+		auto t = get_radial_exponent(a);
+		if( box != 0 ) init_eval_function<true>(t);
+		else           init_eval_function<false>(t);
 	}
-	return 0;
 }
 
 void KingProfile::validate() {
@@ -108,9 +204,14 @@ double KingProfile::get_rscale() {
 	return this->rt;
 }
 
+double KingProfile::get_rscale_edge() {
+	// evaluate_at is 0 for r >= rt
+	return 1;
+}
+
 KingProfile::KingProfile(const Model &model, const std::string &name) :
 	RadialProfile(model, name),
-	rc(1), rt(3), a(2)
+	rc(1), rt(3), a(2), _edge(0)
 {
 	register_parameter("rc", rc);
 	register_parameter("rt", rt);
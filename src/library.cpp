@@ -31,6 +31,7 @@
 
 #include "profit/config.h"
 #include "profit/library.h"
+#include "profit/sersic.h"
 #include "profit/utils.h"
 #include "profit/fft_impl.h"
 
@@ -68,7 +69,7 @@ std::string version_suffix()
 
 #ifdef PROFIT_FFTW
 static inline
-std::string get_fftw_wisdom_filename()
+std::string get_fftw_wisdom_filename(bool single_precision = false)
 {
 	auto fftw_cache_dir = create_dirs(get_profit_home(), {std::string("fftw_cache")});
 #ifdef PROFIT_FFTW_OPENMP
@@ -76,6 +77,9 @@ std::string get_fftw_wisdom_filename()
 #else
 	auto fftw_wisdom_fname = fftw_cache_dir + "/unthreaded-wisdom";
 #endif
+	if (single_precision) {
+		fftw_wisdom_fname += "-float";
+	}
 	return fftw_wisdom_fname + "_" + fftw_version;
 }
 #endif // PROFIT_FFTW
@@ -93,6 +97,61 @@ std::string finish_diagnose()
 	return _finish_diagnose;
 }
 
+#ifdef PROFIT_FFTW
+template <typename ImportWisdom>
+static void import_fftw_wisdom(const std::string &fftw_wisdom_filename, ImportWisdom &&import_wisdom)
+{
+	if (!file_exists(fftw_wisdom_filename)) {
+		return;
+	}
+	auto *fftw_wisdom_file = fopen(fftw_wisdom_filename.c_str(), "r");
+	if (!fftw_wisdom_file) {
+		std::ostringstream os;
+		os << "Opening fftw wisdom from " << fftw_wisdom_filename << " failed: " << strerror(errno);
+		_init_diagnose = os.str();
+	}
+	else {
+		auto import_status = import_wisdom(fftw_wisdom_file);
+		if (import_status == 0) {
+			std::ostringstream os;
+			os << "Importing fftw wisdom from " << fftw_wisdom_filename << " failed: " << import_status;
+			_init_diagnose = os.str();
+		}
+		fclose(fftw_wisdom_file);
+	}
+}
+
+template <typename ExportWisdom>
+static void export_fftw_wisdom(const std::string &fftw_wisdom_filename, ExportWisdom &&export_wisdom)
+{
+	auto *fftw_wisdom_file = fopen(fftw_wisdom_filename.c_str(), "w");
+	if (!fftw_wisdom_file) {
+		std::ostringstream os;
+		os << "Error when exporting fftw wisdom from " << fftw_wisdom_file << ": " << strerror(errno);
+		_finish_diagnose = os.str();
+	}
+	else {
+		export_wisdom(fftw_wisdom_file);
+		fclose(fftw_wisdom_file);
+	}
+}
+
+static void import_fftw_system_wisdom(const char *fftw_system_wisdom_filename, int (*import_system_wisdom)())
+{
+#if !(defined(__WIN32__) || defined(WIN32) || defined(_WINDOWS))
+	if (file_exists(fftw_system_wisdom_filename) && import_system_wisdom() == 0) {
+		std::ostringstream os;
+		os << _init_diagnose << '\n';
+		os << "Importing fftw system wisdom failed (returned 0)";
+		_init_diagnose = os.str();
+	}
+#else
+	UNUSED(fftw_system_wisdom_filename);
+	UNUSED(import_system_wisdom);
+#endif // !WIN32
+}
+#endif // PROFIT_FFTW
+
 bool init()
 {
 	// Initialize FFTW library, including its OpenMP support
@@ -102,6 +161,11 @@ bool init()
 	std::lock_guard<std::mutex> guard(fftw_mutex);
 #ifdef PROFIT_FFTW_OPENMP
 	int res = fftw_init_threads();
+#ifdef PROFIT_FFTW_FLOAT
+	if (res) {
+		res = fftwf_init_threads();
+	}
+#endif // PROFIT_FFTW_FLOAT
 	if (!res) {
 		std::ostringstream os;
 		os << "Error while initializing FFTW threads support, errno = " << res;
@@ -110,33 +174,12 @@ bool init()
 	}
 #endif // PROFIT_FFTW_OPENMP
 
-	auto fftw_wisdom_filename = get_fftw_wisdom_filename();
-	if (file_exists(fftw_wisdom_filename)) {
-		auto *fftw_wisdom_file = fopen(fftw_wisdom_filename.c_str(), "r");
-		if (!fftw_wisdom_file) {
-			std::ostringstream os;
-			os << "Opening fftw wisdom from " << fftw_wisdom_filename << " failed: " << strerror(errno);
-			_init_diagnose = os.str();
-		}
-		else {
-			auto import_status = fftw_import_wisdom_from_file(fftw_wisdom_file);
-			if (import_status == 0) {
-				std::ostringstream os;
-				os << "Importing fftw wisdom from " << fftw_wisdom_filename << " failed: " << import_status;
-				_init_diagnose = os.str();
-			}
-			fclose(fftw_wisdom_file);
-		}
-	}
-
-#if !(defined(__WIN32__) || defined(WIN32) || defined(_WINDOWS))
-	if (file_exists("/etc/fftw/wisdom") && fftw_import_system_wisdom() == 0) {
-		std::ostringstream os;
-		os << _init_diagnose << '\n';
-		os << "Importing fftw system wisdom failed (returned 0)";
-		_init_diagnose = os.str();
-	}
-#endif // !WIN32
+	import_fftw_wisdom(get_fftw_wisdom_filename(), fftw_import_wisdom_from_file);
+	import_fftw_system_wisdom("/etc/fftw/wisdom", fftw_import_system_wisdom);
+#ifdef PROFIT_FFTW_FLOAT
+	import_fftw_wisdom(get_fftw_wisdom_filename(true), fftwf_import_wisdom_from_file);
+	import_fftw_system_wisdom("/etc/fftw/wisdomf", fftwf_import_system_wisdom);
+#endif // PROFIT_FFTW_FLOAT
 #endif // PROFIT_FFTW
 
 	return true;
@@ -145,22 +188,23 @@ bool init()
 void finish()
 {
 #ifdef PROFIT_FFTW
+	// Shared plans must be gone before FFTW is cleaned up
+	clear_fft_plans();
 	std::lock_guard<std::mutex> guard(fftw_mutex);
-	auto fftw_wisdom_filename = get_fftw_wisdom_filename();
-	auto *fftw_wisdom_file = fopen(fftw_wisdom_filename.c_str(), "w");
-	if (!fftw_wisdom_file) {
-		std::ostringstream os;
-		os << "Error when exporting fftw wisdom from " << fftw_wisdom_file << ": " << strerror(errno);
-		_finish_diagnose = os.str();
-	}
-	else {
-		fftw_export_wisdom_to_file(fftw_wisdom_file);
-		fclose(fftw_wisdom_file);
-	}
+	export_fftw_wisdom(get_fftw_wisdom_filename(), fftw_export_wisdom_to_file);
+#ifdef PROFIT_FFTW_FLOAT
+	export_fftw_wisdom(get_fftw_wisdom_filename(true), fftwf_export_wisdom_to_file);
+#endif // PROFIT_FFTW_FLOAT
 #ifdef PROFIT_FFTW_OPENMP
 	fftw_cleanup_threads();
+#ifdef PROFIT_FFTW_FLOAT
+	fftwf_cleanup_threads();
+#endif // PROFIT_FFTW_FLOAT
 #endif /* PROFIT_FFTW_OPENMP */
 	fftw_cleanup();
+#ifdef PROFIT_FFTW_FLOAT
+	fftwf_cleanup();
+#endif // PROFIT_FFTW_FLOAT
 #endif // PROFIT_FFTW
 }
 
@@ -182,6 +226,15 @@ bool has_fftw()
 #endif // PROFIT_FFTW
 }
 
+bool has_fftw_float()
+{
+#ifdef PROFIT_FFTW_FLOAT
+	return true;
+#else
+	return false;
+#endif // PROFIT_FFTW_FLOAT
+}
+
 bool has_fftw_with_openmp()
 {
 #ifdef PROFIT_FFTW_OPENMP
@@ -267,6 +320,9 @@ void clear_cache()
 		recursive_remove(opencl_cache);
 	}
 #endif
+
+	// Central pixel values of sersic profiles, kept under sersic_cache
+	SersicProfile::clear_central_pixel_cache();
 }
 
 } // namespace profit
\ No newline at end of file
@@ -26,8 +26,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <exception>
 #include <functional>
+#include <iterator>
+#include <numeric>
 #include <sstream>
+#include <vector>
 
 #include "profit/common.h"
 #include "profit/brokenexponential.h"
@@ -36,9 +40,11 @@
 #include "profit/exceptions.h"
 #include "profit/ferrer.h"
 #include "profit/king.h"
+#include "profit/library.h"
 #include "profit/model.h"
 #include "profit/moffat.h"
 #include "profit/null.h"
+#include "profit/omp_utils.h"
 #include "profit/psf.h"
 #include "profit/sersic.h"
 #include "profit/sky.h"
@@ -64,7 +70,15 @@ Model::Model(unsigned int width, unsigned int height) :
 	return_finesampled(true),
 	opencl_env(),
 	omp_threads(0),
-	profiles()
+	concurrent_profiles(0),
+	instruction_set(AUTO),
+	single_precision(false),
+	profiles(),
+	profile_omp_threads(0),
+	profile_cache_size(0),
+	profile_cache(),
+	cached_inputs(),
+	profile_cache_clock(0)
 {
 	// no-op
 }
@@ -84,10 +98,28 @@ Model::Model(Dimensions dimensions) :
 	return_finesampled(true),
 	opencl_env(),
 	omp_threads(0),
-	profiles()
+	concurrent_profiles(0),
+	instruction_set(AUTO),
+	single_precision(false),
+	profiles(),
+	profile_omp_threads(0),
+	profile_cache_size(0),
+	profile_cache(),
+	cached_inputs(),
+	profile_cache_clock(0)
 {
 }
 
+void Model::set_instruction_set(simd_instruction_set instruction_set)
+{
+	if (!has_simd_instruction_set(instruction_set)) {
+		std::ostringstream os;
+		os << "Instruction set \"" << instruction_set << "\" is not supported";
+		throw invalid_parameter(os.str());
+	}
+	this->instruction_set = instruction_set;
+}
+
 bool Model::has_profiles() const {
 	return this->profiles.size() > 0;
 }
@@ -257,34 +289,153 @@ void Model::adjust(Mask &mask, const Dimensions &dims, const Image &psf,
 }
 
 Image Model::evaluate(Point &offset_out)
+{
+	return evaluate_model(nullptr, offset_out);
+}
+
+Image Model::evaluate(std::vector<Image> &derivatives, Point &offset_out)
+{
+	return evaluate_model(&derivatives, offset_out);
+}
+
+Image Model::evaluate_model(std::vector<Image> *derivatives, Point &offset_out)
 {
 	auto analysis = analyze_inputs();
+	if (derivatives) {
+		derivatives->clear();
+	}
 
 	/* so long folks! */
 	if (dry_run) {
 		inform_offset({0, 0}, offset_out);
+		if (derivatives) {
+			for (auto &profile: profiles) {
+				auto n_parameters = profile->get_derivative_parameters().size();
+				derivatives->insert(derivatives->end(), n_parameters, Image{analysis.drawing_dims});
+			}
+		}
 		return Image{analysis.drawing_dims};
 	}
 
 	// Adjust mask before passing it down to profiles
 	Point offset;
-	Image image;
 	Mask adjusted_mask;
-	if (adjust_mask && analysis.mask_needs_adjustment) {
-		adjusted_mask = mask;
-		adjust(adjusted_mask, psf, finesampling, analysis);
-		image = produce_image(adjusted_mask, analysis, offset);
+	auto &profiles_mask = get_profiles_mask(analysis, adjusted_mask);
+	auto image = produce_image(profiles_mask, analysis, offset, derivatives);
+
+	// Derivatives undergo the same post-processing as the image
+	std::vector<Image *> images {&image};
+	if (derivatives) {
+		for (auto &derivative: *derivatives) {
+			images.push_back(&derivative);
+		}
+	}
+	post_process(images, analysis, bool(adjusted_mask), offset);
+
+	inform_offset(offset, offset_out);
+	return image;
+}
+
+std::vector<Image> Model::evaluate_batch(const std::vector<ProfileParameter> &parameters,
+    const std::vector<std::vector<double>> &values, Point &offset_out)
+{
+	for (auto &parameter: parameters) {
+		if (std::find(profiles.begin(), profiles.end(), parameter.first) == profiles.end()) {
+			throw invalid_parameter("Parameter " + parameter.second + " belongs to a profile not in this model");
+		}
 	}
-	else {
-		if (!adjust_mask && mask.getDimensions() != analysis.drawing_dims) {
+	for (auto &parameter_values: values) {
+		if (parameter_values.size() != parameters.size()) {
 			std::ostringstream os;
-			os << "Mask dimensions != drawing dimensions: "
-			   << mask.getDimensions() << " != " << analysis.drawing_dims;
+			os << "Number of values != number of parameters: ";
+			os << parameter_values.size() << " != " << parameters.size();
 			throw invalid_parameter(os.str());
 		}
-		image = produce_image(mask, analysis, offset);
 	}
 
+	auto analysis = analyze_inputs();
+	if (dry_run) {
+		inform_offset({0, 0}, offset_out);
+		return std::vector<Image>(values.size(), Image{analysis.drawing_dims});
+	}
+
+	Mask adjusted_mask;
+	auto &profiles_mask = get_profiles_mask(analysis, adjusted_mask);
+
+	/*
+	 * Profiles are evaluated for each set of values in turn, one image after
+	 * the other (each using the usual profile-level parallelism); only the
+	 * convolution is carried out for the whole batch at once. The original
+	 * parameter values are restored afterwards
+	 */
+	std::vector<double> original_values;
+	for (auto &parameter: parameters) {
+		original_values.push_back(parameter.first->get_double_parameter(parameter.second));
+	}
+	auto set_values = [&](const std::vector<double> &parameter_values) {
+		for (std::size_t i = 0; i != parameters.size(); i++) {
+			parameters[i].first->parameter(parameters[i].second, parameter_values[i]);
+		}
+	};
+	std::vector<Image> images;
+	std::vector<Image> to_convolve;
+	try {
+		for (auto &parameter_values: values) {
+			set_values(parameter_values);
+			for (auto &profile: profiles) {
+				profile->validate();
+			}
+			images.emplace_back(analysis.drawing_dims);
+			to_convolve.emplace_back(analysis.convolution_required ? analysis.drawing_dims : Dimensions{});
+			evaluate_profiles(images.back(), to_convolve.back(), profiles_mask, analysis, nullptr);
+		}
+	} catch (...) {
+		set_values(original_values);
+		throw;
+	}
+	set_values(original_values);
+
+	// All images are convolved together
+	Point offset;
+	if (analysis.convolution_required) {
+		auto convolved = ensure_convolver()->convolve(to_convolve, psf, profiles_mask, crop, offset);
+		to_convolve.clear();
+		for (std::size_t i = 0; i != images.size(); i++) {
+			if (convolved[i].getDimensions() != analysis.drawing_dims) {
+				images[i] = images[i].extend(convolved[i].getDimensions(), offset);
+			}
+			images[i] += convolved[i];
+		}
+	}
+
+	std::vector<Image *> image_ptrs;
+	for (auto &image: images) {
+		image_ptrs.push_back(&image);
+	}
+	post_process(image_ptrs, analysis, bool(adjusted_mask), offset);
+	inform_offset(offset, offset_out);
+	return images;
+}
+
+const Mask &Model::get_profiles_mask(const input_analysis &analysis, Mask &adjusted_mask) const
+{
+	if (adjust_mask && analysis.mask_needs_adjustment) {
+		adjusted_mask = mask;
+		adjust(adjusted_mask, psf, finesampling, analysis);
+		return adjusted_mask;
+	}
+	if (!adjust_mask && mask.getDimensions() != analysis.drawing_dims) {
+		std::ostringstream os;
+		os << "Mask dimensions != drawing dimensions: "
+		   << mask.getDimensions() << " != " << analysis.drawing_dims;
+		throw invalid_parameter(os.str());
+	}
+	return mask;
+}
+
+void Model::post_process(const std::vector<Image *> &images, const input_analysis &analysis,
+    bool mask_adjusted, Point &offset) const
+{
 	// Remove PSF padding if one was added, and downsample if necessary
 	if (analysis.psf_padding) {
 		auto crop_offset = analysis.psf_padding;
@@ -297,30 +448,247 @@ Image Model::evaluate(Point &offset_out)
 			auto conv_intended_padding = convolver->padding(analysis.drawing_dims - analysis.psf_padding * 2, psf.getDimensions());
 			auto offset_diff = conv_actual_padding.first - conv_intended_padding.first;
 			auto dim_diff = conv_actual_padding.second - conv_intended_padding.second;
-			crop_dims = image.getDimensions() - analysis.psf_padding * 2;
+			crop_dims = images.front()->getDimensions() - analysis.psf_padding * 2;
 			crop_dims -= offset_diff + dim_diff;
 			crop_offset += offset_diff;
 			offset -= offset_diff;
 		}
-		image = image.crop(crop_dims, crop_offset);
+		for (auto image: images) {
+			*image = image->crop(crop_dims, crop_offset);
+		}
 	}
 
+	for (auto image: images) {
+		if (finesampling > 1 && !return_finesampled) {
+			*image = image->downsample(finesampling, Image::DownsamplingMode::SUM);
+		}
+		// Only in this case we know exactly what to mask out; otherwise
+		// users should have the original mask
+		if (mask_adjusted) {
+			*image &= mask;
+		}
+	}
 	if (finesampling > 1 && !return_finesampled) {
-		image = image.downsample(finesampling, Image::DownsamplingMode::SUM);
 		offset /= finesampling;
 	}
-	// Only in this case we know exactly what to mask out; otherwise
-	// users should have the original mask
-	if (adjusted_mask) {
-		image &= mask;
+}
+
+void Model::evaluate_profile(Profile &profile, Image &image, const Mask &mask,
+    const input_analysis &analysis)
+{
+	PixelScale profile_scale {scale.first / finesampling, scale.second / finesampling};
+	profile.adjust_for_finesampling(finesampling);
+	profile.evaluate(image, mask, profile_scale, analysis.psf_padding, magzero);
+}
+
+// Adds region_image, which covers region of image, onto image
+static void add_region(Image &image, const Image &region_image, const Box &region)
+{
+	auto width = image.getWidth();
+	auto region_width = region_image.getWidth();
+	for (unsigned int j = region.first.y; j < region.second.y; j++) {
+		auto *row = image.data() + j * width + region.first.x;
+		auto *region_row = region_image.data() + (j - region.first.y) * region_width;
+		for (unsigned int i = 0; i < region_width; i++) {
+			row[i] += region_row[i];
+		}
 	}
+}
 
-	inform_offset(offset, offset_out);
-	return image;
+void Model::evaluate_profiles(const unsigned int *indices, unsigned int n_profiles,
+    Image *images, Box *regions, unsigned int concurrent, const Mask &mask,
+    const input_analysis &analysis)
+{
+	/*
+	 * Profiles are evaluated in batches, each into an image covering only
+	 * its footprint. The OpenMP threads are split among the profiles of each
+	 * batch, which use them in nested parallel regions, and exceptions are
+	 * propagated outside the parallel region.
+	 */
+	PixelScale profile_scale {scale.first / finesampling, scale.second / finesampling};
+	omp_nested_parallelism nested_parallelism(concurrent > 1 && profile_omp_threads > 1);
+	std::vector<std::exception_ptr> errors(n_profiles);
+	for (unsigned int first = 0; first < n_profiles; first += concurrent) {
+		auto batch_size = std::min(concurrent, n_profiles - first);
+		omp_1d_for(concurrent, batch_size, [&](unsigned int i) {
+			try {
+				auto &profile = *profiles[indices[first + i]];
+				profile.adjust_for_finesampling(finesampling);
+				images[first + i] = profile.evaluate_footprint(analysis.drawing_dims,
+				    regions[first + i], mask, profile_scale, analysis.psf_padding, magzero);
+			} catch (...) {
+				errors[first + i] = std::current_exception();
+			}
+		});
+		for (unsigned int i = 0; i < batch_size; i++) {
+			if (errors[first + i]) {
+				std::rethrow_exception(errors[first + i]);
+			}
+		}
+	}
+}
+
+void Model::evaluate_profiles(Image &model_image, Image &to_convolve,
+    const Mask &mask, const input_analysis &analysis,
+    std::vector<Image> *derivatives)
+{
+	// Derivatives are calculated one profile after the other, since profiles
+	// evaluate themselves many times to calculate them
+	if (derivatives) {
+		PixelScale profile_scale {scale.first / finesampling, scale.second / finesampling};
+		profile_omp_threads = omp_threads;
+		for(auto &profile: this->profiles) {
+			auto n_parameters = profile->get_derivative_parameters().size();
+			std::vector<Image> profile_derivatives(n_parameters, Image{analysis.drawing_dims});
+			profile->adjust_for_finesampling(finesampling);
+			profile->evaluate_derivatives(profile->do_convolve() ? to_convolve : model_image,
+			    profile_derivatives, mask, profile_scale, analysis.psf_padding, magzero);
+			std::move(profile_derivatives.begin(), profile_derivatives.end(),
+			          std::back_inserter(*derivatives));
+		}
+		return;
+	}
+
+	auto n_profiles = static_cast<unsigned int>(profiles.size());
+	auto concurrent = std::max(1U, std::min({concurrent_profiles, omp_threads, n_profiles}));
+	profile_omp_threads = concurrent == 1 ? omp_threads : std::max(1U, omp_threads / concurrent);
+
+	if (profile_cache_size) {
+		evaluate_cached_profiles(model_image, to_convolve, mask, analysis, concurrent);
+		return;
+	}
+
+	if (concurrent == 1) {
+		for(auto &profile: this->profiles) {
+			evaluate_profile(*profile, profile->do_convolve() ? to_convolve : model_image, mask, analysis);
+		}
+		return;
+	}
+
+	/*
+	 * Each batch of profiles is evaluated into its own set of images, which
+	 * are then added in order. Since profiles add their values to the given
+	 * image, this gives the same result as evaluating them one after the
+	 * other into the same image.
+	 */
+	std::vector<Image> profile_images(concurrent);
+	std::vector<Box> regions(concurrent);
+	std::vector<unsigned int> indices(concurrent);
+	for (unsigned int first = 0; first < n_profiles; first += concurrent) {
+		auto batch_size = std::min(concurrent, n_profiles - first);
+		std::iota(indices.begin(), indices.end(), first);
+		evaluate_profiles(indices.data(), batch_size, profile_images.data(), regions.data(),
+		                  concurrent, mask, analysis);
+		for (unsigned int i = 0; i < batch_size; i++) {
+			auto &profile = profiles[first + i];
+			add_region(profile->do_convolve() ? to_convolve : model_image, profile_images[i], regions[i]);
+		}
+	}
+}
+
+bool Model::profile_cache_inputs::operator==(const profile_cache_inputs &other) const
+{
+	return drawing_dims == other.drawing_dims && psf_padding == other.psf_padding &&
+	       mask_needs_adjustment == other.mask_needs_adjustment &&
+	       mask_needs_convolution == other.mask_needs_convolution &&
+	       finesampling == other.finesampling && scale == other.scale &&
+	       magzero == other.magzero &&
+	       instruction_set == other.instruction_set &&
+	       single_precision == other.single_precision && opencl_env == other.opencl_env;
+}
+
+void Model::evaluate_cached_profiles(Image &model_image, Image &to_convolve,
+    const Mask &mask, const input_analysis &analysis, unsigned int concurrent)
+{
+	profile_cache_inputs inputs {analysis.drawing_dims, analysis.psf_padding,
+	                             adjust_mask && analysis.mask_needs_adjustment,
+	                             analysis.mask_needs_convolution,
+	                             finesampling, scale, magzero,
+	                             instruction_set, single_precision, opencl_env};
+	if (!(inputs == cached_inputs)) {
+		profile_cache.clear();
+		cached_inputs = inputs;
+	}
+	auto n_profiles = static_cast<unsigned int>(profiles.size());
+	profile_cache.resize(n_profiles);
+	profile_cache_clock++;
+
+	// Only profiles without a valid kept image are evaluated
+	std::vector<unsigned int> stale;
+	std::vector<unsigned long> parameter_changes(n_profiles);
+	for (unsigned int i = 0; i < n_profiles; i++) {
+		auto &entry = profile_cache[i];
+		parameter_changes[i] = profiles[i]->get_parameter_changes();
+		if (!entry.kept || entry.parameter_changes != parameter_changes[i]) {
+			entry = profile_cache_entry();
+			stale.push_back(i);
+			continue;
+		}
+		entry.last_used = profile_cache_clock;
+	}
+	auto n_stale = static_cast<unsigned int>(stale.size());
+	std::vector<Image> stale_images(n_stale);
+	std::vector<Box> stale_regions(n_stale);
+	evaluate_profiles(stale.data(), n_stale, stale_images.data(), stale_regions.data(),
+	                  concurrent, mask, analysis);
+
+	// Images are added in profile order, regardless of where they come from
+	unsigned int k = 0;
+	for (unsigned int i = 0; i < n_profiles; i++) {
+		auto &image = profiles[i]->do_convolve() ? to_convolve : model_image;
+		if (profile_cache[i].kept) {
+			add_region(image, profile_cache[i].image, profile_cache[i].region);
+		}
+		else {
+			add_region(image, stale_images[k], stale_regions[k]);
+			k++;
+		}
+	}
+
+	/*
+	 * Keep the new images while they fit. Otherwise they replace the least
+	 * recently used images, as long as these weren't used in this evaluation
+	 */
+	auto image_bytes = [](const Image &image) {
+		return image.size() * sizeof(double);
+	};
+	std::size_t kept_bytes = 0;
+	for (auto &entry: profile_cache) {
+		kept_bytes += entry.kept ? image_bytes(entry.image) : 0;
+	}
+	for (k = 0; k < n_stale; k++) {
+		auto new_bytes = image_bytes(stale_images[k]);
+		if (new_bytes > profile_cache_size) {
+			continue;
+		}
+		while (kept_bytes + new_bytes > profile_cache_size) {
+			auto lru = profile_cache.end();
+			for (auto it = profile_cache.begin(); it != profile_cache.end(); it++) {
+				if (it->kept && (lru == profile_cache.end() || it->last_used < lru->last_used)) {
+					lru = it;
+				}
+			}
+			if (lru == profile_cache.end() || lru->last_used == profile_cache_clock) {
+				break;
+			}
+			kept_bytes -= image_bytes(lru->image);
+			*lru = profile_cache_entry();
+		}
+		if (kept_bytes + new_bytes > profile_cache_size) {
+			break;
+		}
+		auto &entry = profile_cache[stale[k]];
+		entry.image = std::move(stale_images[k]);
+		entry.region = stale_regions[k];
+		entry.kept = true;
+		entry.parameter_changes = parameter_changes[stale[k]];
+		entry.last_used = profile_cache_clock;
+		kept_bytes += new_bytes;
+	}
 }
 
 Image Model::produce_image(const Mask &mask, const input_analysis &analysis,
-    Point &offset)
+    Point &offset, std::vector<Image> *derivatives)
 {
 	// Avoiding memory allocation if no convolution is needed
 	Image model_image{analysis.drawing_dims};
@@ -329,30 +697,46 @@ Image Model::produce_image(const Mask &mask, const input_analysis &analysis,
 		to_convolve = Image{analysis.drawing_dims};
 	}
 
-	for(auto &profile: this->profiles) {
-		profile->adjust_for_finesampling(finesampling);
-		if (profile->do_convolve()) {
-			profile->evaluate(to_convolve, mask,
-				{scale.first / finesampling, scale.second / finesampling},
-				analysis.psf_padding, magzero);
-		}
-		else {
-			profile->evaluate(model_image, mask,
-				{scale.first / finesampling, scale.second / finesampling},
-				analysis.psf_padding, magzero);
-		}
-	}
+	evaluate_profiles(model_image, to_convolve, mask, analysis, derivatives);
 
-	// Perform convolution if needed, then add back to the model image
+	// Perform convolution if needed, then add back to the model image.
+	// Derivatives of convolved profiles are convolved together with it,
+	// while the rest are only extended like the model image
 	offset = {0, 0};
 	if (analysis.convolution_required) {
-		to_convolve = ensure_convolver()->convolve(to_convolve, psf, mask, crop, offset);
+		std::vector<Image> convolved {std::move(to_convolve)};
+		std::vector<Image *> convolved_derivatives;
+		std::vector<Image *> other_derivatives;
+		if (derivatives) {
+			auto derivative = derivatives->begin();
+			for (auto &profile: profiles) {
+				auto n_parameters = profile->get_derivative_parameters().size();
+				for (std::size_t i = 0; i != n_parameters; i++, derivative++) {
+					if (profile->do_convolve()) {
+						convolved.push_back(std::move(*derivative));
+						convolved_derivatives.push_back(&*derivative);
+					}
+					else {
+						other_derivatives.push_back(&*derivative);
+					}
+				}
+			}
+		}
+		convolved = ensure_convolver()->convolve(convolved, psf, mask, crop, offset);
+		for (std::size_t i = 0; i != convolved_derivatives.size(); i++) {
+			*convolved_derivatives[i] = std::move(convolved[i + 1]);
+		}
+
 		// The result of the convolution might be bigger that the original,
 		// dependingo on user settings, so we need to account for that
-		if (to_convolve.getDimensions() != analysis.drawing_dims) {
-			model_image = model_image.extend(to_convolve.getDimensions(), offset);
+		auto &convolved_image = convolved.front();
+		if (convolved_image.getDimensions() != analysis.drawing_dims) {
+			model_image = model_image.extend(convolved_image.getDimensions(), offset);
+			for (auto derivative: other_derivatives) {
+				*derivative = derivative->extend(convolved_image.getDimensions(), offset);
+			}
 		}
-		model_image += to_convolve;
+		model_image += convolved_image;
 	}
 
 	/* Done! Good job :-) */
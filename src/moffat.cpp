@@ -48,13 +48,102 @@ namespace profit
  *
  * Reducing:
  *  r_factor = ((x/rscale)^{2+b} + (y/rscale)^{2+b})^{1/(2+b)}
+ *
+ * We calculate r_factor^2 directly, which for b = 0 doesn't need a square
+ * root, and specialise the evaluation function for common values of c
+ * (see radial_exponent).
+ */
+template <bool boxy, radial_exponent t>
+static
+double eval_function(double x, double y, double box, double rscale, double con)
+{
+	double r_factor2 = fixed_boxy_r2<boxy>(x, y, box) / (rscale * rscale);
+	return fixed_pow<t>(1 + r_factor2, -con);
+}
+
+/*
+ * The vectorised moffat evaluation function
  */
+template <bool boxy, radial_exponent t>
+struct moffat_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double rscale, double con) :
+			box(box), rscale(rscale), con(con) {}
+
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			auto r_factor2 = S::div(simd_boxy_r2<SIMD, FT, boxy>(x, y, box), S::set1(rscale * rscale));
+			return simd_fixed_pow<SIMD, FT, t>(S::add(S::set1(1.), r_factor2), -con);
+		}
+
+		double box, rscale, con;
+	};
+
+};
+
+template <bool boxy, radial_exponent t, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double rscale, double con)
+{
+	simd_evaluate<moffat_kernel<boxy, t>::template simd>(instruction_set, x, y, values, n, box, rscale, con);
+}
+
 double MoffatProfile::evaluate_at(double x, double y) const
 {
-	using std::pow;
-	double r = boxy_r(x, y);
-	double r_factor = r/rscale;
-	return pow(1 + r_factor*r_factor, -con);
+	return m_eval_function(x, y, box, rscale, con);
+}
+
+void MoffatProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, rscale, con);
+}
+
+void MoffatProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, rscale, con);
+}
+
+template <bool boxy, radial_exponent t>
+void MoffatProfile::init_eval_function() {
+	m_eval_function = eval_function<boxy, t>;
+	m_eval_many_function = eval_many_function<boxy, t, double>;
+	m_eval_many_float_function = eval_many_function<boxy, t, float>;
+}
+
+template <bool boxy>
+void MoffatProfile::init_eval_function(radial_exponent t) {
+	switch (t) {
+		case radial_exponent::quarter:      init_eval_function<boxy, radial_exponent::quarter>(); break;
+		case radial_exponent::half:         init_eval_function<boxy, radial_exponent::half>(); break;
+		case radial_exponent::one:          init_eval_function<boxy, radial_exponent::one>(); break;
+		case radial_exponent::three_halves: init_eval_function<boxy, radial_exponent::three_halves>(); break;
+		case radial_exponent::two:          init_eval_function<boxy, radial_exponent::two>(); break;
+		case radial_exponent::five_halves:  init_eval_function<boxy, radial_exponent::five_halves>(); break;
+		case radial_exponent::three:        init_eval_function<boxy, radial_exponent::three>(); break;
+		case radial_exponent::four:         init_eval_function<boxy, radial_exponent::four>(); break;
+		default:                            init_eval_function<boxy, radial_exponent::general>(); break;
+	}
+}
+
+void MoffatProfile::initial_calculations() {
+
+	RadialProfile::initial_calculations();
+
+	/* The evaluation functions are specialised for the shape of the profile */
+	if( shape_parameters_changed() ) {
+		auto t = get_radial_exponent(con);
+		if( box != 0 ) init_eval_function<true>(t);
+		else           init_eval_function<false>(t);
+	}
 }
 
 void MoffatProfile::validate() {
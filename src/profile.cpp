@@ -24,11 +24,15 @@
  * along with libprofit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <string>
 
 #include "profit/common.h"
 #include "profit/exceptions.h"
+#include "profit/model.h"
 #include "profit/profile.h"
 #include "profit/utils.h"
 
@@ -39,6 +43,7 @@ Profile::Profile(const Model &model, const std::string &name) :
 	model(model),
 	name(name),
 	convolve(false),
+	parameter_changes(0),
 	stats()
 {
 	register_parameter("convolve", convolve);
@@ -69,21 +74,140 @@ std::shared_ptr<ProfileStats> Profile::get_stats() const {
 void Profile::register_parameter(const char *name, bool &parameter)
 {
 	bool_parameters.insert({name, parameter});
+	changed_parameters[name] = true;
 }
 
 void Profile::register_parameter(const char *name, unsigned int &parameter)
 {
 	uint_parameters.insert({name, parameter});
+	changed_parameters[name] = true;
 }
 
 void Profile::register_parameter(const char *name, double &parameter)
 {
 	double_parameters.insert({name, parameter});
+	changed_parameters[name] = true;
+}
+
+bool Profile::parameter_changed(const char *name) const
+{
+	auto it = changed_parameters.find(name);
+	return it != changed_parameters.end() && it->second;
+}
+
+bool Profile::parameters_changed(std::initializer_list<const char *> excluded) const
+{
+	for (auto &changed: changed_parameters) {
+		if (!changed.second) {
+			continue;
+		}
+		bool is_excluded = false;
+		for (auto name: excluded) {
+			is_excluded = is_excluded || std::strcmp(name, changed.first.c_str()) == 0;
+		}
+		if (!is_excluded) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void Profile::parameter_changes_seen()
+{
+	for (auto &changed: changed_parameters) {
+		changed.second = false;
+	}
+}
+
+double Profile::get_double_parameter(const std::string &name) const
+{
+	return double_parameters.at(name).get();
+}
+
+double Profile::derivative_step(double value)
+{
+	return 1e-5 * std::max(1., std::abs(value));
+}
+
+void Profile::set_derivative_parameters(const std::vector<std::string> &parameters)
+{
+	for (auto &parameter: parameters) {
+		if (double_parameters.find(parameter) == double_parameters.end()) {
+			std::ostringstream os;
+			os << "Unknown double parameter in profile " << get_name() << ": " << parameter;
+			throw invalid_parameter(os.str());
+		}
+	}
+	derivative_parameters = parameters;
+}
+
+const std::vector<std::string> &Profile::get_derivative_parameters() const
+{
+	return derivative_parameters;
+}
+
+unsigned long Profile::get_parameter_changes() const
+{
+	return parameter_changes;
+}
+
+Image Profile::evaluate_footprint(const Dimensions &dims, Box &region, const Mask &mask,
+    const PixelScale &scale, const Point &offset, double magzero)
+{
+	region = Box{{0, 0}, dims};
+	Image image{dims};
+	evaluate(image, mask, scale, offset, magzero);
+	return image;
+}
+
+void Profile::evaluate_derivatives(Image &image, std::vector<Image> &derivatives,
+    const Mask &mask, const PixelScale &scale, const Point &offset, double magzero)
+{
+	evaluate(image, mask, scale, offset, magzero);
+
+	/*
+	 * Parameters are given to the profile as users would, so any quantities
+	 * derived from them are recalculated. The original value is restored
+	 * afterwards
+	 */
+	Image shifted_image{image.getDimensions()};
+	auto finesampling = model.get_finesampling();
+	for (std::size_t i = 0; i != derivative_parameters.size(); i++) {
+		auto &name = derivative_parameters[i];
+		double value = get_double_parameter(name);
+		double step = derivative_step(value);
+		for (double sign: {1., -1.}) {
+			parameter(name, value + sign * step);
+			adjust_for_finesampling(finesampling);
+			shifted_image.zero();
+			evaluate(shifted_image, mask, scale, offset, magzero);
+			shifted_image *= sign / (2 * step);
+			derivatives[i] += shifted_image;
+		}
+		parameter(name, value);
+		adjust_for_finesampling(finesampling);
+	}
+}
+
+/*
+ * Assigns val to parameter, recording whether its value actually changed,
+ * and counting the change
+ */
+template <typename T>
+void assign_parameter(T &parameter, T val, bool &changed, unsigned long &changes)
+{
+	if (!(parameter == val)) {
+		parameter = val;
+		changed = true;
+		changes++;
+	}
 }
 
 template <typename T>
 void set_parameter(
 	Profile::parameter_holder<T> &parameters,
+	std::map<std::string, bool> &changed_parameters,
+	unsigned long &parameter_changes,
 	const std::string &name,
 	const std::string &profile_name,
 	T val)
@@ -94,12 +218,14 @@ void set_parameter(
 		os << "Unknown " << tname << " parameter in profile " << profile_name << ": " << name;
 		throw invalid_parameter(os.str());
 	}
-	parameters.at(name).get() = val;
+	assign_parameter(parameters.at(name).get(), val, changed_parameters[name], parameter_changes);
 }
 
 template <typename T, typename Converter>
 bool set_parameter(
 	Profile::parameter_holder<T> &parameters,
+	std::map<std::string, bool> &changed_parameters,
+	unsigned long &parameter_changes,
 	const std::string &name,
 	const std::string &profile_name,
 	const std::string &val,
@@ -111,7 +237,7 @@ bool set_parameter(
 
 	try {
 		T bval = converter(val);
-		parameters.at(name).get() = bval;
+		assign_parameter(parameters.at(name).get(), bval, changed_parameters[name], parameter_changes);
 		return true;
 	} catch (const std::invalid_argument &e) {
 		UNUSED(e);
@@ -125,15 +251,15 @@ bool set_parameter(
 }
 
 void Profile::parameter(const std::string &name, bool val) {
-	set_parameter(bool_parameters, name, get_name(), val);
+	set_parameter(bool_parameters, changed_parameters, parameter_changes, name, get_name(), val);
 }
 
 void Profile::parameter(const std::string &name, double val) {
-	set_parameter(double_parameters, name, get_name(), val);
+	set_parameter(double_parameters, changed_parameters, parameter_changes, name, get_name(), val);
 }
 
 void Profile::parameter(const std::string &name, unsigned int val) {
-	set_parameter(uint_parameters, name, get_name(), val);
+	set_parameter(uint_parameters, changed_parameters, parameter_changes, name, get_name(), val);
 }
 
 void Profile::parameter(const std::string &param_spec)
@@ -149,9 +275,9 @@ void Profile::parameter(const std::string &param_spec)
 	auto &val = trim(parts[1]);
 
 	bool found = (
-		set_parameter(bool_parameters, pname, get_name(), val, [](const std::string &s) { return std::stoul(s, nullptr, 10); }) ||
-		set_parameter(uint_parameters, pname, get_name(), val, [](const std::string &s) { return stoui(s); }) ||
-		set_parameter(double_parameters, pname, get_name(), val, [](const std::string &s) { return std::stod(s); })
+		set_parameter(bool_parameters, changed_parameters, parameter_changes, pname, get_name(), val, [](const std::string &s) { return std::stoul(s, nullptr, 10); }) ||
+		set_parameter(uint_parameters, changed_parameters, parameter_changes, pname, get_name(), val, [](const std::string &s) { return stoui(s); }) ||
+		set_parameter(double_parameters, changed_parameters, parameter_changes, pname, get_name(), val, [](const std::string &s) { return std::stod(s); })
 	);
 
 	if (!found) {
@@ -152,11 +152,12 @@ void show_version(std::ostream &os) {
 	if (has_fftw()) {
 		os << "Yes ";
 		if (has_fftw_with_openmp()) {
-			os << "(with OpenMP)";
+			os << "(with OpenMP";
 		}
 		else {
-			os << "(without OpenMP)";
+			os << "(without OpenMP";
 		}
+		os << (has_fftw_float() ? ", with single precision)" : ", without single precision)");
 	}
 	else {
 		os << "No";
@@ -196,7 +197,7 @@ Options:
   -e <n>    FFTW plans created with n effort (more takes longer)
   -I <n>    SIMD Instruction set to use with brute-force convolver.
             0=auto (default), 1=none, 2=sse2, 3=avx.
-  -r        Reuse FFT-transformed PSF across evaluations (if -T fft)
+  -r        Reuse FFT-transformed PSF across evaluations (if -T fft[-float])
   -x        Image width. Defaults to 100
   -y        Image height. Defaults to 100
   -S <n>    Finesampling factor. Defaults to 1
@@ -213,8 +214,11 @@ The following convolver types are supported:
 
  * brute: A brute-force convolver
  * brute-old: An older, slower brute-force convolver (used only for comparisons)
+ * low-rank: A convolver using a low-rank separable approximation of the PSF
  * opencl: An OpenCL-based brute-force convolver
  * fft: An FFT-based convolver
+ * fft-float: An FFT-based convolver using single-precision FFTs
+ * fft-tiled: An FFT-based convolver working on cache-sized tiles
 
 Profiles should be specified as follows (parts between [] are optional):
 
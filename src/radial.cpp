@@ -27,9 +27,9 @@
 #include <algorithm>
 #include <cmath>
 #include <chrono>
+#include <limits>
 #include <map>
 #include <sstream>
-#include <tuple>
 #include <vector>
 
 #include "profit/common.h"
@@ -43,6 +43,20 @@
 namespace profit
 {
 
+radial_exponent get_radial_exponent(double exponent)
+{
+	exponent = std::abs(exponent);
+	if( almost_equals(exponent, 0.25) )      return radial_exponent::quarter;
+	else if( almost_equals(exponent, 0.5) )  return radial_exponent::half;
+	else if( almost_equals(exponent, 1) )    return radial_exponent::one;
+	else if( almost_equals(exponent, 1.5) )  return radial_exponent::three_halves;
+	else if( almost_equals(exponent, 2) )    return radial_exponent::two;
+	else if( almost_equals(exponent, 2.5) )  return radial_exponent::five_halves;
+	else if( almost_equals(exponent, 3) )    return radial_exponent::three;
+	else if( almost_equals(exponent, 4) )    return radial_exponent::four;
+	return radial_exponent::general;
+}
+
 inline
 void RadialProfile::_image_to_profile_coordinates(double x, double y, double &x_prof, double &y_prof) {
 	x -= this->_xcen;
@@ -52,90 +66,382 @@ void RadialProfile::_image_to_profile_coordinates(double x, double y, double &x_
 	y_prof /= this->axrat;
 }
 
-double RadialProfile::subsample_pixel(double x0, double x1, double y0, double y1,
-                                      unsigned int recur_level, unsigned int max_recursions,
-                                      unsigned int resolution) {
+/*
+ * A region of the image that is subsampled: either a pixel (at level 0) or a
+ * sub-pixel that needed further refinement at the previous level
+ */
+struct RadialProfile::subsampling_node {
+	double x0, x1, y0, y1;
+	unsigned int resolution;
+	unsigned int max_recursions;
+	/* The pixel (level 0) or node in the previous level this node refines */
+	unsigned int parent;
+	/* A second pixel receiving the value of this node (level 0), or no_pixel */
+	unsigned int mirror_pixel;
+	/*
+	 * Whether this node is the mirror image of the previous one in its level,
+	 * and reuses its refinement decisions instead of calculating its own
+	 */
+	bool mirrors_previous;
+	/* Where this node's sub-pixels start in the level buffers */
+	std::size_t points_offset;
+	std::size_t evals_offset;
+	/* The sum of the values of this node's sub-pixels */
+	double total;
+	/* The image pixel this node belongs to, and the fraction of it it covers */
+	unsigned int pixel;
+	double weight;
+};
+
+struct RadialProfile::integration_point {
+	unsigned int pixel;
+	double x, y;
+	double weight;
+	double value;
+};
+
+/*
+ * All the nodes subsampled at a given recursion level, their sub-pixels, and
+ * the profile coordinates at which they are evaluated
+ */
+template <typename FT>
+struct RadialProfile::subsampling_level {
+	std::vector<subsampling_node> nodes;
+	std::vector<double> xs;
+	std::vector<double> ys;
+	std::vector<char> refine;
+	std::vector<FT> x_profs;
+	std::vector<FT> y_profs;
+	std::vector<FT> vals;
+};
+
+template <typename FT>
+struct RadialProfile::evaluation_scratch {
+	/* Pixels of an image row that are evaluated without subsampling */
+	std::vector<unsigned int> direct_idxs;
+	std::vector<unsigned int> direct_mirror_idxs;
+	std::vector<FT> direct_x_profs;
+	std::vector<FT> direct_y_profs;
+	std::vector<FT> direct_vals;
+	/* Pixels of each image row that need subsampling */
+	std::vector<std::vector<subsampling_node>> subsampled_pixels;
+	/* One element per recursion level */
+	std::vector<subsampling_level<FT>> levels;
+	/* Integration points, when recorded; those of pixels evaluated directly go per tile first */
+	std::vector<std::vector<integration_point>> tile_integration_points;
+	std::vector<integration_point> integration_points;
+};
+
+/*
+ * The maximum number of nodes subsampled together at each recursion level
+ */
+static const std::size_t max_subsampling_nodes = 1024;
+
+/*
+ * Indicates the absence of a pixel index
+ */
+static const unsigned int no_pixel = std::numeric_limits<unsigned int>::max();
+
+/*
+ * Mirrored nodes share their refinement decisions only while the distance
+ * between the profile's centre and its closest symmetric placement is below
+ * this fraction of the size of their sub-pixels
+ */
+static const double refinement_symmetry_tolerance = 1e-2;
+
+template <typename FT>
+RadialProfile::evaluation_scratch<FT> &RadialProfile::thread_scratch()
+{
+	static thread_local evaluation_scratch<FT> scratch;
+	return scratch;
+}
+
+/*
+ * Runs f(first, last) over consecutive blocks of [0, n) in parallel
+ */
+template <typename Callable>
+static void omp_blocks_for(int threads, std::size_t n, std::size_t block_size, Callable &&f)
+{
+	auto n_blocks = (n + block_size - 1) / block_size;
+	omp_1d_for(threads, n_blocks, [&](unsigned int block) {
+		auto first = block * block_size;
+		f(first, std::min(n, first + block_size));
+	});
+}
 
+template <typename FT>
+void RadialProfile::prepare_subsampling_level(subsampling_level<FT> &level, unsigned int recur_level)
+{
 	using std::abs;
 
-	double xbin = (x1-x0) / resolution;
-	double ybin = (y1-y0) / resolution;
-	double half_xbin = xbin/2.;
-	double half_ybin = ybin/2.;
-	double total = 0;
-	double x_prof;
-	double y_prof;
+	/* Where each node's sub-pixels and evaluation points will go */
+	std::size_t n_points = 0;
+	std::size_t n_evals = 0;
+	for (auto &node: level.nodes) {
+		auto node_points = node.resolution * node.resolution;
+		bool tests = node.resolution > 1 && recur_level < node.max_recursions && !node.mirrors_previous;
+		node.points_offset = n_points;
+		node.evals_offset = n_evals;
+		n_points += node_points;
+		n_evals += tests ? 2 * node_points : node_points;
+	}
+
+	/*
+	 * Buffers are only resized; after the first few evaluations they already
+	 * have enough capacity and no memory is allocated.
+	 */
+	level.xs.resize(n_points);
+	level.ys.resize(n_points);
+	level.refine.resize(n_points);
+	level.x_profs.resize(n_evals);
+	level.y_profs.resize(n_evals);
+	level.vals.resize(n_evals);
+
+	/*
+	 * The middle X/Y value is used for each sub-pixel. When recursing we
+	 * additionally evaluate, for each sub-pixel, a test value on the next
+	 * sub-pixel along the profile's Y axis, which is used to decide whether
+	 * to refine it or not. Nodes mirroring their previous node don't need
+	 * these, as they reuse its decisions.
+	 */
+	omp_blocks_for(model.profile_omp_threads, level.nodes.size(), 16, [&](std::size_t first, std::size_t last) {
+		for (auto n = first; n < last; n++) {
+			auto &node = level.nodes[n];
+			auto resolution = node.resolution;
+			auto node_points = resolution * resolution;
+			bool tests = resolution > 1 && recur_level < node.max_recursions && !node.mirrors_previous;
+			double xbin = (node.x1 - node.x0) / resolution;
+			double ybin = (node.y1 - node.y0) / resolution;
+			double half_xbin = xbin/2.;
+			double half_ybin = ybin/2.;
+			double delta_y_prof = abs((-xbin*this->_sin_ang + ybin*this->_cos_ang)/this->axrat);
+
+			auto xs = level.xs.data() + node.points_offset;
+			auto ys = level.ys.data() + node.points_offset;
+			auto x_profs = level.x_profs.data() + node.evals_offset;
+			auto y_profs = level.y_profs.data() + node.evals_offset;
+			double x = node.x0;
+			unsigned int k = 0;
+			for (unsigned int i = 0; i < resolution; i++) {
+				x += half_xbin;
+				double y = node.y0;
+				for (unsigned int j = 0; j < resolution; j++, k++) {
+					y += half_ybin;
+					double x_prof, y_prof;
+					this->_image_to_profile_coordinates(x, y, x_prof, y_prof);
+					xs[k] = x;
+					ys[k] = y;
+					x_profs[k] = x_prof;
+					y_profs[k] = y_prof;
+					if( tests ) {
+						x_profs[node_points + k] = abs(x_prof);
+						y_profs[node_points + k] = abs(y_prof) + delta_y_prof;
+					}
+					y += half_ybin;
+				}
+				x += half_xbin;
+			}
+		}
+	});
+}
+
+template <typename FT>
+void RadialProfile::subsample_level(unsigned int recur_level)
+{
+	using std::abs;
 
-	bool recurse = resolution > 1 && recur_level < max_recursions;
+	/*
+	 * All the evaluation points of the nodes of this level are collected
+	 * in contiguous buffers and evaluated together in parallel
+	 */
+	auto &levels = thread_scratch<FT>().levels;
+	auto &level = levels[recur_level];
+	auto &nodes = level.nodes;
 
 #ifdef PROFIT_DEBUG
 	/* record how many sub-integrations we've done */
-	if( n_integrations.find(recur_level) != n_integrations.end() ) {
-		n_integrations[recur_level] += 1;
-	}
-	else {
-		n_integrations[recur_level] = 1;
-	}
+	n_integrations[recur_level] += nodes.size();
 #endif
 
-	/* The middle X/Y value is used for each pixel */
-	std::vector<std::tuple<double, double>> subsample_points;
-	double x = x0;
-
-	std::vector<unsigned int> idxs(resolution * resolution);
-	if( recurse ) {
-		for (unsigned int i = 0; i < resolution; i++) {
-			x += half_xbin;
-			double y = y0;
-			for (unsigned int j = 0; j < resolution; j++) {
-				y += half_ybin;
-
-				this->_image_to_profile_coordinates(x, y, x_prof, y_prof);
-				double subval = this->evaluate_at(x_prof, y_prof);
-
-				double delta_y_prof = (-xbin*this->_sin_ang + ybin*this->_cos_ang)/this->axrat;
-				double testval = this->evaluate_at(abs(x_prof), abs(y_prof) + abs(delta_y_prof));
-				if( abs(testval/subval - 1.0) > this->acc ) {
-					subsample_points.emplace_back(std::make_tuple(x, y));
+	prepare_subsampling_level(level, recur_level);
+	omp_blocks_for(model.profile_omp_threads, level.vals.size(), 1024, [&](std::size_t first, std::size_t last) {
+		this->_evaluate_many(level.x_profs.data() + first, level.y_profs.data() + first,
+		                     level.vals.data() + first, last - first);
+	});
+
+	/*
+	 * Add up the sub-pixels that don't need refinement. Nodes mirroring their
+	 * previous node refine the mirror images of its refined sub-pixels, so
+	 * they go in a second pass
+	 */
+	auto add_subpixels = [&](bool mirroring_nodes) {
+		omp_blocks_for(model.profile_omp_threads, nodes.size(), 64, [&](std::size_t first, std::size_t last) {
+			for (auto n = first; n < last; n++) {
+				auto &node = nodes[n];
+				if( node.mirrors_previous != mirroring_nodes ) {
+					continue;
+				}
+				auto node_points = node.resolution * node.resolution;
+				bool recurse = node.resolution > 1 && recur_level < node.max_recursions;
+				auto vals = level.vals.data() + node.evals_offset;
+				auto refine = level.refine.data() + node.points_offset;
+				const char *mirrored_refine = nullptr;
+				if( mirroring_nodes ) {
+					mirrored_refine = level.refine.data() + nodes[n - 1].points_offset + node_points - 1;
 				}
-				else {
+				double total = 0;
+				for (unsigned int k = 0; k < node_points; k++) {
+					double subval = vals[k];
+					refine[k] = false;
+					if( recurse ) {
+						if( mirroring_nodes ) {
+							refine[k] = *(mirrored_refine - k);
+						}
+						else {
+							double testval = vals[node_points + k];
+							refine[k] = abs(testval/subval - 1.0) > this->acc;
+						}
+						if( refine[k] ) {
+							continue;
+						}
+					}
 					total += subval;
 				}
-				y += half_ybin;
+				node.total = total;
 			}
+		});
+	};
+	add_subpixels(false);
+	if( std::any_of(nodes.begin(), nodes.end(), [](const subsampling_node &node) { return node.mirrors_previous; }) ) {
+		add_subpixels(true);
+	}
 
-			x += half_xbin;
+	if( record_integration_points ) {
+		auto &integration_points = thread_scratch<FT>().integration_points;
+		for (auto &node: nodes) {
+			auto node_points = node.resolution * node.resolution;
+			for (unsigned int k = 0; k < node_points; k++) {
+				if( !level.refine[node.points_offset + k] ) {
+					integration_points.push_back({node.pixel,
+					    level.xs[node.points_offset + k], level.ys[node.points_offset + k],
+					    node.weight / node_points, double(level.vals[node.evals_offset + k])});
+				}
+			}
 		}
 	}
-	else {
-		for (unsigned int i = 0; i < resolution; i++) {
-			x += half_xbin;
-			double y = y0;
-			for (unsigned int j = 0; j < resolution; j++) {
-				y += half_ybin;
-				this->_image_to_profile_coordinates(x, y, x_prof, y_prof);
-				total += this->evaluate_at(x_prof, y_prof);
-				y += half_ybin;
+
+	/*
+	 * The sub-pixels to refine, in order, become the nodes of the next level.
+	 * These are subsampled in chunks of bounded size to keep memory usage
+	 * under control, and their averaged values are added back to their
+	 * parents in the same order a depth-first subsampling would do it.
+	 * The children of mirroring nodes are kept next to each other, so they
+	 * can keep sharing their refinement decisions.
+	 * Growing the levels invalidates the references above.
+	 */
+	if( levels.size() < recur_level + 2 ) {
+		levels.resize(recur_level + 2);
+	}
+	auto subsample_children = [&]() {
+		subsample_level<FT>(recur_level + 1);
+		auto &parents = levels[recur_level].nodes;
+		auto &children = levels[recur_level + 1].nodes;
+		for (auto &child: children) {
+			parents[child.parent].total += child.total / (child.resolution * child.resolution);
+		}
+		children.clear();
+	};
+
+	levels[recur_level + 1].nodes.clear();
+	for (unsigned int n = 0; n < levels[recur_level].nodes.size(); n++) {
+		auto &current = levels[recur_level];
+		auto &children = levels[recur_level + 1].nodes;
+		auto node_points = current.nodes[n].resolution * current.nodes[n].resolution;
+		bool mirrored = n + 1 < current.nodes.size() && current.nodes[n + 1].mirrors_previous;
+		auto add_child = [&](unsigned int parent, unsigned int k, bool mirrors_previous) {
+			auto &node = current.nodes[parent];
+			double half_xbin = (node.x1 - node.x0) / node.resolution / 2.;
+			double half_ybin = (node.y1 - node.y0) / node.resolution / 2.;
+			double x = current.xs[node.points_offset + k];
+			double y = current.ys[node.points_offset + k];
+			children.push_back({x - half_xbin, x + half_xbin,
+			                    y - half_ybin, y + half_ybin,
+			                    node.resolution, node.max_recursions,
+			                    parent, no_pixel, false, 0, 0, 0,
+			                    node.pixel, node.weight / (node.resolution * node.resolution)});
+			if( mirrors_previous ) {
+				children.back().mirrors_previous = this->mirror_reuses_refinement(children.back());
 			}
-			x += half_xbin;
+		};
+		for (unsigned int k = 0; k < node_points; k++) {
+			if( !current.refine[current.nodes[n].points_offset + k] ) {
+				continue;
+			}
+			add_child(n, k, false);
+			if( mirrored ) {
+				add_child(n + 1, node_points - 1 - k, true);
+			}
+		}
+		if( mirrored ) {
+			n++;
+		}
+		if( children.size() >= max_subsampling_nodes ) {
+			subsample_children();
 		}
 	}
-
-	for(auto &point: subsample_points) {
-		double x = std::get<0>(point);
-		double y = std::get<1>(point);
-		total += this->subsample_pixel(x - half_xbin, x + half_xbin,
-		                               y - half_ybin, y + half_ybin,
-		                               recur_level + 1, max_recursions,
-		                               resolution);
+	if( !levels[recur_level + 1].nodes.empty() ) {
+		subsample_children();
 	}
+}
 
-	/* Average and return */
-	return total / (resolution * resolution);
+bool RadialProfile::mirror_reuses_refinement(const subsampling_node &node) const
+{
+	double xbin = (node.x1 - node.x0) / node.resolution;
+	double ybin = (node.y1 - node.y0) / node.resolution;
+	return _symmetry_offset_x <= xbin * refinement_symmetry_tolerance &&
+	       _symmetry_offset_y <= ybin * refinement_symmetry_tolerance;
+}
+
+bool RadialProfile::shape_parameters_changed() const
+{
+	return parameters_changed({"xcen", "ycen", "mag", "ang", "convolve", "force_cpu",
+	                           "tabulate", "tabulate_acc"});
 }
 
 void RadialProfile::initial_calculations() {
 
+	/*
+	 * Everything but Ie and the rotation coefficients depends only on the
+	 * shape of the profile, and is kept from previous evaluations otherwise
+	 */
+	if( shape_parameters_changed() ) {
+		shape_calculations();
+	}
+	this->_ie = std::pow(10, -0.4*(this->mag - magzero))/_lumtot;
+
+	/*
+	 * Get the rotation angle in radians and calculate the coefficients
+	 * that will fill the rotation matrix we'll use later to transform
+	 * from image coordinates into profile coordinates.
+	 *
+	 * In galfit the angle started from the Y image axis.
+	 */
+	if( parameter_changed("ang") ) {
+		double angrad = std::fmod(this->ang + 90, 360.) * M_PI / 180.;
+		this->_cos_ang = std::cos(angrad);
+		this->_sin_ang = std::sin(angrad);
+	}
+
+}
+
+void RadialProfile::shape_calculations() {
+
+	/* The parameters adjusted below start from the values requested by the user */
+	acc = requested_acc;
+	rscale_switch = requested_rscale_switch;
+	rscale_max = requested_rscale_max;
+	resolution = requested_resolution;
+
 	/*
 	 * get_rscale() is implemented by subclasses. It provides the translation
 	 * from profile-specific parameters into the common rscale concept used in
@@ -149,8 +455,7 @@ void RadialProfile::initial_calculations() {
 	 */
 	double b2 = this->box + 2;
 	double r_box = M_PI * b2 / (2 * beta(1/b2, 1/b2));
-	double lumtot = this->get_lumtot() * axrat / r_box;
-	this->_ie = std::pow(10, -0.4*(this->mag - magzero))/lumtot;
+	this->_lumtot = this->get_lumtot() * axrat / r_box;
 
 	/*
 	 * Optionally adjust the user-given rscale_switch and resolution parameters
@@ -184,18 +489,6 @@ void RadialProfile::initial_calculations() {
 		acc = adjust_acc(acc);
 
 	}
-
-	/*
-	 * Get the rotation angle in radians and calculate the coefficients
-	 * that will fill the rotation matrix we'll use later to transform
-	 * from image coordinates into profile coordinates.
-	 *
-	 * In galfit the angle started from the Y image axis.
-	 */
-	double angrad = std::fmod(this->ang + 90, 360.) * M_PI / 180.;
-	this->_cos_ang = std::cos(angrad);
-	this->_sin_ang = std::sin(angrad);
-
 }
 
 /**
@@ -211,6 +504,9 @@ void RadialProfile::validate() {
 	if ( box <= -2 ) {
 		throw invalid_parameter("box <= -2, must have box > -2");
 	}
+	if ( tabulate && tabulate_acc <= 0 ) {
+		throw invalid_parameter("tabulate_acc <= 0, must have tabulate_acc > 0");
+	}
 }
 
 /**
@@ -226,6 +522,313 @@ double RadialProfile::adjust_acc(double acc)
 	return acc;
 }
 
+double RadialProfile::get_rscale_edge()
+{
+	return 0;
+}
+
+void RadialProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set /*instruction_set*/) const
+{
+	for (std::size_t i = 0; i < n; i++) {
+		values[i] = this->evaluate_at(x[i], y[i]);
+	}
+}
+
+void RadialProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set /*instruction_set*/) const
+{
+	for (std::size_t i = 0; i < n; i++) {
+		values[i] = float(this->evaluate_at(x[i], y[i]));
+	}
+}
+
+/*
+ * The interpolated value at position `t` of a table (measured in segments
+ * from its start), or NaN if `t` falls outside the table or on an invalid
+ * segment
+ */
+static inline
+double tabulated_log_value(double t, std::size_t n_segments, const double *coeffs, const char *valid)
+{
+	if( !(t >= 0 && t < n_segments) ) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	auto segment = static_cast<std::size_t>(t);
+	if( !valid[segment] ) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+	t -= segment;
+	const double *c = coeffs + 4 * segment;
+	return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+}
+
+double RadialProfile::max_evaluation_radius(const Dimensions &dims, const PixelScale &scale)
+{
+	/*
+	 * The farthest image corner (or rscale_max, or the profile's edge), plus
+	 * the distance at which the subsampling test points are taken
+	 */
+	double r_max = 0;
+	for (double x: {0., dims.x * scale.first}) {
+		for (double y: {0., dims.y * scale.second}) {
+			double x_prof, y_prof;
+			_image_to_profile_coordinates(x, y, x_prof, y_prof);
+			r_max = std::max(r_max, std::sqrt(x_prof * x_prof + y_prof * y_prof));
+		}
+	}
+	double pixel_diagonal = std::sqrt(scale.first * scale.first + scale.second * scale.second) / axrat;
+	r_max += pixel_diagonal;
+	if( rscale_max > 0 ) {
+		r_max = std::min(r_max, rscale_max * rscale + pixel_diagonal);
+	}
+	double rscale_edge = get_rscale_edge();
+	if( rscale_edge > 0 ) {
+		r_max = std::min(r_max, rscale_edge * rscale);
+	}
+	return r_max;
+}
+
+void RadialProfile::build_table(const Dimensions &dims, const PixelScale &scale)
+{
+	using std::abs;
+	using std::exp;
+	using std::log;
+
+	table.enabled = false;
+	if( !tabulate || box != 0 ) {
+		return;
+	}
+
+	/*
+	 * The table covers from a tiny fraction of rscale up to the largest
+	 * radius the profile is evaluated at. Radii outside this range are
+	 * evaluated directly.
+	 */
+	double r_max = max_evaluation_radius(dims, scale);
+	double r_min = rscale * 1e-4;
+	if( !(r_max > r_min) ) {
+		return;
+	}
+
+	/*
+	 * Knots are evenly spaced in log(r), starting with 32 per decade.
+	 * Each round we build the spline and check its relative error at a
+	 * quarter, half and three quarters of each segment; if it's not good
+	 * enough everywhere the middle points become new knots and we try
+	 * again, and the quarter points become the middle points of the new
+	 * segments. Refinement is bounded though, so some segments might end up
+	 * being invalid.
+	 */
+	const std::size_t max_segments = 1 << 14;
+	double log_r_min = log(r_min);
+	double log_r_max = log(r_max);
+	auto n = static_cast<std::size_t>(std::max(4., std::ceil((log_r_max - log_r_min) / log(10.) * 32)));
+	double h = (log_r_max - log_r_min) / n;
+
+	/* Values are positive everywhere on the table, except maybe at the edge */
+	const double invalid_log_value = -746;
+	auto log_value_at = [&](double log_r) {
+		double value = this->evaluate_at(exp(log_r), 0);
+		if( value > 0 && std::isfinite(value) ) {
+			return log(value);
+		}
+		return invalid_log_value;
+	};
+
+	auto &log_values = table.log_values;
+	auto &mid_log_values = table.mid_log_values;
+	auto &quarter_log_values = table.quarter_log_values;
+	auto &M = table.second_derivatives;
+	auto &cp = table.scratch;
+	auto &valid = table.valid;
+	log_values.resize(n + 1);
+	for (std::size_t i = 0; i <= n; i++) {
+		log_values[i] = log_value_at(log_r_min + i * h);
+	}
+	mid_log_values.resize(n);
+	for (std::size_t i = 0; i < n; i++) {
+		mid_log_values[i] = log_value_at(log_r_min + (i + 0.5) * h);
+	}
+
+	auto prev_n_invalid = std::numeric_limits<std::size_t>::max();
+	while( true ) {
+
+		/*
+		 * Solve for the second derivatives of the spline using "not-a-knot"
+		 * end conditions, which on an even grid reduce the first and last
+		 * equations to 6 * M[1] = d[1] and 6 * M[n-1] = d[n-1]
+		 */
+		M.resize(n + 1);
+		cp.resize(n + 1);
+		double d_factor = 6 / (h * h);
+		auto d = [&](std::size_t i) {
+			return d_factor * (log_values[i + 1] - 2 * log_values[i] + log_values[i - 1]);
+		};
+		cp[1] = 0;
+		M[1] = d(1) / 6;
+		for (std::size_t i = 2; i < n; i++) {
+			double a = (i == n - 1) ? 0 : 1;
+			double b = (i == n - 1) ? 6 : 4;
+			double m = b - a * cp[i - 1];
+			cp[i] = 1 / m;
+			M[i] = (d(i) - a * M[i - 1]) / m;
+		}
+		for (std::size_t i = n - 2; i >= 1; i--) {
+			M[i] -= cp[i] * M[i + 1];
+		}
+		M[0] = 2 * M[1] - M[2];
+		M[n] = 2 * M[n - 1] - M[n - 2];
+
+		/* The spline on segment i at t = (log(r) - log(r_i)) / h */
+		double A = h * h / 6;
+		auto interpolated = [&](std::size_t i, double t) {
+			return (1 - t) * log_values[i] + t * log_values[i + 1] -
+			       A * t * (1 - t) * ((2 - t) * M[i] + (1 + t) * M[i + 1]);
+		};
+		auto within_acc = [&](double interpolated, double log_value) {
+			return log_value != invalid_log_value &&
+			       abs(std::expm1(interpolated - log_value)) <= tabulate_acc;
+		};
+
+		/* Check each segment at its quarter points */
+		quarter_log_values.resize(2 * n);
+		valid.resize(n);
+		std::size_t n_invalid = 0;
+		for (std::size_t i = 0; i < n; i++) {
+			quarter_log_values[2 * i] = log_value_at(log_r_min + (i + 0.25) * h);
+			quarter_log_values[2 * i + 1] = log_value_at(log_r_min + (i + 0.75) * h);
+			valid[i] = log_values[i] != invalid_log_value &&
+			           log_values[i + 1] != invalid_log_value &&
+			           within_acc(interpolated(i, 0.25), quarter_log_values[2 * i]) &&
+			           within_acc(interpolated(i, 0.5), mid_log_values[i]) &&
+			           within_acc(interpolated(i, 0.75), quarter_log_values[2 * i + 1]);
+			n_invalid += valid[i] ? 0 : 1;
+		}
+
+		/*
+		 * Refinement doesn't help near singularities (e.g., the edge of
+		 * truncated profiles), where the same number of segments keeps
+		 * failing regardless of their size
+		 */
+		if( n_invalid == 0 || n_invalid >= prev_n_invalid || 2 * n > max_segments ) {
+			break;
+		}
+		prev_n_invalid = n_invalid;
+
+		/* Middle points become knots, and quarter points middle points */
+		log_values.resize(2 * n + 1);
+		for (std::size_t i = n; i > 0; i--) {
+			log_values[2 * i] = log_values[i];
+			log_values[2 * i - 1] = mid_log_values[i - 1];
+		}
+		mid_log_values.swap(quarter_log_values);
+		n *= 2;
+		h /= 2;
+	}
+
+	/* Write down each segment's polynomial on t = (log(r) - log(r_i)) / h */
+	double A = h * h / 6;
+	table.coeffs.resize(4 * n);
+	for (std::size_t i = 0; i < n; i++) {
+		double *c = table.coeffs.data() + 4 * i;
+		c[0] = log_values[i];
+		c[1] = log_values[i + 1] - log_values[i] - A * (2 * M[i] + M[i + 1]);
+		c[2] = 3 * A * M[i];
+		c[3] = A * (M[i + 1] - M[i]);
+	}
+	table.log_r_min = log_r_min;
+	table.inv_h = 1 / h;
+	table.n_segments = n;
+	table.enabled = true;
+}
+
+/*
+ * Vectorised kernels for the logarithm of the radius and the exponential
+ * used around table lookups. The latter ignores its second argument
+ */
+template <simd_instruction_set SIMD, typename FT>
+struct log_radius_kernel {
+	typedef simd_traits<SIMD, FT> S;
+	typedef typename S::vector_type vector_type;
+
+	vector_type operator()(vector_type x, vector_type y) const
+	{
+		return S::mul(S::set1(0.5), simd_log<SIMD, FT>(S::add(S::mul(x, x), S::mul(y, y))));
+	}
+};
+
+template <simd_instruction_set SIMD, typename FT>
+struct exp_kernel {
+	typedef simd_traits<SIMD, FT> S;
+	typedef typename S::vector_type vector_type;
+
+	vector_type operator()(vector_type x, vector_type /*y*/) const
+	{
+		return simd_exp<SIMD, FT>(x);
+	}
+};
+
+template <typename FT>
+void RadialProfile::evaluate_tabulated(const FT *x, const FT *y, FT *values, std::size_t n,
+                                       simd_instruction_set instruction_set) const
+{
+	/*
+	 * log(r) = log(r^2) / 2 saves us the square root. When possible the
+	 * logarithms and exponentials are vectorised, and only the lookups
+	 * themselves are scalar; values holds log(r), then log(value).
+	 * Points not covered by the table are evaluated directly
+	 */
+	bool vectorised = instruction_set != NONE && has_simd_math(instruction_set);
+	if( vectorised ) {
+		simd_evaluate<log_radius_kernel>(instruction_set, x, y, values, n);
+	}
+	else {
+		for (std::size_t i = 0; i < n; i++) {
+			double x_i = x[i];
+			double y_i = y[i];
+			values[i] = FT(std::log(x_i * x_i + y_i * y_i) / 2);
+		}
+	}
+
+	for (std::size_t i = 0; i < n; i++) {
+		double t = (values[i] - table.log_r_min) * table.inv_h;
+		values[i] = FT(tabulated_log_value(t, table.n_segments, table.coeffs.data(), table.valid.data()));
+	}
+
+	if( vectorised ) {
+		simd_evaluate<exp_kernel>(instruction_set, values, values, values, n);
+	}
+	else {
+		for (std::size_t i = 0; i < n; i++) {
+			values[i] = FT(std::exp(double(values[i])));
+		}
+	}
+
+	/* NaNs propagate through exp */
+	for (std::size_t i = 0; i < n; i++) {
+		if( std::isnan(values[i]) ) {
+			values[i] = FT(this->evaluate_at(x[i], y[i]));
+		}
+	}
+}
+
+template <typename FT>
+void RadialProfile::_evaluate_many(const FT *x, const FT *y, FT *values, std::size_t n) const
+{
+	auto instruction_set = model.get_instruction_set();
+	if( table.enabled ) {
+		evaluate_tabulated(x, y, values, n, instruction_set);
+		return;
+	}
+
+	if( instruction_set == NONE || !has_simd_math(instruction_set) ) {
+		RadialProfile::evaluate_many(x, y, values, n, instruction_set);
+		return;
+	}
+	this->evaluate_many(x, y, values, n, instruction_set);
+}
+
 void RadialProfile::subsampling_params(double  /*x*/, double  /*y*/,
                                        unsigned int &resolution,
                                        unsigned int &max_recursions) {
@@ -233,11 +836,19 @@ void RadialProfile::subsampling_params(double  /*x*/, double  /*y*/,
 	max_recursions = this->max_recursions;
 }
 
+void RadialProfile::precalculated_pixels(const Dimensions & /*dims*/, const PixelScale & /*scale*/,
+                                         std::vector<std::pair<unsigned int, double>> & /*values*/)
+{
+}
+
+void RadialProfile::prepare_evaluation(double /*r_max*/)
+{
+}
+
 /**
  * The main profile evaluation function
  */
-void RadialProfile::evaluate(Image &image, const Mask &mask, const PixelScale &scale,
-    const Point &offset, double magzero)
+void RadialProfile::start_evaluation(const PixelScale &scale, const Point &offset, double magzero)
 {
 	this->magzero = magzero;
 
@@ -249,6 +860,7 @@ void RadialProfile::evaluate(Image &image, const Mask &mask, const PixelScale &s
 	 * list of values around every method call.
 	 */
 	this->initial_calculations();
+	this->parameter_changes_seen();
 
 	// Adjust the center of our profile for the given offset of the image origin
 	_xcen = xcen + offset.x * scale.first;
@@ -258,17 +870,32 @@ void RadialProfile::evaluate(Image &image, const Mask &mask, const PixelScale &s
 #ifdef PROFIT_DEBUG
 	n_integrations.clear();
 #endif /* PROFIT_DEBUG */
+}
+
+void RadialProfile::evaluate(Image &image, const Mask &mask, const PixelScale &scale,
+    const Point &offset, double magzero)
+{
+	start_evaluation(scale, offset, magzero);
+
+	auto evaluate_on_cpu = [&]() {
+		if( model.get_single_precision() && !record_integration_points ) {
+			evaluate_cpu<float>(image, mask, scale);
+		}
+		else {
+			evaluate_cpu<double>(image, mask, scale);
+		}
+	};
 
 #ifndef PROFIT_OPENCL
-	evaluate_cpu(image, mask, scale);
+	evaluate_on_cpu();
 #else
 	/*
 	 * We fallback to the CPU implementation if no OpenCL context has been
 	 * given, or if there is no OpenCL kernel implementing the profile
 	 */
 	auto env = OpenCLEnvImpl::fromOpenCLEnvPtr(model.get_opencl_env());
-	if( force_cpu || !env || !supports_opencl() ) {
-		evaluate_cpu(image, mask, scale);
+	if( force_cpu || !env || !supports_opencl() || record_integration_points ) {
+		evaluate_on_cpu();
 		return;
 	}
 
@@ -288,59 +915,543 @@ void RadialProfile::evaluate(Image &image, const Mask &mask, const PixelScale &s
 
 }
 
+/* The bounding box of the non-empty spans of a footprint, if any */
+static Box footprint_bounding_box(const std::vector<std::pair<unsigned int, unsigned int>> &spans)
+{
+	auto height = static_cast<unsigned int>(spans.size());
+	unsigned int first_row = height, last_row = 0;
+	unsigned int first_col = std::numeric_limits<unsigned int>::max(), last_col = 0;
+	for (unsigned int j = 0; j < height; j++) {
+		if( spans[j].first == spans[j].second ) {
+			continue;
+		}
+		first_row = std::min(first_row, j);
+		last_row = j + 1;
+		first_col = std::min(first_col, spans[j].first);
+		last_col = std::max(last_col, spans[j].second);
+	}
+	if( first_row >= last_row ) {
+		return Box();
+	}
+	return Box{{first_col, first_row}, {last_col, last_row}};
+}
+
+Image RadialProfile::evaluate_footprint(const Dimensions &dims, Box &region, const Mask &mask,
+    const PixelScale &scale, const Point &offset, double magzero)
+{
+#ifdef PROFIT_OPENCL
+	/* OpenCL kernels evaluate whole images */
+	auto env = OpenCLEnvImpl::fromOpenCLEnvPtr(model.get_opencl_env());
+	if( !force_cpu && env && supports_opencl() && !record_integration_points ) {
+		return Profile::evaluate_footprint(dims, region, mask, scale, offset, magzero);
+	}
+#endif /* PROFIT_OPENCL */
+
+	start_evaluation(scale, offset, magzero);
+	region = footprint_bounding_box(footprint(dims, scale));
+	Image image{region.second - region.first};
+	if( model.get_single_precision() && !record_integration_points ) {
+		evaluate_cpu<float>(image, region, dims, mask, scale);
+	}
+	else {
+		evaluate_cpu<double>(image, region, dims, mask, scale);
+	}
+	return image;
+}
+
+void RadialProfile::evaluate_derivatives(Image &image, std::vector<Image> &derivatives,
+    const Mask &mask, const PixelScale &scale, const Point &offset, double magzero)
+{
+	/* Evaluate normally, recording the integration points */
+	auto &points = thread_scratch<double>().integration_points;
+	points.clear();
+	record_integration_points = true;
+	try {
+		evaluate(image, mask, scale, offset, magzero);
+	} catch (...) {
+		record_integration_points = false;
+		throw;
+	}
+	record_integration_points = false;
+
+	auto &parameters = get_derivative_parameters();
+	for (std::size_t i = 0; i != parameters.size(); i++) {
+		auto &name = parameters[i];
+		auto &derivative = derivatives[i];
+
+		/* Ie = 10^(-0.4 * (mag - magzero)) / lumtot */
+		if( name == "mag" ) {
+			double factor = -0.4 * std::log(10.) * get_pixel_scale(scale);
+			for (auto &point: points) {
+				derivative[point.pixel] += factor * point.weight * point.value;
+			}
+			continue;
+		}
+
+		double value = get_double_parameter(name);
+		double step = derivative_step(value);
+		parameter(name, value + step);
+		add_integration_points(derivative, points, scale, offset, 1 / (2 * step));
+		parameter(name, value - step);
+		add_integration_points(derivative, points, scale, offset, -1 / (2 * step));
+		parameter(name, value);
+		initial_calculations();
+		parameter_changes_seen();
+		_xcen = xcen + offset.x * scale.first;
+		_ycen = ycen + offset.y * scale.second;
+	}
+}
+
+void RadialProfile::add_integration_points(Image &image, const std::vector<integration_point> &points,
+    const PixelScale &scale, const Point &offset, double factor)
+{
+	initial_calculations();
+	parameter_changes_seen();
+	_xcen = xcen + offset.x * scale.first;
+	_ycen = ycen + offset.y * scale.second;
+	factor *= get_pixel_scale(scale);
+
+	auto n = points.size();
+	std::vector<double> x_profs(n), y_profs(n), values(n);
+	omp_blocks_for(model.profile_omp_threads, n, 1024, [&](std::size_t first, std::size_t last) {
+		for (auto k = first; k < last; k++) {
+			this->_image_to_profile_coordinates(points[k].x, points[k].y, x_profs[k], y_profs[k]);
+		}
+		this->_evaluate_many(x_profs.data() + first, y_profs.data() + first,
+		                     values.data() + first, last - first);
+	});
+	for (std::size_t k = 0; k < n; k++) {
+		image[points[k].pixel] += factor * points[k].weight * values[k];
+	}
+}
+
+std::vector<RadialProfile::pixel_span> RadialProfile::footprint(const Dimensions &dims, const PixelScale &scale)
+{
+	auto width = dims.x;
+	auto height = dims.y;
+
+	/*
+	 * Pixels are evaluated only if their centers lie within rscale_max, so
+	 * that radius defines our footprint. Truncated profiles are zero beyond
+	 * their edge, but pixels whose centers are outside the edge might still
+	 * be sub-sampled, so we extend it by half a pixel diagonal.
+	 * The edge is given in terms of the boxy radius, so we also need to
+	 * translate it into the (larger or equal) euclidean radius that contains it.
+	 */
+	double radius = std::numeric_limits<double>::infinity();
+	if( rscale_max > 0 ) {
+		radius = rscale_max * rscale;
+	}
+	double rscale_edge = get_rscale_edge();
+	if( rscale_edge > 0 ) {
+		double box_plus_2 = box + 2;
+		double edge = rscale_edge * rscale * std::max(1., std::pow(2., 0.5 - 1 / box_plus_2));
+		edge += std::sqrt(scale.first * scale.first + scale.second * scale.second) / 2 / axrat;
+		radius = std::min(radius, edge);
+	}
+
+	if( std::isinf(radius) ) {
+		return std::vector<pixel_span>(height, pixel_span{0, width});
+	}
+
+	/*
+	 * For each row we solve the equation of the rotated ellipse
+	 * x_prof^2 + y_prof^2 = radius^2 for the image x coordinate. With
+	 * dx = x - xcen and dy = y - ycen this gives A*dx^2 + B*dx + C = 0, where:
+	 *
+	 *   A = cos^2 + sin^2/axrat^2
+	 *   B = 2 * dy * sin * cos * (1 - 1/axrat^2)
+	 *   C = dy^2 * (sin^2 + cos^2/axrat^2) - radius^2
+	 *
+	 * We are a bit generous with the radius and the resulting x limits
+	 * to avoid dropping pixels due to rounding errors; the exact inclusion
+	 * test still happens per pixel.
+	 */
+	radius *= 1 + 1e-6;
+	double cos2 = _cos_ang * _cos_ang;
+	double sin2 = _sin_ang * _sin_ang;
+	double inv_axrat2 = 1 / (axrat * axrat);
+	double A = cos2 + sin2 * inv_axrat2;
+	double B_factor = 2 * _sin_ang * _cos_ang * (1 - inv_axrat2);
+	double C_factor = sin2 + cos2 * inv_axrat2;
+	double half_xbin = scale.first / 2;
+	double half_ybin = scale.second / 2;
+
+	std::vector<pixel_span> spans(height, pixel_span{0, 0});
+	for (unsigned int j = 0; j < height; j++) {
+		double dy = half_ybin + j * scale.second - _ycen;
+		double B = B_factor * dy;
+		double C = C_factor * dy * dy - radius * radius;
+		double discriminant = B * B - 4 * A * C;
+		if( discriminant < 0 ) {
+			continue;
+		}
+		double sqrt_disc = std::sqrt(discriminant);
+		double x0 = _xcen + (-B - sqrt_disc) / (2 * A);
+		double x1 = _xcen + (-B + sqrt_disc) / (2 * A);
+		double i0 = std::floor((x0 - half_xbin) / scale.first);
+		double i1 = std::ceil((x1 - half_xbin) / scale.first) + 1;
+		i0 = std::max(0., std::min(double(width), i0));
+		i1 = std::max(0., std::min(double(width), i1));
+		spans[j] = {static_cast<unsigned int>(i0), static_cast<unsigned int>(i1)};
+	}
+
+	return spans;
+}
+
+template <typename FT>
 void RadialProfile::evaluate_cpu(Image &image, const Mask &mask, const PixelScale &scale)
+{
+	auto dims = image.getDimensions();
+	evaluate_cpu<FT>(image, Box{{0, 0}, dims}, dims, mask, scale);
+}
+
+template <typename FT>
+void RadialProfile::evaluate_cpu(Image &image, const Box &region, const Dimensions &dims,
+    const Mask &mask, const PixelScale &scale)
 {
 	double half_xbin = scale.first/2.;
 	double half_ybin = scale.second/2.;
 
-	auto width = image.getWidth();
-	auto height = image.getHeight();
+	auto width = dims.x;
+	auto height = dims.y;
 	double flux_scale = this->get_pixel_scale(scale);
 
 	/*
-	 * Evaluate the profile at each pixel independently
+	 * Find out which pixels are actually covered by this profile.
+	 * Only those are evaluated.
+	 */
+	auto spans = footprint(dims, scale);
+	auto bounding_box = footprint_bounding_box(spans);
+	if( bounding_box.empty() ) {
+		return;
+	}
+	unsigned int first_col = bounding_box.first.x, last_col = bounding_box.second.x;
+	unsigned int first_row = bounding_box.first.y, last_row = bounding_box.second.y;
+
+	prepare_evaluation(max_evaluation_radius(dims, scale));
+
+	/*
+	 * When recording integration points every point is evaluated directly,
+	 * so no table or precalculated values are used
 	 */
-	omp_2d_for(model.omp_threads, width, height, [&](unsigned int i, unsigned int j) {
+	if( record_integration_points ) {
+		table.enabled = false;
+	}
+	else {
+		build_table(dims, scale);
+	}
 
-		/* We were instructed to ignore this pixel */
-		if( mask && !mask[i + j * width] ) {
-			return;
+	/* Subclasses might already know the values of some of the pixels */
+	precalculated_values.clear();
+	if( !record_integration_points ) {
+		precalculated_pixels(dims, scale, precalculated_values);
+	}
+	auto find_precalculated_value = [&](unsigned int pixel, double &value) {
+		for (auto &precalculated: precalculated_values) {
+			if( precalculated.first == pixel ) {
+				value = precalculated.second;
+				return true;
+			}
 		}
+		return false;
+	};
 
-		double x_prof;
-		double y_prof;
-		double r_prof;
-		double y = half_ybin + j * scale.second;
-		double x = half_xbin + i * scale.first;
-		this->_image_to_profile_coordinates(x, y, x_prof, y_prof);
+	/*
+	 * Radial profiles are point-symmetric about their centre. When it falls
+	 * on a pixel centre or corner pixel (i, j) is the mirror image of pixel
+	 * (mirror_i - i, mirror_j - j), so only one pixel of each pair (the first
+	 * in row-major order) is evaluated, and its value added to both.
+	 * Pixels whose mirror isn't evaluated in this image still use the mirror's
+	 * coordinates, so the results don't depend on the image's extent.
+	 * When the centre is only close to such a placement both pixels are
+	 * evaluated, but the subsampling of the second reuses the refinement
+	 * decisions taken for the first one, as long as they remain valid.
+	 */
+	double mirror_x = 2 * _xcen / scale.first - 1;
+	double mirror_y = 2 * _ycen / scale.second - 1;
+	double mirror_i = std::round(mirror_x);
+	double mirror_j = std::round(mirror_y);
+	_symmetry_offset_x = std::abs(mirror_x - mirror_i) * scale.first / 2;
+	_symmetry_offset_y = std::abs(mirror_y - mirror_j) * scale.second / 2;
+	bool symmetric = !record_integration_points &&
+	                 std::abs(mirror_i) < (1 << 30) && std::abs(mirror_j) < (1 << 30);
+	bool mirror_values = symmetric && _symmetry_offset_x == 0 && _symmetry_offset_y == 0;
+	bool share_refinement = symmetric && !mirror_values &&
+	                        _symmetry_offset_x <= scale.first * refinement_symmetry_tolerance &&
+	                        _symmetry_offset_y <= scale.second * refinement_symmetry_tolerance;
+	auto is_evaluated = [&](double i, double j) {
+		if( j < 0 || j >= height ) {
+			return false;
+		}
+		auto span = spans[static_cast<unsigned int>(j)];
+		return i >= span.first && i < span.second;
+	};
 
-		/*
-		 * Check whether we need further refinement.
-		 * TODO: the radius calculation doesn't take into account boxing
-		 */
-		r_prof = std::sqrt(x_prof*x_prof + y_prof*y_prof);
-		double pixel_val;
-		if( this->rscale_max > 0 && r_prof/this->rscale > this->rscale_max ) {
-			pixel_val = 0.;
+	/*
+	 * Only the runs of pixels not masked out are visited; without a mask
+	 * whole rows are
+	 */
+	const MaskSpans::span full_row{0, width};
+	const MaskSpans no_spans;
+	const auto &mask_spans = mask ? mask.spans() : no_spans;
+	auto row_runs = [&](unsigned int j) {
+		if( mask ) {
+			return mask_spans.row(j);
 		}
-		else if( this->rough || r_prof/this->rscale > this->rscale_switch ) {
-			pixel_val = this->evaluate_at(x_prof, y_prof);
+		return MaskSpans::row_spans(&full_row, &full_row + 1);
+	};
+
+	/* Pixels are indexed in terms of the whole image, not of the region */
+	bool whole_image = region.first == Point{0, 0} && region.second == dims;
+	auto region_width = region.second.x - region.first.x;
+	auto region_pixel = [&](unsigned int pixel) {
+		if( whole_image ) {
+			return pixel;
 		}
-		else {
+		return (pixel % width - region.first.x) + (pixel / width - region.first.y) * region_width;
+	};
+	auto add_value = [&](unsigned int pixel, unsigned int mirror, double value) {
+		image[region_pixel(pixel)] += flux_scale * value;
+		if( mirror != no_pixel ) {
+			image[region_pixel(mirror)] += flux_scale * value;
+		}
+	};
 
-			unsigned int ss_resolution;
-			unsigned int ss_max_recursions;
-			this->subsampling_params(x, y, ss_resolution, ss_max_recursions);
+	/*
+	 * Evaluate the profile on each tile of the footprint's bounding box
+	 * independently. Pixels that don't need subsampling are collected and
+	 * evaluated together at the end of the tile, while those that do are
+	 * collected and subsampled together afterwards.
+	 *
+	 * Tiles entirely within rscale_switch only need their pixels classified,
+	 * while the rest evaluate most of theirs, so they are scheduled first
+	 */
+	const unsigned int tile_size = 32;
+	unsigned int tile_cols = (last_col - first_col + tile_size - 1) / tile_size;
+	unsigned int tile_rows = (last_row - first_row + tile_size - 1) / tile_size;
+	auto tile_cost = [&](const grid_tile &tile) {
+		double n_pixels = 0;
+		for (unsigned int j = tile.j0; j < tile.j1; j++) {
+			auto span = spans[j];
+			for (auto &run: row_runs(j)) {
+				auto i0 = std::max({tile.i0, span.first, run.first});
+				auto i1 = std::min({tile.i1, span.second, run.second});
+				n_pixels += i1 > i0 ? i1 - i0 : 0;
+			}
+		}
+		if( this->rough ) {
+			return n_pixels;
+		}
+		double max_distance = 0;
+		for (double x: {tile.i0 * scale.first, tile.i1 * scale.first}) {
+			for (double y: {tile.j0 * scale.second, tile.j1 * scale.second}) {
+				max_distance = std::max(max_distance, std::hypot(x - _xcen, y - _ycen));
+			}
+		}
+		if( max_distance / this->axrat / this->rscale <= this->rscale_switch ) {
+			return n_pixels / 4;
+		}
+		return n_pixels;
+	};
 
-			/* Subsample and integrate */
-			pixel_val =  this->subsample_pixel(x - half_xbin, x + half_xbin,
-			                                   y - half_ybin, y + half_ybin,
-			                                   0, ss_max_recursions, ss_resolution);
+	auto &scratch = thread_scratch<FT>();
+	auto &subsampled_pixels = scratch.subsampled_pixels;
+	if( subsampled_pixels.size() < tile_cols * tile_rows ) {
+		subsampled_pixels.resize(tile_cols * tile_rows);
+	}
+	auto &tile_integration_points = scratch.tile_integration_points;
+	if( record_integration_points && tile_integration_points.size() < tile_cols * tile_rows ) {
+		tile_integration_points.resize(tile_cols * tile_rows);
+	}
+	omp_tiled_2d_for(model.profile_omp_threads, first_col, last_col, first_row, last_row,
+	                 tile_size, tile_size, tile_cost, [&](const grid_tile &tile) {
+
+		auto &tile_scratch = thread_scratch<FT>();
+		auto &direct_idxs = tile_scratch.direct_idxs;
+		auto &direct_mirror_idxs = tile_scratch.direct_mirror_idxs;
+		auto &direct_x_profs = tile_scratch.direct_x_profs;
+		auto &direct_y_profs = tile_scratch.direct_y_profs;
+		auto &direct_vals = tile_scratch.direct_vals;
+		auto &tile_subsampled = subsampled_pixels[tile.index];
+		direct_idxs.clear();
+		direct_mirror_idxs.clear();
+		direct_x_profs.clear();
+		direct_y_profs.clear();
+		tile_subsampled.clear();
+
+		for (unsigned int j = tile.j0; j < tile.j1; j++) {
+			auto span = spans[j];
+			for (auto &run: row_runs(j)) {
+				auto i0 = std::max({tile.i0, span.first, run.first});
+				auto i1 = std::min({tile.i1, span.second, run.second});
+				for (unsigned int i = i0; i < i1; i++) {
+
+					/*
+					 * The value calculated at pixel (eval_i, eval_j) goes to `pixel`
+					 * and, if given, to `mirror`
+					 */
+					unsigned int pixel = i + j * width;
+					unsigned int mirror = no_pixel;
+					double eval_i = i;
+					double eval_j = j;
+					if( mirror_values ) {
+						double mi = mirror_i - i;
+						double mj = mirror_j - j;
+						bool first = j < mj || (j == mj && i <= mi);
+						/* Masked out mirrors are not visited, and thus not evaluated */
+						bool mirror_evaluated = is_evaluated(mi, mj) &&
+						    (!mask || mask[static_cast<unsigned int>(mi) + static_cast<unsigned int>(mj) * width]);
+						if( !first && mirror_evaluated ) {
+							continue;
+						}
+						else if( !first ) {
+							eval_i = mi;
+							eval_j = mj;
+						}
+						else if( mirror_evaluated && (mi != i || mj != j) ) {
+							mirror = static_cast<unsigned int>(mi) + static_cast<unsigned int>(mj) * width;
+						}
+					}
+
+					double x_prof;
+					double y_prof;
+					double r_prof;
+					double x = half_xbin + eval_i * scale.first;
+					double y = half_ybin + eval_j * scale.second;
+					this->_image_to_profile_coordinates(x, y, x_prof, y_prof);
+
+					/*
+					 * Check whether we need further refinement.
+					 * TODO: the radius calculation doesn't take into account boxing
+					 */
+					r_prof = std::sqrt(x_prof*x_prof + y_prof*y_prof);
+					if( this->rscale_max > 0 && r_prof/this->rscale > this->rscale_max ) {
+						continue;
+					}
+					else if( this->rough || r_prof/this->rscale > this->rscale_switch ) {
+						direct_idxs.push_back(pixel);
+						direct_mirror_idxs.push_back(mirror);
+						direct_x_profs.push_back(x_prof);
+						direct_y_profs.push_back(y_prof);
+						continue;
+					}
+
+					double value;
+					if( !precalculated_values.empty() && eval_i == i && eval_j == j &&
+					    find_precalculated_value(i + j * width, value) ) {
+						add_value(pixel, mirror, value);
+						continue;
+					}
+
+					unsigned int ss_resolution;
+					unsigned int ss_max_recursions;
+					this->subsampling_params(x, y, ss_resolution, ss_max_recursions);
+					tile_subsampled.push_back({x - half_xbin, x + half_xbin,
+					                           y - half_ybin, y + half_ybin,
+					                           ss_resolution, ss_max_recursions,
+					                           pixel, mirror, false, 0, 0, 0,
+					                           pixel, 1});
+				}
+			}
 		}
 
-		image[i + j * width] += flux_scale * pixel_val;
+		auto n_direct = direct_idxs.size();
+		if( n_direct == 0 ) {
+			return;
+		}
+		direct_vals.resize(n_direct);
+		this->_evaluate_many(direct_x_profs.data(), direct_y_profs.data(), direct_vals.data(), n_direct);
+		for (std::size_t k = 0; k < n_direct; k++) {
+			add_value(direct_idxs[k], direct_mirror_idxs[k], direct_vals[k]);
+		}
+
+		if( record_integration_points ) {
+			auto &tile_points = tile_integration_points[tile.index];
+			tile_points.clear();
+			for (std::size_t k = 0; k < n_direct; k++) {
+				auto pixel = direct_idxs[k];
+				tile_points.push_back({pixel,
+				    half_xbin + (pixel % width) * scale.first,
+				    half_ybin + (pixel / width) * scale.second,
+				    1, double(direct_vals[k])});
+			}
+		}
 	});
 
+	if( record_integration_points ) {
+		for (unsigned int t = 0; t < tile_cols * tile_rows; t++) {
+			auto &tile_points = tile_integration_points[t];
+			scratch.integration_points.insert(scratch.integration_points.end(),
+			                                  tile_points.begin(), tile_points.end());
+			tile_points.clear();
+		}
+	}
+
+	/*
+	 * Subsample the pixels that need it, in chunks of bounded size,
+	 * adding their averaged values to the image
+	 */
+	auto &levels = scratch.levels;
+	if( levels.empty() ) {
+		levels.resize(1);
+	}
+	auto subsample_pixels = [&]() {
+		subsample_level<FT>(0);
+		auto &pixels = levels[0].nodes;
+		for (auto &pixel: pixels) {
+			add_value(pixel.parent, pixel.mirror_pixel, pixel.total / (pixel.resolution * pixel.resolution));
+		}
+		pixels.clear();
+	};
+
+	/*
+	 * When sharing refinement decisions, mirrored pixels are subsampled next
+	 * to each other, the first one in row-major order going first
+	 */
+	auto find_mirror = [&](const subsampling_node &pixel) -> const subsampling_node * {
+		double mi = mirror_i - pixel.parent % width;
+		double mj = mirror_j - pixel.parent / width;
+		if( mi < first_col || mi >= last_col || mj < first_row || mj >= last_row ) {
+			return nullptr;
+		}
+		auto mirror = static_cast<unsigned int>(mi) + static_cast<unsigned int>(mj) * width;
+		if( mirror == pixel.parent ) {
+			return nullptr;
+		}
+		auto tile_index = (static_cast<unsigned int>(mj) - first_row) / tile_size * tile_cols +
+		                  (static_cast<unsigned int>(mi) - first_col) / tile_size;
+		auto &tile_pixels = subsampled_pixels[tile_index];
+		auto it = std::lower_bound(tile_pixels.begin(), tile_pixels.end(), mirror,
+		    [](const subsampling_node &node, unsigned int idx) { return node.parent < idx; });
+		if( it == tile_pixels.end() || it->parent != mirror ||
+		    it->resolution != pixel.resolution || it->max_recursions != pixel.max_recursions ||
+		    !mirror_reuses_refinement(pixel) || !mirror_reuses_refinement(*it) ) {
+			return nullptr;
+		}
+		return &*it;
+	};
+
+	levels[0].nodes.clear();
+	for (unsigned int t = 0; t < tile_cols * tile_rows; t++) {
+		for (auto &pixel: subsampled_pixels[t]) {
+			auto mirror = share_refinement ? find_mirror(pixel) : nullptr;
+			if( mirror && mirror->parent < pixel.parent ) {
+				continue;
+			}
+			levels[0].nodes.push_back(pixel);
+			if( mirror ) {
+				levels[0].nodes.push_back(*mirror);
+				levels[0].nodes.back().mirrors_previous = true;
+			}
+			if( levels[0].nodes.size() >= max_subsampling_nodes ) {
+				subsample_pixels();
+			}
+		}
+	}
+	if( !levels[0].nodes.empty() ) {
+		subsample_pixels();
+	}
 }
 
 #ifdef PROFIT_OPENCL
@@ -731,9 +1842,14 @@ RadialProfile::RadialProfile(const Model &model, const std::string &name) :
 	max_recursions(2), adjust(true),
 	rscale_max(0),
 	force_cpu(false),
-	rscale(0), _ie(0),
+	tabulate(false), tabulate_acc(1e-6),
+	rscale(0),
+	requested_acc(acc), requested_rscale_switch(rscale_switch),
+	requested_resolution(resolution), requested_rscale_max(rscale_max),
+	_lumtot(0), _ie(0),
 	_cos_ang(0), _sin_ang(0),
-	magzero(0)
+	magzero(0),
+	record_integration_points(false)
 {
 	register_parameter("rough", rough);
 	register_parameter("adjust", adjust);
@@ -744,11 +1860,13 @@ RadialProfile::RadialProfile(const Model &model, const std::string &name) :
 	register_parameter("ang", ang);
 	register_parameter("axrat", axrat);
 	register_parameter("box", box);
-	register_parameter("acc", acc);
-	register_parameter("rscale_switch", rscale_switch);
-	register_parameter("rscale_max", rscale_max);
+	register_parameter("acc", requested_acc);
+	register_parameter("rscale_switch", requested_rscale_switch);
+	register_parameter("rscale_max", requested_rscale_max);
 	register_parameter("max_recursions", max_recursions);
-	register_parameter("resolution", resolution);
+	register_parameter("resolution", requested_resolution);
+	register_parameter("tabulate", tabulate);
+	register_parameter("tabulate_acc", tabulate_acc);
 }
 
 #ifdef PROFIT_DEBUG
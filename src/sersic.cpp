@@ -24,8 +24,13 @@
  * along with libprofit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cmath>
 #include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
 
 #include "profit/common.h"
 #include "profit/exceptions.h"
@@ -197,6 +202,84 @@ double eval_function(double x, double y, double box, double re, double nser, dou
 	return std::exp(-bn * (r_factor - 1));
 }
 
+/*
+ * The vectorised sersic evaluation function.
+ *
+ * r_factor is calculated following the same strategies as _r_factor,
+ * using the fact that non-boxy bases are the square of boxy bases.
+ * Transcendental functions are the fast approximations of the given Order,
+ * or the accurate ones if Order is 0.
+ */
+template <bool boxy, SersicProfile::rfactor_invexp_t t, unsigned int Order>
+struct sersic_kernel {
+
+	template <simd_instruction_set SIMD, typename FT>
+	struct simd {
+		typedef simd_traits<SIMD, FT> S;
+		typedef simd_fast_math_functions<SIMD, FT, Order> M;
+		typedef typename S::vector_type vector_type;
+
+		simd(double box, double re, double nser, double bn) :
+			box(box), re(re), nser(nser), bn(bn) {}
+
+		vector_type operator()(vector_type x, vector_type y) const
+		{
+			double B = box + 2;
+			vector_type base;
+			if (boxy) {
+				auto re_v = S::set1(re);
+				base = S::add(M::pow(S::abs(S::div(x, re_v)), B),
+				              M::pow(S::abs(S::div(y, re_v)), B));
+			}
+			else {
+				base = S::div(S::add(S::mul(x, x), S::mul(y, y)), S::set1(re * re));
+			}
+			auto r_factor = _r_factor(base, _invexp<boxy>(nser, B));
+			return M::exp(S::mul(S::set1(-bn), S::sub(r_factor, S::set1(1.))));
+		}
+
+		vector_type _r_factor(vector_type b, double invexp) const
+		{
+			if (!boxy) {
+				if (t == SersicProfile::pointfive) {
+					return b;
+				}
+				b = S::sqrt(b);
+			}
+			switch (t) {
+				case SersicProfile::pointfive:
+					return S::mul(b, b);
+				case SersicProfile::one:
+					return b;
+				case SersicProfile::two:
+					return S::sqrt(b);
+				case SersicProfile::three:
+					return M::pow(b, 1. / 3.);
+				case SersicProfile::four:
+					return S::sqrt(S::sqrt(b));
+				case SersicProfile::eight:
+					return S::sqrt(S::sqrt(S::sqrt(b)));
+				case SersicProfile::sixteen:
+					return S::sqrt(S::sqrt(S::sqrt(S::sqrt(b))));
+				default:
+					return M::pow(b, 1 / invexp);
+			}
+		}
+
+		double box, re, nser, bn;
+	};
+
+};
+
+template<bool boxy, SersicProfile::rfactor_invexp_t t, unsigned int Order, typename FT>
+static
+void eval_many_function(simd_instruction_set instruction_set,
+    const FT *x, const FT *y, FT *values, std::size_t n,
+    double box, double re, double nser, double bn)
+{
+	simd_evaluate<sersic_kernel<boxy, t, Order>::template simd>(instruction_set, x, y, values, n, box, re, nser, bn);
+}
+
 /*
  * The main sersic evaluation function for a given X/Y coordinate
  */
@@ -204,6 +287,18 @@ double SersicProfile::evaluate_at(double x, double y) const {
 	return m_eval_function(x, y, box, re, nser, _bn);
 }
 
+void SersicProfile::evaluate_many(const double *x, const double *y, double *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_function(instruction_set, x, y, values, n, box, re, nser, _bn);
+}
+
+void SersicProfile::evaluate_many(const float *x, const float *y, float *values,
+    std::size_t n, simd_instruction_set instruction_set) const
+{
+	m_eval_many_float_function(instruction_set, x, y, values, n, box, re, nser, _bn);
+}
+
 void SersicProfile::validate() {
 
 	RadialProfile::validate();
@@ -220,38 +315,19 @@ void SersicProfile::validate() {
 template <bool boxy, SersicProfile::rfactor_invexp_t t>
 void SersicProfile::init_eval_function() {
 	m_eval_function = eval_function<boxy, t>;
-}
-
-void SersicProfile::evaluate(Image &image, const Mask &mask, const PixelScale &scale,
-    const Point &offset, double magzero)
-{
-	// inv_exponent is exactly what is yield by the templated _invexp function
-	// later on during each individual evaluation
-	// We need to calculate it here though to decide which template to choose
-	double inv_exponent = nser;
-	if( this->box != 0 ) {
-		inv_exponent *= (box + 2);
-		if( almost_equals(inv_exponent, 0.5) )    init_eval_function<true, pointfive>();
-		else if( almost_equals(inv_exponent, 1) ) init_eval_function<true, one>();
-		else if( almost_equals(inv_exponent, 2) ) init_eval_function<true, two>();
-		else if( almost_equals(inv_exponent, 3) ) init_eval_function<true, three>();
-		else if( almost_equals(inv_exponent, 4) ) init_eval_function<true, four>();
-		else if( almost_equals(inv_exponent, 8) ) init_eval_function<true, eight>();
-		else if( almost_equals(inv_exponent, 16)) init_eval_function<true, sixteen>();
-		else                                      init_eval_function<true, general>();
-	}
-	else {
-		if( almost_equals(inv_exponent, 0.5) )     init_eval_function<false, pointfive>();
-		else if( almost_equals(inv_exponent, 1) )  init_eval_function<false, one>();
-		else if( almost_equals(inv_exponent, 2) )  init_eval_function<false, two>();
-		else if( almost_equals(inv_exponent, 3) )  init_eval_function<false, three>();
-		else if( almost_equals(inv_exponent, 4) )  init_eval_function<false, four>();
-		else if( almost_equals(inv_exponent, 8) )  init_eval_function<false, eight>();
-		else if( almost_equals(inv_exponent, 16) ) init_eval_function<false, sixteen>();
-		else                                       init_eval_function<false, general>();
+	switch (_fast_math_order) {
+		case 4:  init_eval_many_function<boxy, t, 4>(); break;
+		case 6:  init_eval_many_function<boxy, t, 6>(); break;
+		case 8:  init_eval_many_function<boxy, t, 8>(); break;
+		case 10: init_eval_many_function<boxy, t, 10>(); break;
+		default: init_eval_many_function<boxy, t, 0>(); break;
 	}
+}
 
-	return RadialProfile::evaluate(image, mask, scale, offset, magzero);
+template <bool boxy, SersicProfile::rfactor_invexp_t t, unsigned int Order>
+void SersicProfile::init_eval_many_function() {
+	m_eval_many_function = eval_many_function<boxy, t, Order, double>;
+	m_eval_many_float_function = eval_many_function<boxy, t, Order, float>;
 }
 
 double SersicProfile::fluxfrac(double fraction) const {
@@ -288,19 +364,88 @@ double SersicProfile::get_lumtot() {
 	       exp(this->_bn)/pow(this->_bn, 2*this->nser);
 }
 
+void SersicProfile::select_eval_functions() {
+
+	// inv_exponent is exactly what is yield by the templated _invexp function
+	// later on during each individual evaluation
+	// We need to calculate it here though to decide which template to choose.
+	// It only changes with the shape of the profile
+	double inv_exponent = nser;
+	if( this->box != 0 ) {
+		inv_exponent *= (box + 2);
+		if( almost_equals(inv_exponent, 0.5) )    init_eval_function<true, pointfive>();
+		else if( almost_equals(inv_exponent, 1) ) init_eval_function<true, one>();
+		else if( almost_equals(inv_exponent, 2) ) init_eval_function<true, two>();
+		else if( almost_equals(inv_exponent, 3) ) init_eval_function<true, three>();
+		else if( almost_equals(inv_exponent, 4) ) init_eval_function<true, four>();
+		else if( almost_equals(inv_exponent, 8) ) init_eval_function<true, eight>();
+		else if( almost_equals(inv_exponent, 16)) init_eval_function<true, sixteen>();
+		else                                      init_eval_function<true, general>();
+	}
+	else {
+		if( almost_equals(inv_exponent, 0.5) )     init_eval_function<false, pointfive>();
+		else if( almost_equals(inv_exponent, 1) )  init_eval_function<false, one>();
+		else if( almost_equals(inv_exponent, 2) )  init_eval_function<false, two>();
+		else if( almost_equals(inv_exponent, 3) )  init_eval_function<false, three>();
+		else if( almost_equals(inv_exponent, 4) )  init_eval_function<false, four>();
+		else if( almost_equals(inv_exponent, 8) )  init_eval_function<false, eight>();
+		else if( almost_equals(inv_exponent, 16) ) init_eval_function<false, sixteen>();
+		else                                       init_eval_function<false, general>();
+	}
+}
+
+void SersicProfile::prepare_evaluation(double r_max) {
+
+	/*
+	 * The fast math functions keep the values of the profile a thousand
+	 * times below the accuracy requested by the user (or the adjusted one,
+	 * if smaller). Their errors don't reach the values unchanged though:
+	 * r_factor compounds the errors of the exp/log calls used to calculate
+	 * it, and these are then multiplied by bn * r_factor in the exponent,
+	 * so the order is chosen based on the largest r_factor evaluated
+	 */
+	unsigned int order = 0;
+	if( this->fast_math ) {
+		double B = box + 2;
+		double r_boxy = r_max / re * std::max(1., std::pow(2., 1 / B - 0.5));
+		double r_factor_max = std::pow(r_boxy, 1 / nser);
+		double r_factor_error = box != 0 ? 1 + (2 + B) / (nser * B) : 1 + 1 / nser;
+		double tolerance = std::min(acc, requested_acc) * 1e-3;
+		order = simd_fast_math_order(tolerance / (1 + _bn * r_factor_max * r_factor_error));
+	}
+	if( order != _fast_math_order ) {
+		_fast_math_order = order;
+		select_eval_functions();
+	}
+}
+
 void SersicProfile::initial_calculations() {
 
 	/*
 	 * bn needs to be calculated before calling the super method
-	 * because it's used to calculate the total luminosity
+	 * because it's used to calculate the total luminosity.
+	 * Like the rest of the shape-derived quantities, it is kept
+	 * from previous evaluations if the shape hasn't changed
 	 */
-	this->_bn = qgamma(0.5, 2*this->nser);
+	bool shape_changed = shape_parameters_changed();
+	if( shape_changed ) {
+		this->_bn = qgamma(0.5, 2*this->nser);
+	}
 
 	/* Common calculations first */
 	RadialProfile::initial_calculations();
 
+	/*
+	 * The evaluation functions depend only on the shape of the profile;
+	 * prepare_evaluation might still change them to use a different fast
+	 * math order
+	 */
+	if( shape_changed ) {
+		select_eval_functions();
+	}
+
 	/* Just some additional adjustments on rescale_factor */
-	if( this->adjust ) {
+	if( shape_changed && this->adjust ) {
 		this->_rescale_factor = 1;
 		if( this->rescale_flux ) {
 			double flux_r;
@@ -346,17 +491,371 @@ void SersicProfile::subsampling_params(double x, double y,
 
 }
 
+/*
+ * A persistent cache with the average value of non-boxy sersic profiles over
+ * the pixels closest to their centre, which otherwise require expensive
+ * subsampling. Values are calculated on demand on the nodes of a regular grid
+ * over nser, axrat, log10(re), ang and the position of the pixel relative to
+ * the profile centre (all in pixel units), and are linearly interpolated
+ * between nodes. Nodes are stored under get_profit_home() so they can be
+ * reused by later runs.
+ *
+ * The profile's point and mirror symmetries fold any angle and position into
+ * ang in [0, 45] and dx in [0, 1], which together with the ranges of the
+ * other axes bounds the grid. The number of nodes is further capped; once
+ * the cap is reached parameters needing new nodes are not covered anymore.
+ */
+class CentralPixelCache {
+
+public:
+
+	static constexpr unsigned int n_axes = 6;
+
+	/* Calculates the log of the value of a node given its parameters */
+	typedef double (*node_function)(const double (&params)[n_axes]);
+
+	/*
+	 * Sets `value` to the (interpolated) average value over a pixel whose
+	 * centre is at (dx, dy) relative to the profile's centre, calculating
+	 * any missing node first. Returns false if the given parameters are
+	 * not covered by the grid, or if missing nodes would exceed the cap.
+	 */
+	bool get(double nser, double axrat, double re, double ang, double dx, double dy,
+	         node_function calculate_node, double &value);
+
+	/* Forgets all nodes, both in memory and on disk */
+	void clear();
+
+	static CentralPixelCache &instance()
+	{
+		static CentralPixelCache cache;
+		return cache;
+	}
+
+private:
+
+	struct grid_axis {
+		double min;
+		double step;
+		unsigned int n_nodes;
+	};
+
+	static const grid_axis grid[n_axes];
+
+	/* Bump this when the grid or the way nodes are calculated changes */
+	static constexpr std::uint32_t version = 2;
+
+	/* At most this many nodes (16 bytes each on disk) are kept */
+	static constexpr std::size_t max_nodes = 1 << 20;
+
+	/* A node, as stored on disk */
+	struct node {
+		std::uint64_t key;
+		double log_value;
+	};
+
+	/* Guards the members below, but is not held while calculating nodes */
+	std::mutex mutex;
+	bool loaded = false;
+	std::string filename;
+	std::unordered_map<std::uint64_t, double> nodes;
+
+	void load();
+	void store(const std::vector<node> &new_nodes);
+};
+
+/*
+ * The dx and dy steps are not a power of two, so profile centres are never
+ * on the centre of a subpixel, where a single sample of the cusp would
+ * dominate (and spoil) the value of the node
+ */
+const CentralPixelCache::grid_axis CentralPixelCache::grid[] = {
+	{1, 0.1, 91},          // nser, [1, 10]
+	{0.1, 0.025, 37},      // axrat, [0.1, 1]
+	{-0.5, 0.05, 51},      // log10(re), [-0.5, 2]
+	{0, 5, 10},            // ang, [0, 45]
+	{0, 1 / 24., 25},      // dx, [0, 1]
+	{-1, 1 / 24., 49}      // dy, [-1, 1]
+};
+
+constexpr unsigned int CentralPixelCache::n_axes;
+constexpr std::uint32_t CentralPixelCache::version;
+constexpr std::size_t CentralPixelCache::max_nodes;
+
+void CentralPixelCache::load()
+{
+	/* If we can't use the profit home we still keep nodes in memory */
+	loaded = true;
+	try {
+		filename = create_dirs(get_profit_home(), {std::string("sersic_cache")}) + "/central_pixels";
+	} catch (const exception &) {
+		filename.clear();
+		return;
+	}
+
+	/*
+	 * The file has a version number followed by (key, log value) records.
+	 * Files with a different version, and truncated records, are ignored
+	 */
+	std::ifstream input(filename, std::ios::binary);
+	std::uint32_t file_version = 0;
+	if( input.read(reinterpret_cast<char *>(&file_version), sizeof(file_version)) && file_version == version ) {
+		node n;
+		while( nodes.size() < max_nodes && input.read(reinterpret_cast<char *>(&n), sizeof(n)) ) {
+			nodes[n.key] = n.log_value;
+		}
+		return;
+	}
+
+	std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+	output.write(reinterpret_cast<const char *>(&version), sizeof(version));
+}
+
+void CentralPixelCache::store(const std::vector<node> &new_nodes)
+{
+	/*
+	 * Other threads might have calculated some of these nodes in the
+	 * meantime, in which case they were already stored by them
+	 */
+	std::vector<node> stored_nodes;
+	std::lock_guard<std::mutex> guard(mutex);
+	for (auto &new_node: new_nodes) {
+		if( nodes.size() < max_nodes && nodes.emplace(new_node.key, new_node.log_value).second ) {
+			stored_nodes.push_back(new_node);
+		}
+	}
+	if( filename.empty() || stored_nodes.empty() ) {
+		return;
+	}
+	std::ofstream output(filename, std::ios::binary | std::ios::app);
+	output.write(reinterpret_cast<const char *>(stored_nodes.data()), stored_nodes.size() * sizeof(node));
+}
+
+void CentralPixelCache::clear()
+{
+	std::lock_guard<std::mutex> guard(mutex);
+	nodes.clear();
+	loaded = false;
+	filename.clear();
+	auto cache_dir = get_profit_home() + "/sersic_cache";
+	if( dir_exists(cache_dir) ) {
+		recursive_remove(cache_dir);
+	}
+}
+
+bool CentralPixelCache::get(double nser, double axrat, double re, double ang, double dx, double dy,
+                            node_function calculate_node, double &value)
+{
+	/*
+	 * Turning the profile by 90 degrees, mirroring it around the diagonal
+	 * and around its centre give the same pixel values for the turned and
+	 * mirrored pixel positions
+	 */
+	ang = std::fmod(ang, 180.);
+	if( ang < 0 ) {
+		ang += 180;
+	}
+	if( ang >= 90 ) {
+		ang -= 90;
+		std::swap(dx, dy);
+		dy = -dy;
+	}
+	if( ang > 45 ) {
+		ang = 90 - ang;
+		std::swap(dx, dy);
+	}
+	if( dx < 0 ) {
+		dx = -dx;
+		dy = -dy;
+	}
+
+	double params[n_axes] = {nser, axrat, std::log10(re), ang, dx, dy};
+	unsigned int lower[n_axes];
+	double weights[n_axes];
+	for (unsigned int axis = 0; axis < n_axes; axis++) {
+		auto &g = grid[axis];
+		double t = (params[axis] - g.min) / g.step;
+		if( !(t >= 0 && t <= g.n_nodes - 1) ) {
+			return false;
+		}
+		lower[axis] = std::min(static_cast<unsigned int>(t), g.n_nodes - 2);
+		weights[axis] = t - lower[axis];
+	}
+
+	/* The 2^n_axes corners around the given parameters with non-zero weight */
+	constexpr unsigned int max_corners = 1u << n_axes;
+	unsigned int corner_idx[max_corners][n_axes];
+	std::uint64_t corner_keys[max_corners];
+	double corner_weights[max_corners];
+	double corner_log_values[max_corners];
+	unsigned int n_corners = 0;
+	for (unsigned int corner = 0; corner < max_corners; corner++) {
+		double weight = 1;
+		std::uint64_t key = 0;
+		for (unsigned int axis = 0; axis < n_axes; axis++) {
+			bool up = corner & (1u << axis);
+			unsigned int idx = lower[axis] + (up ? 1 : 0);
+			weight *= up ? weights[axis] : 1 - weights[axis];
+			key = key * grid[axis].n_nodes + idx;
+			corner_idx[n_corners][axis] = idx;
+		}
+		if( weight == 0 ) {
+			continue;
+		}
+		corner_keys[n_corners] = key;
+		corner_weights[n_corners] = weight;
+		n_corners++;
+	}
+
+	/* Look up the known nodes, holding the lock only while doing so */
+	std::vector<unsigned int> missing;
+	{
+		std::lock_guard<std::mutex> guard(mutex);
+		if( !loaded ) {
+			load();
+		}
+		for (unsigned int corner = 0; corner < n_corners; corner++) {
+			auto it = nodes.find(corner_keys[corner]);
+			if( it != nodes.end() ) {
+				corner_log_values[corner] = it->second;
+			}
+			else {
+				missing.push_back(corner);
+			}
+		}
+		if( nodes.size() + missing.size() > max_nodes ) {
+			return false;
+		}
+	}
+
+	/*
+	 * Calculating nodes involves full model evaluations, so it happens
+	 * without the lock; the new nodes are then stored all at once
+	 */
+	if( !missing.empty() ) {
+		std::vector<node> new_nodes;
+		new_nodes.reserve(missing.size());
+		for (auto corner: missing) {
+			double node_params[n_axes];
+			for (unsigned int axis = 0; axis < n_axes; axis++) {
+				node_params[axis] = grid[axis].min + corner_idx[corner][axis] * grid[axis].step;
+			}
+			corner_log_values[corner] = calculate_node(node_params);
+			new_nodes.push_back({corner_keys[corner], corner_log_values[corner]});
+		}
+		store(new_nodes);
+	}
+
+	/* Multilinear interpolation of the log values of the corners */
+	double log_value = 0;
+	for (unsigned int corner = 0; corner < n_corners; corner++) {
+		log_value += corner_weights[corner] * corner_log_values[corner];
+	}
+	value = std::exp(log_value);
+	return true;
+}
+
+double SersicProfile::central_pixel_log_value(const double (&params)[6])
+{
+	/*
+	 * Evaluate a single-pixel image with the same subsampling the central
+	 * pixels get when auto-adjusting with the default accuracy, and then
+	 * remove the flux normalisation to get the average profile value
+	 */
+	double axrat = params[1];
+	Model model {1, 1};
+	auto profile = model.add_profile("sersic");
+	profile->parameter("nser", params[0]);
+	profile->parameter("axrat", axrat);
+	profile->parameter("re", std::pow(10., params[2]));
+	profile->parameter("ang", params[3]);
+	profile->parameter("xcen", 0.5 - params[4]);
+	profile->parameter("ycen", 0.5 - params[5]);
+	profile->parameter("mag", 0.);
+	profile->parameter("adjust", false);
+	profile->parameter("acc", 0.1 / axrat);
+	profile->parameter("resolution", 8u);
+	profile->parameter("max_recursions", 10u);
+	profile->parameter("rscale_switch", std::numeric_limits<double>::max());
+	auto image = model.evaluate();
+	return std::log(image[0] / static_cast<RadialProfile &>(*profile)._ie);
+}
+
+void SersicProfile::clear_central_pixel_cache()
+{
+	CentralPixelCache::instance().clear();
+}
+
+void SersicProfile::precalculated_pixels(const Dimensions &dims, const PixelScale &scale,
+                                         std::vector<std::pair<unsigned int, double>> &values)
+{
+	/*
+	 * Same central pixels subsampling_params looks for, which must be
+	 * square for the cache to apply
+	 */
+	auto pixel_scale = model.get_image_pixel_scale();
+	if( !cache_center || !adjust || nser <= 1 || box != 0 ||
+	    pixel_scale != scale || scale.first != scale.second ) {
+		return;
+	}
+
+	/*
+	 * Only pixels whose centres are within one pixel of the profile's centre
+	 * qualify, so only the (at most) three columns and rows around it are
+	 * visited, and each of them is still checked exactly
+	 */
+	double half_bin = scale.first / 2;
+	auto index_range = [](double cen, double pixel_size, unsigned int n, unsigned int &first, unsigned int &last) {
+		double pos = (cen - pixel_size / 2) / pixel_size;
+		double lo = std::max(std::ceil(pos - 1), 0.);
+		double hi = std::min(std::floor(pos + 1), double(n) - 1);
+		if( !(lo <= hi) ) {
+			return false;
+		}
+		first = static_cast<unsigned int>(lo);
+		last = static_cast<unsigned int>(hi);
+		return true;
+	};
+	unsigned int i_first, i_last, j_first, j_last;
+	if( !index_range(_xcen, scale.first, dims.x, i_first, i_last) ||
+	    !index_range(_ycen, scale.second, dims.y, j_first, j_last) ) {
+		return;
+	}
+
+	for (unsigned int j = j_first; j <= j_last; j++) {
+		double y = half_bin + j * scale.second;
+		if( std::abs(y - _ycen) >= scale.second ) {
+			continue;
+		}
+		for (unsigned int i = i_first; i <= i_last; i++) {
+			double x = half_bin + i * scale.first;
+			if( std::abs(x - _xcen) >= scale.first ) {
+				continue;
+			}
+			double value;
+			if( CentralPixelCache::instance().get(nser, axrat, re / scale.first, ang,
+			                                       (x - _xcen) / scale.first, (y - _ycen) / scale.second,
+			                                       &central_pixel_log_value, value) ) {
+				values.emplace_back(i + j * dims.x, value);
+			}
+		}
+	}
+}
+
 /**
  * The sersic creation function
  */
 SersicProfile::SersicProfile(const Model &model, const std::string &name) :
 	RadialProfile(model, name),
 	re(1), nser(1),
-	rescale_flux(false)
+	rescale_flux(false), cache_center(false), fast_math(false),
+	_fast_math_order(0)
 {
 	register_parameter("re", re);
 	register_parameter("nser", nser);
 	register_parameter("rescale_flux", rescale_flux);
+	register_parameter("cache_center", cache_center);
+	register_parameter("fast_math", fast_math);
 }
 
 #ifdef PROFIT_OPENCL
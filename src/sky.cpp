@@ -47,18 +47,24 @@ void SkyProfile::adjust_for_finesampling(unsigned int finesampling)
 void SkyProfile::evaluate(Image &image, const Mask &mask, const PixelScale & /*scale*/,
     const Point &/*offset*/, double  /*magzero*/)
 {
-	/* In case we need to mask some pixels out */
-	auto mask_it = mask.begin();
-
 	/* Fill the image with the background value */
-	for(auto &pixel: image) {
-
-		/* Check the calculation mask and avoid pixel if necessary  */
-		if( mask && !*mask_it++ ) {
-			continue;
+	if( !mask ) {
+		for(auto &pixel: image) {
+			pixel += this->bg;
 		}
+		return;
+	}
 
-		pixel += this->bg;
+	/* Only fill the runs of pixels not masked out */
+	auto width = image.getWidth();
+	auto height = image.getHeight();
+	const auto &mask_spans = mask.spans();
+	for(unsigned int j = 0; j < height; j++) {
+		for(auto &span: mask_spans.row(j)) {
+			for(unsigned int i = span.first; i < span.second; i++) {
+				image[i + j * width] += this->bg;
+			}
+		}
 	}
 }
 
@@ -224,14 +224,325 @@ public:
 	void test_masked_convolution() {
 		_test_masked_convolution(ConvolverType::BRUTE_OLD);
 		_test_masked_convolution(ConvolverType::BRUTE);
+		_test_masked_convolution(ConvolverType::LOW_RANK);
+	}
+
+	void test_brute_convolver_partially_masked_blocks()
+	{
+		// Image widths that don't fill entire blocks of output pixels, and a
+		// mask whose spans start and end in the middle of blocks
+		for (auto src_dims: {Dimensions{37, 23}, Dimensions{64, 9}, Dimensions{5, 40}}) {
+			auto src = uniform_random_image(src_dims);
+			auto krn = uniform_random_image({7, 6});
+			Mask mask(src_dims);
+			for (unsigned int j = 0; j != src_dims.y; j++) {
+				for (unsigned int i = j % 3; i < src_dims.x; i += 5) {
+					mask[i + j * src_dims.x] = true;
+				}
+			}
+			auto expected = create_convolver(ConvolverType::BRUTE_OLD)->convolve(src, krn, mask);
+			for (auto instruction_set: {simd_instruction_set::NONE, simd_instruction_set::SSE2,
+			                            simd_instruction_set::AVX, simd_instruction_set::AUTO}) {
+				if (!has_simd_instruction_set(instruction_set)) {
+					continue;
+				}
+				ConvolverCreationPreferences prefs;
+				prefs.instruction_set = instruction_set;
+				auto result = create_convolver(ConvolverType::BRUTE, prefs)->convolve(src, krn, mask);
+				images_within_tolerance(expected, result, 1e-9);
+			}
+		}
+	}
+
+	void test_low_rank_kernel()
+	{
+		// A separable kernel has rank 1
+		std::vector<double> column {1, 2, 3, 4, 5};
+		std::vector<double> row {0.5, 1, 2, 1, 0.5, 0.25, 0.1};
+		Image separable {{7, 5}};
+		for (unsigned int j = 0; j != 5; j++) {
+			for (unsigned int i = 0; i != 7; i++) {
+				separable[Point{i, j}] = column[j] * row[i];
+			}
+		}
+		auto low_rank = low_rank_kernel(separable, 1e-12);
+		TS_ASSERT_EQUALS(1, low_rank.rank());
+		TS_ASSERT_LESS_THAN_EQUALS(low_rank.residual, 1e-12);
+
+		// The full decomposition of any kernel reconstructs it, and keeping
+		// fewer terms gives residuals within the requested tolerance
+		for (auto krn_dims: {Dimensions{9, 7}, Dimensions{7, 9}}) {
+			auto krn = uniform_random_image(krn_dims);
+			low_rank = low_rank_kernel(krn, 0);
+			TS_ASSERT_EQUALS(7, low_rank.rank());
+			for (unsigned int j = 0; j != krn_dims.y; j++) {
+				for (unsigned int i = 0; i != krn_dims.x; i++) {
+					double value = 0;
+					for (unsigned int t = 0; t != low_rank.rank(); t++) {
+						value += low_rank.columns[t][j] * low_rank.rows[t][i];
+					}
+					TS_ASSERT_DELTA(krn[i + j * krn_dims.x], value, 1e-12);
+				}
+			}
+			low_rank = low_rank_kernel(krn, 0.2);
+			TS_ASSERT_LESS_THAN(low_rank.rank(), 7);
+			TS_ASSERT_LESS_THAN_EQUALS(low_rank.residual, 0.2);
+		}
+
+		TS_ASSERT_THROWS(low_rank_kernel(separable, -1), const invalid_parameter &);
+	}
+
+	void test_low_rank_convolver()
+	{
+		// With the full decomposition of the kernel, results are those of
+		// brute-force convolution
+		auto src = uniform_random_image({101, 100});
+		auto krn = uniform_random_image({25, 24});
+		ConvolverCreationPreferences prefs;
+		prefs.low_rank_tolerance = 0;
+		auto expected = create_convolver(ConvolverType::BRUTE)->convolve(src, krn, Mask{});
+		auto low_rank = create_convolver("low-rank", prefs);
+		images_within_tolerance(expected, low_rank->convolve(src, krn, Mask{}), 1e-10);
+
+		// Smooth kernels need few terms; errors are bounded by the residual
+		Image gaussian {{25, 25}};
+		for (unsigned int j = 0; j != 25; j++) {
+			for (unsigned int i = 0; i != 25; i++) {
+				double x = i - 12., y = j - 12.;
+				gaussian[Point{i, j}] = std::exp(-(x * x / 8 + y * y / 18 + x * y / 20));
+			}
+		}
+		gaussian /= gaussian.total();
+		prefs.low_rank_tolerance = 1e-3;
+		auto approximation = low_rank_kernel(gaussian, prefs.low_rank_tolerance);
+		TS_ASSERT_LESS_THAN(approximation.rank(), 6);
+		expected = create_convolver(ConvolverType::BRUTE)->convolve(src, gaussian, Mask{});
+		auto result = create_convolver(ConvolverType::LOW_RANK, prefs)->convolve(src, gaussian, Mask{});
+		auto gaussian_norm = std::sqrt(std::inner_product(gaussian.begin(), gaussian.end(), gaussian.begin(), 0.));
+		auto max_error = approximation.residual * gaussian_norm * std::sqrt(double(gaussian.size()));
+		for (unsigned int i = 0; i != expected.size(); i++) {
+			TS_ASSERT_DELTA(expected[i], result[i], max_error);
+		}
+	}
+
+	void test_batch_convolution()
+	{
+		// Convolving a batch of images gives the same results as convolving
+		// them one by one, including offsets
+		std::vector<ConvolverType> types {ConvolverType::BRUTE_OLD, ConvolverType::BRUTE, ConvolverType::LOW_RANK};
+		if (has_fftw()) {
+			types.push_back(ConvolverType::FFT);
+		}
+		if (has_fftw_float()) {
+			types.push_back(ConvolverType::FFT_FLOAT);
+		}
+		if (has_fftw()) {
+			types.push_back(ConvolverType::FFT_TILED);
+		}
+		auto krn = uniform_random_image({5, 4});
+		Mask mask{true, {20, 21}};
+		mask[Point{3, 4}] = false;
+		std::vector<Image> srcs;
+		for (unsigned int i = 0; i != 5; i++) {
+			srcs.push_back(uniform_random_image({20, 21}));
+		}
+		for (auto type: types) {
+			for (bool crop: {true, false}) {
+				auto convolver = create_convolver(type);
+				Point batch_offset;
+				auto results = convolver->convolve(srcs, krn, mask, crop, batch_offset);
+				TS_ASSERT_EQUALS(srcs.size(), results.size());
+				for (unsigned int i = 0; i != srcs.size(); i++) {
+					Point offset;
+					auto result = create_convolver(type)->convolve(srcs[i], krn, mask, crop, offset);
+					TS_ASSERT_EQUALS(offset, batch_offset);
+					images_within_tolerance(result, results[i], type == ConvolverType::FFT_FLOAT ? 1e-5 : 1e-12);
+				}
+
+				// The same convolver takes batches of other sizes too
+				std::vector<Image> small_srcs(srcs.begin(), srcs.begin() + 2);
+				auto small_results = convolver->convolve(small_srcs, krn, mask, crop);
+				TS_ASSERT_EQUALS(small_srcs.size(), small_results.size());
+				for (unsigned int i = 0; i != small_srcs.size(); i++) {
+					images_within_tolerance(results[i], small_results[i], type == ConvolverType::FFT_FLOAT ? 1e-5 : 1e-12);
+				}
+			}
+		}
+
+		// Images in a batch must have the same dimensions
+		srcs.push_back(uniform_random_image({21, 20}));
+		auto convolver = create_convolver(ConvolverType::BRUTE);
+		TS_ASSERT_THROWS(convolver->convolve(srcs, krn, Mask{}), const invalid_parameter &);
+	}
+
+	void test_fft_convolver_padding()
+	{
+		if (!has_fftw()) {
+			TS_SKIP("No FFTW available");
+		}
+
+		// The FFT convolver gives the same results as the brute-force one,
+		// and its uncropped results contain them at the padding it reports
+		for (auto src_dims: {Dimensions{40, 40}, Dimensions{41, 33}, Dimensions{30, 47}}) {
+			for (auto krn_dims: {Dimensions{8, 8}, Dimensions{9, 9}, Dimensions{4, 11}}) {
+				auto src = uniform_random_image(src_dims);
+				auto krn = uniform_random_image(krn_dims);
+				auto fft = create_convolver(ConvolverType::FFT);
+				auto expected = create_convolver(ConvolverType::BRUTE_OLD)->convolve(src, krn, Mask{});
+				images_within_tolerance(expected, fft->convolve(src, krn, Mask{}), 1e-10);
+
+				Point offset;
+				auto uncropped = fft->convolve(src, krn, Mask{}, false, offset);
+				auto padding = fft->padding(src_dims, krn_dims);
+				TS_ASSERT_EQUALS(offset, padding.first);
+				TS_ASSERT_EQUALS(uncropped.getDimensions(), src_dims + padding.first + padding.second);
+				TS_ASSERT(uncropped.getDimensions() >= src_dims + krn_dims - 1);
+				images_within_tolerance(expected, uncropped.crop(src_dims, offset), 1e-10);
+			}
+		}
+	}
+
+	void test_fft_float_convolver()
+	{
+		if (!has_fftw_float()) {
+			TS_SKIP("No single-precision FFTW available");
+		}
+
+		// Single-precision FFTs introduce absolute errors of about 1e-6 times
+		// the peak of the result
+		for (auto src_dims: {Dimensions{100, 100}, Dimensions{101, 87}}) {
+			for (auto krn_dims: {Dimensions{24, 24}, Dimensions{25, 25}}) {
+				auto src = uniform_random_image(src_dims);
+				auto krn = uniform_random_image(krn_dims);
+				auto expected = create_convolver(ConvolverType::FFT)->convolve(src, krn, Mask{});
+				auto result = create_convolver("fft-float")->convolve(src, krn, Mask{});
+				TS_ASSERT_EQUALS(expected.getDimensions(), result.getDimensions());
+				auto peak = *std::max_element(expected.begin(), expected.end());
+				for (unsigned int i = 0; i != expected.size(); i++) {
+					TS_ASSERT_DELTA(expected[i], result[i], peak * 1e-5);
+				}
+			}
+		}
+	}
+
+	void test_fft_convolver_rectangular_images()
+	{
+		if (!has_fftw()) {
+			TS_SKIP("No FFTW available");
+		}
+
+		// FFTs skip the zero rows of the padded source and kernel, and the
+		// rows of the result that are cropped away
+		for (auto src_dims: {Dimensions{37, 61}, Dimensions{61, 37}}) {
+			for (auto krn_dims: {Dimensions{5, 12}, Dimensions{12, 5}}) {
+				auto src = uniform_random_image(src_dims);
+				auto krn = uniform_random_image(krn_dims);
+				auto expected = create_convolver(ConvolverType::BRUTE)->convolve(src, krn, Mask{});
+				auto fft_convolver = create_convolver(ConvolverType::FFT);
+				auto result = fft_convolver->convolve(src, krn, Mask{});
+				images_within_tolerance(expected, result, 1e-12);
+				Point offset;
+				auto uncropped = fft_convolver->convolve(src, krn, Mask{}, false, offset);
+				images_within_tolerance(expected, uncropped.crop(src_dims, offset), 1e-12);
+			}
+		}
+	}
+
+	void test_fft_convolver_big_image()
+	{
+		if (!has_fftw()) {
+			TS_SKIP("No FFTW available");
+		}
+
+		// The plans for the pruned FFTs of big images need to fit in memory.
+		// The central pixel of the kernel is 1 while the rest are 0, so the
+		// convolution gives back the original image. FFT round-off errors
+		// scale with the image's values as a whole, not with each pixel's
+		auto src = uniform_random_image({1024, 1024});
+		auto krn = Image{51, 51};
+		krn[Point{25, 25}] = 1;
+		auto convolution = create_convolver(ConvolverType::FFT)->convolve(src, krn, Mask{});
+		TS_ASSERT_EQUALS(src.getDimensions(), convolution.getDimensions());
+		auto peak = *std::max_element(src.begin(), src.end());
+		for (unsigned int i = 0; i != src.size(); i++) {
+			TS_ASSERT_DELTA(src[i], convolution[i], peak * 1e-12);
+		}
+	}
+
+	void test_tiled_fft_convolver()
+	{
+		if (!has_fftw()) {
+			TS_SKIP("No FFTW available");
+		}
+
+		// Images are big enough to be split into several tiles in each
+		// dimension, some of which are fully masked out
+		Dimensions src_dims {700, 600};
+		auto src = uniform_random_image(src_dims);
+		Mask mask {true, src_dims};
+		for (unsigned int j = 0; j != 300; j++) {
+			for (unsigned int i = 0; i != 400; i++) {
+				mask[Point{i, j}] = false;
+			}
+		}
+		mask[Point{10, 10}] = true;
+		for (auto krn_dims: {Dimensions{21, 21}, Dimensions{80, 7}}) {
+			auto krn = uniform_random_image(krn_dims);
+			auto expected = create_convolver(ConvolverType::FFT)->convolve(src, krn, mask);
+			auto result = create_convolver("fft-tiled")->convolve(src, krn, mask);
+			images_within_tolerance(expected, result, 1e-12);
+
+			// Tiles are convolved identically by any number of threads
+			ConvolverCreationPreferences prefs;
+			prefs.omp_threads = 3;
+			TS_ASSERT_EQUALS(result, create_convolver(ConvolverType::FFT_TILED, prefs)->convolve(src, krn, mask));
+		}
+	}
+
+	void test_fft_convolvers_share_plans()
+	{
+		if (!has_fftw()) {
+			TS_SKIP("No FFTW available");
+		}
+
+		// Convolvers of the same size share their plans, but not their buffers,
+		// so interleaving them must not change their results
+		auto krn = uniform_random_image({25, 25});
+		auto src1 = uniform_random_image({100, 100});
+		auto src2 = uniform_random_image({100, 100});
+		auto src3 = uniform_random_image({60, 80});
+		auto conv1 = create_convolver(ConvolverType::FFT);
+		auto conv2 = create_convolver(ConvolverType::FFT);
+		auto result1 = conv1->convolve(src1, krn, Mask{});
+		auto result3 = conv2->convolve(src3, krn, Mask{});
+		auto result2 = conv2->convolve(src2, krn, Mask{});
+		TS_ASSERT_EQUALS(result1, conv2->convolve(src1, krn, Mask{}));
+		TS_ASSERT_EQUALS(result2, conv1->convolve(src2, krn, Mask{}));
+		TS_ASSERT_EQUALS(result3, conv1->convolve(src3, krn, Mask{}));
+	}
+
+	void test_psf_wider_than_image()
+	{
+		// Images narrower but taller than the kernel are extended only
+		// horizontally, and the central pixel of the kernel is 1 while the
+		// rest are 0, so the convolution gives back the original image
+		auto src = uniform_random_image({3, 9});
+		auto krn = Image{5, 5};
+		krn[Point{2, 2}] = 1;
+		for (auto type: {ConvolverType::BRUTE_OLD, ConvolverType::BRUTE}) {
+			auto convolution = create_convolver(type)->convolve(src, krn, Mask{});
+			images_within_tolerance(src, convolution, 1e-9);
+		}
 	}
 
 	void test_psf_bigger_than_image()
 	{
 		_test_psf_bigger_than_image(ConvolverType::BRUTE);
 		_test_psf_bigger_than_image(ConvolverType::BRUTE_OLD);
+		_test_psf_bigger_than_image(ConvolverType::LOW_RANK);
 		if (has_fftw()) {
 			_test_psf_bigger_than_image(ConvolverType::FFT);
+			_test_psf_bigger_than_image(ConvolverType::FFT_TILED);
 		}
 		if (has_opencl() && !get_opencl_info().empty()) {
 			ConvolverCreationPreferences prefs;
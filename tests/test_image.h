@@ -25,6 +25,7 @@
  */
 
 #include <list>
+#include <random>
 
 #include "common_test_setup.h"
 
@@ -134,6 +135,14 @@ public:
 		TS_ASSERT(!(origin > Point{1, 1}));
 	}
 
+	void test_max()
+	{
+		TS_ASSERT_EQUALS(max(Point{1, 2}, Point{3, 4}), (Point{3, 4}));
+		TS_ASSERT_EQUALS(max(Point{3, 2}, Point{1, 4}), (Point{3, 4}));
+		TS_ASSERT_EQUALS(max(Point{1, 4}, Point{3, 2}), (Point{3, 4}));
+		TS_ASSERT_EQUALS(max(Point{3, 4}, Point{1, 2}), (Point{3, 4}));
+	}
+
 };
 
 class TestBox : public CxxTest::TestSuite {
@@ -689,4 +698,79 @@ public:
 		}, 4, 4};
 		assert_masks(expected_expanded_by_1, m.expand_by({1, 1}));
 	}
+
+	void test_expand_by_matches_brute_force()
+	{
+		std::mt19937 generator(1234);
+		std::bernoulli_distribution set_pixel(0.05);
+		for (auto dims: {Dimensions{1, 1}, Dimensions{7, 3}, Dimensions{40, 25}, Dimensions{300, 11}}) {
+			Mask m(dims);
+			for (unsigned int k = 0; k != dims.x * dims.y; k++) {
+				m[k] = set_pixel(generator);
+			}
+			for (auto pad: {Dimensions{0, 0}, Dimensions{1, 0}, Dimensions{0, 2}, Dimensions{3, 5}, Dimensions{50, 50}}) {
+				Mask expected(dims);
+				for (unsigned int j = 0; j != dims.y; j++) {
+					for (unsigned int i = 0; i != dims.x; i++) {
+						for (unsigned int l = 0; l != dims.y; l++) {
+							for (unsigned int k = 0; k != dims.x; k++) {
+								if (m[Point{k, l}] && k + pad.x >= i && i + pad.x >= k && l + pad.y >= j && j + pad.y >= l) {
+									expected[Point{i, j}] = true;
+								}
+							}
+						}
+					}
+				}
+				assert_masks(expected, m.expand_by(pad));
+				assert_masks(expected, m.expand_by(pad, 4));
+			}
+		}
+	}
+
+	void test_spans()
+	{
+		Mask m {{
+			true,  true,  false, true,  false,
+			false, false, false, false, false,
+			false, true,  true,  true,  true,
+			true,  true,  true,  true,  true
+		}, 5, 4};
+		auto check_row = [&](unsigned int j, const std::vector<MaskSpans::span> &expected) {
+			auto row = m.spans().row(j);
+			TS_ASSERT_EQUALS(expected, std::vector<MaskSpans::span>(row.begin(), row.end()));
+		};
+		check_row(0, {{0, 2}, {3, 4}});
+		check_row(1, {});
+		check_row(2, {{1, 5}});
+		check_row(3, {{0, 5}});
+		TS_ASSERT_EQUALS(4, m.spans().size());
+		TS_ASSERT_EQUALS(12, m.spans().count());
+
+		// Modifying the mask discards its previous spans
+		m[Point{2, 1}] = true;
+		check_row(1, {{2, 3}});
+		m.zero();
+		TS_ASSERT_EQUALS(0, m.spans().size());
+		TS_ASSERT(m.spans().row(0).empty());
+	}
+
+	void test_apply_to_image()
+	{
+		Mask m {{
+			true,  false, true,
+			false, false, false,
+			false, true,  true
+		}, 3, 3};
+		Image image {{
+			1, 2, 3,
+			4, 5, 6,
+			7, 8, 9
+		}, 3, 3};
+		Image expected {{
+			1, 0, 3,
+			0, 0, 0,
+			0, 8, 9
+		}, 3, 3};
+		assert_images_relative_delta(expected, image & m, 0);
+	}
 };
\ No newline at end of file
@@ -265,6 +265,254 @@ public:
 
 	}
 
+	void test_concurrent_profiles()
+	{
+		// Evaluating profiles concurrently must give exactly the same
+		// result as evaluating them one after the other, with and without
+		// convolution, and regardless of the number of threads
+		auto evaluate = [this](unsigned int omp_threads, unsigned int concurrent_profiles) {
+			Model m(60, 60);
+			m.set_omp_threads(omp_threads);
+			m.set_concurrent_profiles(concurrent_profiles);
+			m.set_convolver(create_convolver(ConvolverType::BRUTE));
+			m.set_psf({{0., 1., 2., 3.}, 2, 2});
+			for (unsigned int i = 0; i != 17; i++) {
+				_add_sersic(m, 5 + 3.1 * i, 55 - 2.7 * i, 1 + 0.3 * i, i % 3 == 0);
+			}
+			m.add_profile("sky")->parameter("bg", 1e-12);
+			return m.evaluate();
+		};
+		auto reference = evaluate(0, 0);
+		for (auto omp_threads: {1u, 2u, 4u}) {
+			for (auto concurrent_profiles: {2u, 3u, 30u}) {
+				TS_ASSERT_EQUALS(reference, evaluate(omp_threads, concurrent_profiles));
+			}
+		}
+	}
+
+	void test_profile_cache()
+	{
+		// Kept profile images give exactly the same results as evaluating
+		// all profiles, and only changed profiles are evaluated again.
+		// Radial profiles get new statistics on each evaluation
+		struct test_model {
+			Model model {40, 40};
+			std::vector<ProfilePtr> sersics;
+		};
+		auto create_model = []() {
+			std::unique_ptr<test_model> m(new test_model());
+			m->model.set_convolver(create_convolver(ConvolverType::BRUTE));
+			m->model.set_psf({{0., 1., 2., 3.}, 2, 2});
+			for (unsigned int i = 0; i != 5; i++) {
+				auto sersic = m->model.add_profile("sersic");
+				sersic->parameter("xcen", 5 + 6.1 * i);
+				sersic->parameter("ycen", 35 - 5.7 * i);
+				sersic->parameter("re", 1 + 0.8 * i);
+				sersic->parameter("convolve", i % 2 == 0);
+				m->sersics.push_back(sersic);
+			}
+			m->model.add_profile("sky")->parameter("bg", 1e-12);
+			return m;
+		};
+
+		std::size_t image_size = 42 * 42 * sizeof(double);
+		for (auto cache_size: {std::size_t(1), 4 * image_size, 100 * image_size}) {
+			for (auto concurrent_profiles: {1u, 3u}) {
+				auto cached = create_model();
+				auto reference = create_model();
+				cached->model.set_profile_cache_size(cache_size);
+				cached->model.set_omp_threads(4);
+				cached->model.set_concurrent_profiles(concurrent_profiles);
+				TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+				for (unsigned int i = 0; i != 5; i++) {
+					std::vector<std::shared_ptr<ProfileStats>> stats;
+					for (auto &sersic: cached->sersics) {
+						stats.push_back(sersic->get_stats());
+					}
+					for (auto m: {cached.get(), reference.get()}) {
+						m->sersics[i]->parameter("mag", 16. + i);
+					}
+					TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+					unsigned int n_kept = 0;
+					for (unsigned int j = 0; j != 5; j++) {
+						bool kept = stats[j] == cached->sersics[j]->get_stats();
+						TS_ASSERT(!kept || j != i);
+						n_kept += kept;
+					}
+					if (cache_size == 1) {
+						TS_ASSERT_EQUALS(0, n_kept);
+					}
+					else if (cache_size == 100 * image_size) {
+						TS_ASSERT_EQUALS(4, n_kept);
+					}
+					else {
+						TS_ASSERT_LESS_THAN(0, n_kept);
+					}
+				}
+			}
+		}
+
+		// Changing the model discards all kept images
+		auto cached = create_model();
+		auto reference = create_model();
+		cached->model.set_profile_cache_size(100 * image_size);
+		cached->model.evaluate();
+		for (auto m: {cached.get(), reference.get()}) {
+			m->model.set_magzero(3);
+		}
+		TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+
+		// So do changes in the PSF, which psf profiles draw, and in the mask
+		for (auto m: {cached.get(), reference.get()}) {
+			auto psf = m->model.add_profile("psf");
+			psf->parameter("xcen", 20.);
+			psf->parameter("ycen", 20.);
+		}
+		cached->model.evaluate();
+		for (auto m: {cached.get(), reference.get()}) {
+			m->model.set_psf({{3., 2., 1., 0.}, 2, 2});
+		}
+		TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+		for (auto m: {cached.get(), reference.get()}) {
+			m->model.set_psf_pixel_scale({2, 2});
+		}
+		TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+		Mask mask {true, {40, 40}};
+		mask[Point{20, 20}] = false;
+		for (auto m: {cached.get(), reference.get()}) {
+			m->model.set_mask(mask);
+		}
+		TS_ASSERT_EQUALS(reference->model.evaluate(), cached->model.evaluate());
+	}
+
+	void test_evaluate_batch()
+	{
+		// Each image of a batch is the same as the image obtained by setting
+		// the corresponding parameter values and evaluating the model
+		Model m(40, 40);
+		m.set_convolver(create_convolver(ConvolverType::BRUTE));
+		m.set_psf({{0., 1., 2., 3.}, 2, 2});
+		auto convolved = m.add_profile("sersic");
+		convolved->parameter("xcen", 12.);
+		convolved->parameter("ycen", 15.);
+		convolved->parameter("convolve", true);
+		auto unconvolved = m.add_profile("sersic");
+		unconvolved->parameter("xcen", 25.);
+		unconvolved->parameter("ycen", 30.);
+
+		std::vector<ProfileParameter> parameters {
+			{convolved, "re"}, {convolved, "mag"}, {unconvolved, "xcen"}
+		};
+		std::vector<std::vector<double>> values {
+			{1.5, 15., 25.}, {2.5, 16., 27.3}, {4., 14.5, 22.1}
+		};
+		auto images = m.evaluate_batch(parameters, values);
+		TS_ASSERT_EQUALS(values.size(), images.size());
+
+		auto original = m.evaluate();
+		for (unsigned int i = 0; i != values.size(); i++) {
+			convolved->parameter("re", values[i][0]);
+			convolved->parameter("mag", values[i][1]);
+			unconvolved->parameter("xcen", values[i][2]);
+			assert_images_relative_delta(m.evaluate(), images[i], 1e-12, zero_treatment_t::ASSUME_0);
+		}
+
+		// Parameters are restored after evaluating a batch
+		convolved->parameter("re", 1.);
+		convolved->parameter("mag", 15.);
+		unconvolved->parameter("xcen", 25.);
+		m.evaluate_batch(parameters, values);
+		TS_ASSERT_EQUALS(original, m.evaluate());
+
+		// Parameters must belong to the model, and values must match them
+		Model other(40, 40);
+		auto foreign = other.add_profile("sersic");
+		TS_ASSERT_THROWS(m.evaluate_batch({{foreign, "re"}}, {{1.}}), const invalid_parameter &);
+		TS_ASSERT_THROWS(m.evaluate_batch(parameters, {{1., 2.}}), const invalid_parameter &);
+	}
+
+	void test_derivatives()
+	{
+		// Derivatives must match the central differences of whole model
+		// images. The sersic profile subsamples all pixels without
+		// recursion, so its integration points don't depend on its parameters
+		std::vector<std::pair<std::string, double>> sersic_parameters {
+			{"xcen", 14.3}, {"ycen", 16.8}, {"mag", 15.}, {"re", 5.5},
+			{"nser", 2.3}, {"ang", 30.}, {"axrat", 0.6}, {"box", 0.1}
+		};
+		double bg = 1e-2;
+		auto evaluate = [&](bool convolve, unsigned int finesampling,
+		                    const std::string &shifted_parameter, double shift,
+		                    std::vector<Image> *derivatives) {
+			Model m(30, 30);
+			m.set_finesampling(finesampling);
+			m.set_psf({{0.1, 0.2, 0.1, 0.2, 0.4, 0.2, 0.1, 0.2, 0.1}, 3, 3});
+			auto sersic = m.add_profile("sersic");
+			std::vector<std::string> names;
+			for (auto &parameter: sersic_parameters) {
+				double value = parameter.second;
+				if (parameter.first == shifted_parameter) {
+					value += shift;
+				}
+				sersic->parameter(parameter.first, value);
+				names.push_back(parameter.first);
+			}
+			sersic->parameter("adjust", false);
+			sersic->parameter("rscale_switch", 100.);
+			sersic->parameter("max_recursions", 0u);
+			sersic->parameter("resolution", 4u);
+			sersic->parameter("convolve", convolve);
+			auto sky = m.add_profile("sky");
+			sky->parameter("bg", shifted_parameter == "bg" ? bg + shift : bg);
+			if (!derivatives) {
+				return m.evaluate();
+			}
+			sersic->set_derivative_parameters(names);
+			sky->set_derivative_parameters({"bg"});
+			return m.evaluate(*derivatives);
+		};
+
+		for (bool convolve: {false, true}) {
+			for (unsigned int finesampling: {1u, 2u}) {
+				std::vector<Image> derivatives;
+				auto image = evaluate(convolve, finesampling, "", 0, &derivatives);
+				TS_ASSERT_EQUALS(image, evaluate(convolve, finesampling, "", 0, nullptr));
+				TS_ASSERT_EQUALS(derivatives.size(), sersic_parameters.size() + 1);
+
+				auto derivative = derivatives.begin();
+				auto check_derivative = [&](const std::string &name, double value) {
+					double step = 1e-5 * std::max(1., std::abs(value));
+					auto upper = evaluate(convolve, finesampling, name, step, nullptr);
+					auto lower = evaluate(convolve, finesampling, name, -step, nullptr);
+					TS_ASSERT_EQUALS(derivative->getDimensions(), image.getDimensions());
+					// The expected values carry the rounding errors of the
+					// images divided by the step
+					double max_expected = 0;
+					for (unsigned int i = 0; i != image.size(); i++) {
+						max_expected = std::max(max_expected, std::abs(upper[i] - lower[i]) / (2 * step));
+					}
+					double max_value = *std::max_element(image.begin(), image.end());
+					double tolerance = max_expected * 1e-5 + max_value * 1e-10 / step;
+					for (unsigned int i = 0; i != image.size(); i++) {
+						double expected = (upper[i] - lower[i]) / (2 * step);
+						TSM_ASSERT_DELTA(name, expected, (*derivative)[i], tolerance);
+					}
+					derivative++;
+				};
+				for (auto &parameter: sersic_parameters) {
+					check_derivative(parameter.first, parameter.second);
+				}
+				check_derivative("bg", bg);
+			}
+		}
+
+		// Only existing double parameters can be derived
+		Model m(30, 30);
+		auto sersic = m.add_profile("sersic");
+		TS_ASSERT_THROWS(sersic->set_derivative_parameters({"unknown"}), const invalid_parameter &);
+		TS_ASSERT_THROWS(sersic->set_derivative_parameters({"rough"}), const invalid_parameter &);
+	}
+
 	void test_finesampling()
 	{
 
@@ -363,8 +611,9 @@ public:
 		auto expected_offset = Dimensions{0, 0};
 		auto expected_uncropped_img_dims = expected_img_dims;
 		if (conv_type == ConvolverType::FFT) {
-			expected_offset = expected_img_dims / 2 - 1;
-			expected_uncropped_img_dims = expected_img_dims * 2;
+			// image + psf - 1, rounded up to a size with only 2, 3, 5 and 7
+			// as prime factors: 21 = 3 * 7 and 42 = 2 * 3 * 7
+			expected_uncropped_img_dims = finesampling == 1 ? Dimensions{21, 21} : Dimensions{42, 42};
 		}
 		Point offset;
 		m.set_crop(false);
@@ -24,6 +24,9 @@
  * along with libprofit.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <numeric>
 #include <vector>
 
 #include "common_test_setup.h"
@@ -83,6 +86,415 @@ public:
 		}
 	}
 
+	void test_footprint_circular(void) {
+
+		// A circular profile truncated at rscale_max must have all pixels
+		// outside that radius set to 0, and all inside set to some value
+		Model m {50, 50};
+		auto sp = m.add_profile("sersic");
+		sp->parameter("xcen", 20.3);
+		sp->parameter("ycen", 27.6);
+		sp->parameter("re", 5.);
+		sp->parameter("rscale_max", 2.);
+		sp->parameter("adjust", false);
+		auto image = m.evaluate();
+
+		for (unsigned int j = 0; j != 50; j++) {
+			for (unsigned int i = 0; i != 50; i++) {
+				double x = i + 0.5 - 20.3;
+				double y = j + 0.5 - 27.6;
+				double r = std::sqrt(x * x + y * y);
+				auto pixel = image[i + j * 50];
+				if (r < 10 * (1 - 1e-6)) {
+					TS_ASSERT_DIFFERS(0, pixel);
+				}
+				else if (r > 10 * (1 + 1e-6)) {
+					TS_ASSERT_EQUALS(0, pixel);
+				}
+			}
+		}
+	}
+
+	void test_footprint_cropping(void) {
+
+		// Evaluating a profile on a smaller image must give the same values
+		// than those of the same region of a bigger image, even when the
+		// profile's footprint is only partially within the smaller image
+		for(auto pname: all_radial) {
+			for(auto box: {0., -0.5, 0.5}) {
+				auto evaluate = [&](unsigned int width, unsigned int height) {
+					Model m {width, height};
+					auto radialp = m.add_profile(pname);
+					radialp->parameter("xcen", 30.);
+					radialp->parameter("ycen", 25.);
+					radialp->parameter("ang", 33.);
+					radialp->parameter("axrat", 0.4);
+					radialp->parameter("box", box);
+					return m.evaluate();
+				};
+				auto big = evaluate(60, 60);
+				auto small = evaluate(33, 27);
+				for (unsigned int j = 0; j != 27; j++) {
+					for (unsigned int i = 0; i != 33; i++) {
+						TS_ASSERT_EQUALS(big[i + j * 60], small[i + j * 33]);
+					}
+				}
+			}
+		}
+	}
+
+	void test_evaluate_footprint(void) {
+
+		// Profiles evaluated on their footprint only give the same values
+		// as when evaluated on the whole image, where pixels outside the
+		// footprint are left untouched
+		for(auto pname: all_radial) {
+			Model m {200, 200};
+			auto radialp = m.add_profile(pname);
+			radialp->parameter("xcen", 80.3);
+			radialp->parameter("ycen", 95.6);
+			radialp->parameter("ang", 33.);
+			radialp->parameter("axrat", 0.4);
+			radialp->parameter("rscale_max", 5.);
+			radialp->parameter("adjust", false);
+			auto image = m.evaluate();
+
+			Box region;
+			radialp->adjust_for_finesampling(1);
+			auto footprint = radialp->evaluate_footprint({200, 200}, region, Mask(), {1, 1}, {0, 0}, 0);
+			TS_ASSERT_EQUALS(footprint.getDimensions(), region.second - region.first);
+			TS_ASSERT_LESS_THAN(footprint.size(), image.size());
+			for (unsigned int j = 0; j != 200; j++) {
+				for (unsigned int i = 0; i != 200; i++) {
+					bool inside = i >= region.first.x && i < region.second.x &&
+					              j >= region.first.y && j < region.second.y;
+					auto value = inside ? footprint[(i - region.first.x) + (j - region.first.y) * footprint.getWidth()] : 0.;
+					TS_ASSERT_EQUALS(image[i + j * 200], value);
+				}
+			}
+		}
+	}
+
+	void test_subsampling_openmp(void) {
+
+		// Subsampled pixels are refined in parallel, level by level,
+		// so we check again with a profile that needs deep subsampling
+		// and a varying number of threads
+		if (!has_openmp()) {
+			return;
+		}
+		auto evaluate = [](unsigned int threads) {
+			Model m {60, 60};
+			m.set_omp_threads(threads);
+			auto sp = m.add_profile("sersic");
+			sp->parameter("xcen", 30.2);
+			sp->parameter("ycen", 29.7);
+			sp->parameter("nser", 6.);
+			sp->parameter("re", 3.);
+			sp->parameter("axrat", 0.3);
+			sp->parameter("ang", 70.);
+			return m.evaluate();
+		};
+		auto reference = evaluate(1);
+		for(auto threads: {2, 3, 5}) {
+			TS_ASSERT_EQUALS(reference, evaluate(threads));
+		}
+	}
+
+	void test_instruction_sets(void) {
+
+		// Vectorised evaluation must yield the same results
+		// as the scalar evaluation, up to rounding errors
+		for(auto pname: all_radial) {
+			for(auto rough: {false, true}) {
+				for(auto box: {0., 0.3}) {
+					auto evaluate = [&](simd_instruction_set instruction_set) {
+						Model m {40, 40};
+						m.set_instruction_set(instruction_set);
+						auto radialp = m.add_profile(pname);
+						radialp->parameter("xcen", 20.);
+						radialp->parameter("ycen", 18.);
+						radialp->parameter("ang", 33.);
+						radialp->parameter("axrat", 0.4);
+						radialp->parameter("box", box);
+						radialp->parameter("rough", rough);
+						return m.evaluate();
+					};
+					auto reference = evaluate(NONE);
+					auto peak = *std::max_element(reference.begin(), reference.end());
+					for(auto instruction_set: {AUTO, SSE2, AVX}) {
+						if (!has_simd_instruction_set(instruction_set)) {
+							Model m;
+							TS_ASSERT_THROWS(m.set_instruction_set(instruction_set), invalid_parameter &);
+							continue;
+						}
+						auto image = evaluate(instruction_set);
+						for(unsigned int i = 0; i != image.size(); i++) {
+							TS_ASSERT_DELTA(reference[i], image[i], peak * 1e-12);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void test_single_precision(void) {
+
+		// Single-precision evaluation must yield the same results
+		// as the double-precision evaluation, up to float rounding errors
+		for(auto pname: all_radial) {
+			for(auto rough: {false, true}) {
+				for(auto box: {0., 0.3}) {
+					for(auto instruction_set: {NONE, AUTO}) {
+						auto evaluate = [&](bool single_precision) {
+							Model m {40, 40};
+							m.set_instruction_set(instruction_set);
+							m.set_single_precision(single_precision);
+							auto radialp = m.add_profile(pname);
+							radialp->parameter("xcen", 20.3);
+							radialp->parameter("ycen", 18.1);
+							radialp->parameter("ang", 33.);
+							radialp->parameter("axrat", 0.4);
+							radialp->parameter("box", box);
+							radialp->parameter("rough", rough);
+							return m.evaluate();
+						};
+						auto reference = evaluate(false);
+						auto peak = *std::max_element(reference.begin(), reference.end());
+						auto image = evaluate(true);
+						for(unsigned int i = 0; i != image.size(); i++) {
+							TS_ASSERT_DELTA(reference[i], image[i], peak * 1e-5);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void test_specialised_exponents(void) {
+
+		// Evaluation functions specialised for common exponents must yield
+		// the same results as the general ones, which we force by moving the
+		// exponents slightly away from their specialised values
+		std::vector<std::pair<const char *, std::vector<std::pair<std::string, double>>>> profiles {
+			{"moffat", {{"con", 1.5}}}, {"moffat", {{"con", 2}}}, {"moffat", {{"con", 3}}},
+			{"ferrer", {{"a", 1}, {"b", 1}}}, {"ferrer", {{"a", 2}, {"b", 0}}}, {"ferrer", {{"a", 3}, {"b", 1.5}}},
+			{"king", {{"a", 0.5}}}, {"king", {{"a", 2}}}, {"king", {{"a", 4}}},
+			{"coresersic", {{"a", 1}, {"nser", 4}}}, {"coresersic", {{"a", 2}, {"nser", 1}}},
+			{"brokenexp", {}}
+		};
+		for(auto &profile: profiles) {
+			for(auto box: {0., 0.3}) {
+				for(auto instruction_set: {NONE, AUTO}) {
+					auto evaluate = [&](double shift) {
+						Model m {40, 40};
+						m.set_instruction_set(instruction_set);
+						auto radialp = m.add_profile(profile.first);
+						radialp->parameter("xcen", 20.3);
+						radialp->parameter("ycen", 18.1);
+						radialp->parameter("ang", 33.);
+						radialp->parameter("axrat", 0.4);
+						radialp->parameter("box", box);
+						radialp->parameter("rough", true);
+						for(auto &param: profile.second) {
+							radialp->parameter(param.first, param.second + shift);
+						}
+						return m.evaluate();
+					};
+					auto reference = evaluate(1e-9);
+					auto peak = *std::max_element(reference.begin(), reference.end());
+					auto image = evaluate(0);
+					for(unsigned int i = 0; i != image.size(); i++) {
+						TS_ASSERT_DELTA(reference[i], image[i], peak * 1e-7);
+					}
+				}
+			}
+		}
+	}
+
+	void test_tabulate(void) {
+
+		// Tabulated evaluation must yield the same results as the
+		// direct evaluation within the requested accuracy, with or without
+		// vectorisation, and be ignored for boxy profiles
+		for(auto pname: all_radial) {
+			for(auto rough: {false, true}) {
+				for(auto box: {0., 0.3}) {
+					auto evaluate = [&](bool tabulate, simd_instruction_set instruction_set) {
+						Model m {40, 40};
+						m.set_instruction_set(instruction_set);
+						auto radialp = m.add_profile(pname);
+						radialp->parameter("xcen", 20.);
+						radialp->parameter("ycen", 18.);
+						radialp->parameter("ang", 33.);
+						radialp->parameter("axrat", 0.4);
+						radialp->parameter("box", box);
+						radialp->parameter("rough", rough);
+						radialp->parameter("tabulate", tabulate);
+						radialp->parameter("tabulate_acc", 1e-7);
+						return m.evaluate();
+					};
+					auto reference = evaluate(false, NONE);
+					for(auto instruction_set: {NONE, AUTO}) {
+						auto image = evaluate(true, instruction_set);
+						if (box != 0) {
+							TS_ASSERT_EQUALS(evaluate(false, instruction_set), image);
+							continue;
+						}
+						for(unsigned int i = 0; i != image.size(); i++) {
+							TS_ASSERT_DELTA(reference[i], image[i], reference[i] * 1e-6);
+						}
+					}
+				}
+			}
+		}
+
+		Model m {10, 10};
+		auto radialp = m.add_profile("coresersic");
+		radialp->parameter("tabulate", true);
+		radialp->parameter("tabulate_acc", 0.);
+		TS_ASSERT_THROWS(m.evaluate(), invalid_parameter &);
+	}
+
+	void test_symmetric_placement(void) {
+
+		// Profiles centred on a pixel centre or corner produce point-symmetric
+		// images, which must be the same (within accuracy) as those of a
+		// profile placed slightly off, and respect masks.
+		// Mirrored pixels share their refinement decisions only when they
+		// are evaluated together, so the reference is evaluated in two
+		// halves that never contain both pixels of a mirrored pair
+		Mask mask {40, 40};
+		for(unsigned int i = 0; i != mask.size(); i++) {
+			mask[i] = (i % 7) != 0;
+		}
+		for(auto pname: all_radial) {
+			for(auto box: {0., 0.3}) {
+				for(auto centre: {std::make_pair(20., 18.), std::make_pair(20.5, 18.5), std::make_pair(20., 18.5)}) {
+					auto mirror_i = static_cast<unsigned int>(2 * centre.first - 1);
+					auto mirror_j = static_cast<unsigned int>(2 * centre.second - 1);
+					Mask first_half {40, 40};
+					Mask second_half {40, 40};
+					for(int j = 0; j != 40; j++) {
+						for(int i = 0; i != 40; i++) {
+							auto mirror = std::make_pair(int(mirror_j) - j, int(mirror_i) - i);
+							first_half[i + j * 40] = std::make_pair(j, i) <= mirror;
+							second_half[i + j * 40] = !first_half[i + j * 40];
+						}
+					}
+					auto evaluate = [&](double offset, const Mask &mask) {
+						Model m {40, 40};
+						m.set_mask(mask);
+						auto radialp = m.add_profile(pname);
+						radialp->parameter("xcen", centre.first + offset);
+						radialp->parameter("ycen", centre.second - offset);
+						radialp->parameter("ang", 33.);
+						radialp->parameter("axrat", 0.4);
+						radialp->parameter("box", box);
+						return m.evaluate();
+					};
+					auto image = evaluate(0, Mask{});
+					auto reference = evaluate(1e-9, first_half);
+					reference += evaluate(1e-9, second_half);
+					auto peak = *std::max_element(reference.begin(), reference.end());
+					for(unsigned int j = mirror_j - 39; j <= mirror_j; j++) {
+						for(unsigned int i = mirror_i - 39; i <= mirror_i; i++) {
+							TS_ASSERT_EQUALS(image[i + j * 40], image[(mirror_i - i) + (mirror_j - j) * 40]);
+						}
+					}
+					for(unsigned int i = 0; i != image.size(); i++) {
+						TS_ASSERT_DELTA(reference[i], image[i], peak * 1e-6);
+					}
+					auto masked = evaluate(0, mask);
+					for(unsigned int i = 0; i != image.size(); i++) {
+						TS_ASSERT_EQUALS(mask[i] ? image[i] : 0, masked[i]);
+					}
+				}
+			}
+		}
+	}
+
+	void test_repeated_evaluation(void) {
+
+		// Evaluating a Model again after changing some of its profiles'
+		// parameters must give the same result than a new Model with
+		// those parameter values, even when automatically adjusting
+		// the subsampling parameters
+		auto set_parameters = [](ProfilePtr &p, double xcen, double axrat, double mag) {
+			p->parameter("xcen", xcen);
+			p->parameter("ycen", 18.);
+			p->parameter("ang", 33.);
+			p->parameter("axrat", axrat);
+			p->parameter("mag", mag);
+		};
+		auto evaluate_new = [&](const char *pname, double xcen, double axrat, double mag) {
+			Model m {40, 40};
+			auto radialp = m.add_profile(pname);
+			set_parameters(radialp, xcen, axrat, mag);
+			return m.evaluate();
+		};
+		for(auto pname: all_radial) {
+			Model m {40, 40};
+			auto radialp = m.add_profile(pname);
+			for(auto xcen: {20.3, 21.7}) {
+				for(auto axrat: {0.4, 0.7}) {
+					for(auto mag: {15., 14.}) {
+						set_parameters(radialp, xcen, axrat, mag);
+						TS_ASSERT_EQUALS(evaluate_new(pname, xcen, axrat, mag), m.evaluate());
+						TS_ASSERT_EQUALS(evaluate_new(pname, xcen, axrat, mag), m.evaluate());
+					}
+				}
+			}
+		}
+	}
+
+	void test_adjusted_parameters_unchanged(void) {
+
+		// Automatically adjusted subsampling parameters keep the values
+		// given by users, so giving them again doesn't count as a change
+		for(auto pname: all_radial) {
+			Model m {40, 40};
+			auto radialp = m.add_profile(pname);
+			radialp->parameter("xcen", 20.3);
+			radialp->parameter("ycen", 18.);
+			radialp->parameter("acc", 0.2);
+			radialp->parameter("rscale_switch", 1.5);
+			radialp->parameter("resolution", 5u);
+			radialp->parameter("rscale_max", 0.);
+			auto image = m.evaluate();
+			auto changes = radialp->get_parameter_changes();
+			radialp->parameter("acc", 0.2);
+			radialp->parameter("rscale_switch", 1.5);
+			radialp->parameter("resolution", 5u);
+			radialp->parameter("rscale_max", 0.);
+			TS_ASSERT_EQUALS(changes, radialp->get_parameter_changes());
+			TS_ASSERT_EQUALS(image, m.evaluate());
+		}
+	}
+
+	void test_ferrer_default_accuracy(void) {
+
+		// The ferrer profile defaults to acc = 1, unlike other profiles,
+		// and its default image is the one it has always produced
+		auto evaluate = [](double acc) {
+			Model m {20, 20};
+			auto radialp = m.add_profile("ferrer");
+			radialp->parameter("xcen", 10.3);
+			radialp->parameter("ycen", 9.6);
+			radialp->parameter("rout", 6.);
+			radialp->parameter("axrat", 0.6);
+			radialp->parameter("ang", 20.);
+			radialp->parameter("adjust", false);
+			if (acc > 0) {
+				radialp->parameter("acc", acc);
+			}
+			return m.evaluate();
+		};
+		auto image = evaluate(0);
+		TS_ASSERT_EQUALS(evaluate(1), image);
+		TS_ASSERT_DELTA(9.927155551886438e-07, std::accumulate(image.begin(), image.end(), 0.), 1e-18);
+	}
+
 	void test_calcmask(void) {
 
 		Model m {3, 3};
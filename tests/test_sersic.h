@@ -62,4 +62,135 @@ public:
 		_test_different_nser(0.1);
 	}
 
+	void test_cache_center(void) {
+
+		// Only the pixels closest to the centre are taken from the cache,
+		// and their values are within 0.5% of accurately integrated ones
+		auto evaluate = [](bool cache_center, bool accurate) {
+			Model m {20, 20};
+			auto sersicp = m.add_profile("sersic");
+			sersicp->parameter("xcen", 10.3);
+			sersicp->parameter("ycen", 9.8);
+			sersicp->parameter("nser", 3.3);
+			sersicp->parameter("re", 6.);
+			sersicp->parameter("axrat", 0.6);
+			sersicp->parameter("ang", 40.);
+			sersicp->parameter("cache_center", cache_center);
+			if (accurate) {
+				sersicp->parameter("adjust", false);
+				sersicp->parameter("acc", 0.01);
+				sersicp->parameter("resolution", 8u);
+				sersicp->parameter("max_recursions", 10u);
+				sersicp->parameter("rscale_switch", 0.3);
+			}
+			return m.evaluate();
+		};
+
+		auto reference = evaluate(false, false);
+		auto accurate = evaluate(false, true);
+		auto image = evaluate(true, false);
+		for (unsigned int j = 0; j != 20; j++) {
+			for (unsigned int i = 0; i != 20; i++) {
+				auto idx = i + j * 20;
+				if ((i == 9 || i == 10) && (j == 9 || j == 10)) {
+					TS_ASSERT_DELTA(accurate[idx], image[idx], accurate[idx] * 5e-3);
+				}
+				else {
+					TS_ASSERT_EQUALS(reference[idx], image[idx]);
+				}
+			}
+		}
+		TS_ASSERT(file_exists(get_profit_home() + "/sersic_cache/central_pixels"));
+
+		// Values are the same once they are cached
+		TS_ASSERT_EQUALS(image, evaluate(true, false));
+
+		// Clearing the library's cache forgets them, and they are
+		// calculated (and stored) again on the next evaluation
+		clear_cache();
+		TS_ASSERT(!dir_exists(get_profit_home() + "/sersic_cache"));
+		TS_ASSERT_EQUALS(image, evaluate(true, false));
+		TS_ASSERT(file_exists(get_profit_home() + "/sersic_cache/central_pixels"));
+	}
+
+	void test_fast_math(void) {
+
+		// Fast math functions give values within a small fraction of acc
+		// of those given by the accurate functions, both for the individual
+		// pixels and for the total flux. They are only used by the vectorised
+		// evaluation.
+		// Each accuracy selects a different fast math order. Only the central
+		// pixels are subsampled, which keeps the higher accuracies affordable,
+		// except for the highest order, which is checked without subsampling
+		struct accuracy {
+			double acc;
+			bool rough;
+		};
+		for(auto box: {0., 0.3}) {
+			for(auto nser: {0.7, 1.3, 2.5, 4., 6.1}) {
+				for(auto accuracy: {accuracy{0.1, false}, accuracy{0.05, false},
+				                    accuracy{1e-4, false}, accuracy{1e-8, true}}) {
+					auto acc = accuracy.acc;
+					auto evaluate = [&](bool fast_math, simd_instruction_set instruction_set) {
+						Model m {30, 30};
+						m.set_instruction_set(instruction_set);
+						auto sersicp = m.add_profile("sersic");
+						sersicp->parameter("xcen", 14.3);
+						sersicp->parameter("ycen", 15.6);
+						sersicp->parameter("re", 4.);
+						sersicp->parameter("nser", nser);
+						sersicp->parameter("box", box);
+						sersicp->parameter("axrat", 0.7);
+						sersicp->parameter("ang", 25.);
+						sersicp->parameter("acc", acc);
+						sersicp->parameter("rough", accuracy.rough);
+						sersicp->parameter("rscale_switch", 0.25);
+						sersicp->parameter("adjust", false);
+						sersicp->parameter("fast_math", fast_math);
+						return m.evaluate();
+					};
+					auto reference = evaluate(false, AUTO);
+					auto image = evaluate(true, AUTO);
+					for(unsigned int i = 0; i != image.size(); i++) {
+						TS_ASSERT_DELTA(reference[i], image[i], reference[i] * acc * 5e-2);
+					}
+					TS_ASSERT_DELTA(reference.total(), image.total(), reference.total() * acc * 1e-3);
+					TS_ASSERT_EQUALS(evaluate(false, NONE), evaluate(true, NONE));
+				}
+			}
+		}
+	}
+
+	void test_fast_math_adjusted(void) {
+
+		// Errors of the fast math functions are amplified in the exponent of
+		// the profile, more so for concentrated profiles far from their
+		// centre, but the values still stay within a thousandth of the
+		// requested accuracy when acc is automatically adjusted.
+		// Without subsampling only the functions differ
+		for(auto nser: {2.5, 6.1, 9.}) {
+			for(auto acc: {0.1, 1e-3}) {
+				auto evaluate = [&](bool fast_math) {
+					Model m {100, 100};
+					auto sersicp = m.add_profile("sersic");
+					sersicp->parameter("xcen", 50.3);
+					sersicp->parameter("ycen", 49.6);
+					sersicp->parameter("re", 2.);
+					sersicp->parameter("nser", nser);
+					sersicp->parameter("axrat", 0.5);
+					sersicp->parameter("ang", 30.);
+					sersicp->parameter("acc", acc);
+					sersicp->parameter("rough", true);
+					sersicp->parameter("fast_math", fast_math);
+					return m.evaluate();
+				};
+				auto reference = evaluate(false);
+				auto image = evaluate(true);
+				for(unsigned int i = 0; i != image.size(); i++) {
+					TS_ASSERT_DELTA(reference[i], image[i], reference[i] * acc * 1e-3);
+				}
+			}
+		}
+	}
+
 };
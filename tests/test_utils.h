@@ -28,8 +28,10 @@
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <vector>
 
 #include "common_test_setup.h"
+#include "profit/omp_utils.h"
 
 #ifdef PROFIT_USES_GSL
 	#include <gsl/gsl_errno.h>
@@ -99,6 +101,37 @@ public:
 		}
 	}
 
+	void test_omp_tiled_2d_for() {
+
+		// All points of the grid must be visited exactly once,
+		// regardless of the number of threads and the tiles' costs
+		for(int threads: {1, 2, 3}) {
+			std::vector<int> visits(23 * 17, 0);
+			std::vector<int> tile_visits(3 * 5, 0);
+			auto cost = [](const grid_tile &tile) {
+				return double(tile.index % 4);
+			};
+			omp_tiled_2d_for(threads, 2, 25, 1, 18, 8, 4, cost, [&](const grid_tile &tile) {
+				tile_visits[tile.index]++;
+				for (unsigned int j = tile.j0; j < tile.j1; j++) {
+					for (unsigned int i = tile.i0; i < tile.i1; i++) {
+						visits[(i - 2) + (j - 1) * 23]++;
+					}
+				}
+			});
+			for(auto n: visits) {
+				TS_ASSERT_EQUALS(1, n);
+			}
+			for(auto n: tile_visits) {
+				TS_ASSERT_EQUALS(1, n);
+			}
+		}
+
+		// empty grids don't call anything
+		omp_tiled_2d_for(2, 5, 5, 0, 10, 4, 4, [](const grid_tile &) { return 0.; },
+		                 [](const grid_tile &) { TS_FAIL("no tiles expected"); });
+	}
+
 	void test_get_profit_home() {
 
 		// Test both the normal, HOME-based profit home directory